@@ -0,0 +1,162 @@
+#define _POSIX_C_SOURCE 200809L
+
+/**
+ * @brief il seguente file contiene il benchmark dei messaggi a tutti
+ * 		(POSTTXTALL): con "utenti" registrati (uno su dieci online, ognuno
+ * 		con una chat privata di tre messaggi) misura la latenza di
+ * 		manage_postmessage, in una transazione per messaggio come negli
+ * 		slaves, e le istruzioni SQL eseguite per ogni messaggio. Misura poi
+ * 		la cronologia (GETPREVMSGS) che unisce i messaggi a tutti
+ *
+ * @file benchbroadcast.c
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-14
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "queries.h"
+#include "presence.h"
+#include "chatcache.h"
+#include "groups.h"
+
+#define BENCH_DB "/tmp/chatty_benchbroadcast.db"
+#define BENCH_HISTORY_CALLS 2000
+#define BENCH_FIRST_FD 16
+
+static long no_stmts = 0; /* istruzioni eseguite (BEGIN e COMMIT escluse) */
+
+/**
+ * @return double istante attuale in nanosecondi (CLOCK_MONOTONIC)
+ */
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/**
+ * @brief conta le istruzioni eseguite sul database (SQLITE_TRACE_STMT)
+ *
+ */
+static int count_stmt(unsigned int type, void *ctx, void *stmt, void *sql)
+{
+	const char *text = sqlite3_sql((sqlite3_stmt *)stmt);
+
+	if ((strncmp(text, "BEGIN", 5) != 0) && (strncmp(text, "COMMIT", 6) != 0))
+		no_stmts++;
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if ((argc < 2) || (argc > 3))
+	{
+		fprintf(stderr, "uso: %s <utenti> [messaggi a tutti]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	int no_users = atoi(argv[1]);
+	int no_broadcasts = (argc == 3) ? atoi(argv[2]) : 20;
+	if ((no_users < 2) || (no_broadcasts < 2))
+	{
+		fprintf(stderr, "almeno 2 utenti e 2 messaggi a tutti\n");
+		return EXIT_FAILURE;
+	}
+	char (*names)[MAX_NAME_LENGTH + 1] = safe_malloc(no_users * sizeof(*names));
+	int no_online = (no_users + 9) / 10;
+	sqlite3 *db;
+
+	unlink(BENCH_DB);
+	if (sqlite3_open(BENCH_DB, &db) != SQLITE_OK)
+	{
+		fprintf(stderr, "%s: %s\n", BENCH_DB, sqlite3_errmsg(db));
+		return EXIT_FAILURE;
+	}
+	sqlite3_exec(db, "PRAGMA journal_mode = MEMORY;", NULL, NULL, NULL);
+	sqlite3_exec(db, createdb(), NULL, NULL, NULL);
+	for (int v = 0; migratedb(v); v++)
+		sqlite3_exec(db, migratedb(v), NULL, NULL, NULL);
+	if ((presence_init(BENCH_FIRST_FD + no_online) != EXIT_SUCCESS) ||
+		 (chatcache_init(DEFAULT_CHAT_CACHE_SIZE) != EXIT_SUCCESS) ||
+		 (groups_init(BENCH_FIRST_FD + no_online) != EXIT_SUCCESS))
+	{
+		fprintf(stderr, "inizializzazione dei registri fallita\n");
+		return EXIT_FAILURE;
+	}
+
+	/* utenti, ognuno con una chat privata con il successivo */
+	exec_begin_batch(db);
+	for (int i = 0; i < no_users; i++)
+	{
+		snprintf(names[i], MAX_NAME_LENGTH + 1, "user%07d", i);
+		exec_insertuser(db, names[i]);
+	}
+	for (int i = 0; i < no_users; i++)
+	{
+		sqlite3_int64 chat = exec_createchat(db);
+		exec_insert_user_in_chat(db, names[i], chat);
+		exec_insert_user_in_chat(db, names[(i + 1) % no_users], chat);
+		for (int k = 0; k < 3; k++)
+			exec_insertmessage(db, names[(i + 1) % no_users], "messaggio privato", chat);
+	}
+	exec_end_batch(db, no_users);
+	for (int i = 0; i < no_online; i++)
+		presence_connect(names[i * 10], BENCH_FIRST_FD + i);
+
+	message_t msg;
+	memset(&msg, 0, sizeof(message_t));
+	setHeader(&(msg.hdr), POSTTXTALL_OP, names[1]);
+	setData(&(msg.data), "", "messaggio a tutti", strlen("messaggio a tutti") + 1);
+	sqlite3_trace_v2(db, SQLITE_TRACE_STMT, count_stmt, NULL);
+
+	/* il primo messaggio compila le query, i successivi sono a regime */
+	double first = 0, start = 0;
+	int no_fd = 0;
+	for (int i = 0; i < no_broadcasts; i++)
+	{
+		enum operation branch;
+		double sent = now();
+		if (i == 1)
+		{
+			no_stmts = 0;
+			start = sent;
+		}
+		exec_begin_batch(db);
+		long *fd = manage_postmessage(&msg, &no_fd, &branch, db);
+		exec_end_batch(db, 1);
+		free(fd);
+		if (i == 0)
+			first = now() - sent;
+	}
+	double steady = (now() - start) / (no_broadcasts - 1);
+	long stmts = no_stmts / (no_broadcasts - 1);
+	sqlite3_trace_v2(db, 0, NULL, NULL);
+
+	/* cronologia: chat privata e messaggi a tutti */
+	start = now();
+	for (int i = 0; i < BENCH_HISTORY_CALLS; i++)
+	{
+		result_set history;
+		exec_getprevmsgs(db, names[(i * 7) % no_users], DEFAULT_MAX_HIST_MSG, &history);
+		result_free(&history);
+	}
+	double history = (now() - start) / BENCH_HISTORY_CALLS;
+
+	printf("%7d %10.3f %10.3f %8ld %8d %12.1f\n", no_users, first / 1e6, steady / 1e6, stmts, no_fd,
+			 history / 1e3);
+
+	exec_finalize(db);
+	sqlite3_close(db);
+	unlink(BENCH_DB);
+	free(names);
+	return EXIT_SUCCESS;
+}
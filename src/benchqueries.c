@@ -0,0 +1,254 @@
+#define _POSIX_C_SOURCE 200809L
+
+/**
+ * @brief il seguente file contiene il microbenchmark delle query (queries.h):
+ * 		popola un database con "messaggi" messaggi e misura il tempo medio
+ * 		di ogni helper exec_*, con le query preparate una sola volta
+ * 		(cache per thread) e ricompilate ad ogni chiamata come prima della
+ * 		cache. Le scritture sono eseguite in una transazione: il tempo è
+ * 		quello delle istruzioni, non della sincronizzazione su disco.
+ * 		Con -n il database è privo degli indici della migrazione 1, per
+ * 		misurare le query al crescere dei dati con e senza indici
+ * 		(benchscale.sh)
+ *
+ * @file benchqueries.c
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-14
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "queries.h"
+
+#define BENCH_DB "/tmp/chatty_benchqueries.db"
+#define BENCH_MAX_ITERATIONS 20000
+#define BENCH_MAX_NS 2.5e8 /* tempo massimo di misura di una query */
+#define BENCH_GROUP_USERS 50
+#define BENCH_MAX_MSGS 32
+
+static sqlite3 *db = NULL;
+static int no_users = 0;
+static char (*names)[MAX_NAME_LENGTH + 1] = NULL;
+static int no_chats = 0;
+static sqlite3_int64 *chats = NULL;
+static int (*members)[2] = NULL; /* utenti di ogni chat */
+static int only_cached = 0;		  /* -c: solo le query in cache */
+static char **selected = NULL;	  /* query da misurare (tutte se NULL) */
+static int no_selected = 0;
+
+/**
+ * @return double istante attuale in nanosecondi (CLOCK_MONOTONIC)
+ */
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/**
+ * @return int 1 se la query "label" va misurata, 0 altrimenti
+ */
+static int is_selected(const char *label)
+{
+	if (!selected)
+		return 1;
+	for (int i = 0; i < no_selected; i++)
+		if (strcmp(selected[i], label) == 0)
+			return 1;
+	return 0;
+}
+
+/**
+ * @brief esegue "body" (iterazione "it") per al più BENCH_MAX_NS e ne
+ * 		restituisce in "us" il tempo medio: con "cached" a 0 le query
+ * 		preparate vengono eliminate dopo ogni chiamata
+ *
+ */
+#define BENCH(us, writes, cached, body)                                   \
+	do                                                                     \
+	{                                                                      \
+		double start = now(), elapsed = 0;                                  \
+		int it = 0;                                                         \
+		if (writes)                                                         \
+			exec_begin_batch(db);                                            \
+		for (; (it < BENCH_MAX_ITERATIONS) && (elapsed < BENCH_MAX_NS); it++) \
+		{                                                                   \
+			body;                                                            \
+			if (!(cached))                                                   \
+				exec_finalize(db);                                            \
+			elapsed = now() - start;                                         \
+		}                                                                   \
+		if (writes)                                                         \
+			exec_end_batch(db, 1);                                           \
+		(us) = elapsed / it / 1e3;                                          \
+	} while (0)
+
+/**
+ * @brief misura "body" con e senza cache delle query e stampa i tempi
+ *
+ */
+#define BENCH_QUERY(label, writes, body)                          \
+	do                                                             \
+	{                                                              \
+		double cached, uncached = 0;                                \
+		if (!is_selected(label))                                    \
+			break;                                                   \
+		BENCH(cached, writes, 1, body);                             \
+		if (!only_cached)                                           \
+			BENCH(uncached, writes, 0, body);                        \
+		printf("%-28s %10.2f %10.2f\n", label, uncached, cached);   \
+	} while (0)
+
+/**
+ * @brief popola il database: "msgs" messaggi (uno su 50 è un file) in
+ * 		chat private casuali, msgs / 20 utenti con in media due chat
+ * 		ciascuno e un gruppo di BENCH_GROUP_USERS utenti
+ *
+ * @return sqlite3_int64 id del gruppo
+ */
+static sqlite3_int64 populate(int msgs)
+{
+	sqlite3_int64 group;
+
+	exec_begin_batch(db);
+	for (int i = 0; i < no_users; i++)
+	{
+		snprintf(names[i], MAX_NAME_LENGTH + 1, "user%07d", i);
+		exec_insertuser(db, names[i]);
+	}
+
+	group = exec_creategroup(db, "group", names[0]);
+	for (int i = 0; i < BENCH_GROUP_USERS; i++)
+		exec_insert_user_in_chat(db, names[i], group);
+
+	for (int i = 0; i < no_chats; i++)
+	{
+		members[i][0] = i % no_users;
+		members[i][1] = (members[i][0] + 1 + (i / no_users) * 7) % no_users;
+		chats[i] = exec_createchat(db);
+		exec_insert_user_in_chat(db, names[members[i][0]], chats[i]);
+		exec_insert_user_in_chat(db, names[members[i][1]], chats[i]);
+	}
+
+	srand(1);
+	for (int m = 0; m < msgs; m++)
+	{
+		int c = rand() % no_chats;
+		char *sender = names[members[c][m & 1]];
+		if (m % 50 == 0)
+			exec_postfile(db, sender, "file.bin", chats[c]);
+		else
+			exec_insertmessage(db, sender, "messaggio di prova", chats[c]);
+	}
+	exec_end_batch(db, msgs);
+
+	return group;
+}
+
+int main(int argc, char *argv[])
+{
+	int no_indexes = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "cn")) != -1)
+	{
+		if (opt == 'c')
+			only_cached = 1;
+		else if (opt == 'n')
+			no_indexes = 1;
+		else
+		{
+			fprintf(stderr, "uso: %s [-c] [-n] [messaggi [query...]]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	int msgs = (optind < argc) ? atoi(argv[optind++]) : 4000;
+	if (optind < argc)
+	{
+		selected = argv + optind;
+		no_selected = argc - optind;
+	}
+	no_users = msgs / 20;
+	if (no_users < BENCH_GROUP_USERS)
+	{
+		fprintf(stderr, "almeno %d messaggi\n", BENCH_GROUP_USERS * 20);
+		return EXIT_FAILURE;
+	}
+	no_chats = no_users * 2;
+	names = safe_malloc(no_users * sizeof(*names));
+	chats = safe_malloc(no_chats * sizeof(*chats));
+	members = safe_malloc(no_chats * sizeof(*members));
+
+	unlink(BENCH_DB);
+	if (sqlite3_open(BENCH_DB, &db) != SQLITE_OK)
+	{
+		fprintf(stderr, "%s: %s\n", BENCH_DB, sqlite3_errmsg(db));
+		return EXIT_FAILURE;
+	}
+	sqlite3_exec(db, "PRAGMA journal_mode = MEMORY;", NULL, NULL, NULL);
+	sqlite3_exec(db, createdb(), NULL, NULL, NULL);
+	for (int v = 0; migratedb(v); v++)
+		sqlite3_exec(db, migratedb(v), NULL, NULL, NULL);
+	if (no_indexes)
+		sqlite3_exec(db, "DROP INDEX _Chat_User_username; DROP INDEX _Message_chat_time;", NULL, NULL, NULL);
+
+	sqlite3_int64 group = populate(msgs);
+	long result;
+	result_set set;
+	char fresh[MAX_NAME_LENGTH + 1];
+
+	printf("%d messaggi, %d utenti%s: us per chiamata\n", msgs, no_users, (no_indexes) ? ", senza indici" : "");
+	printf("%-28s %10s %10s\n", "query", "preparata", "in cache");
+
+	/* letture */
+	BENCH_QUERY("checkexistuser", 0, exec_checkexistuser(db, names[it % no_users], &result));
+	BENCH_QUERY("checkexistname", 0, exec_checkexistname(db, names[it % no_users], &result));
+	BENCH_QUERY("checkexistingchat", 0,
+					exec_checkexistingchat(db, names[members[it % no_chats][0]], names[members[it % no_chats][1]]));
+	BENCH_QUERY("getfile", 0, exec_getfile(db, names[it % no_users], "file.bin", &result));
+	BENCH_QUERY("gettotaluser", 0, exec_gettotaluser(db, &result));
+	BENCH_QUERY("getprevmsgs", 0, (exec_getprevmsgs(db, names[it % no_users], BENCH_MAX_MSGS, &set), result_free(&set)));
+#ifndef MAKE_TEST_HAPPY
+	unsigned long stats[5];
+	BENCH_QUERY("get_from_stats", 0, exec_get_from_stats(db, stats, stats + 1, stats + 2, stats + 3, stats + 4));
+#endif
+
+	/* scritture */
+	BENCH_QUERY("insertmessage", 1, exec_insertmessage(db, names[1], "messaggio di prova", chats[0]));
+	BENCH_QUERY("insertbroadcast", 1, exec_insertbroadcast(db, names[1], "messaggio a tutti"));
+	BENCH_QUERY("postfile+delfile", 1, exec_delfile(db, exec_postfile(db, names[1], "bench.bin", chats[0])));
+#ifndef MAKE_TEST_HAPPY
+	BENCH_QUERY("increasestats", 1, exec_increasestats(db, 0, 0, 1, 0, 0));
+#endif
+	BENCH_QUERY("createchat+insert_user", 1, {
+		sqlite3_int64 chat = exec_createchat(db);
+		exec_insert_user_in_chat(db, names[2], chat);
+		exec_insert_user_in_chat(db, names[3], chat);
+	});
+	BENCH_QUERY("insertuser+removeuser", 1, {
+		snprintf(fresh, sizeof(fresh), "bench%07d", it);
+		exec_insertuser(db, fresh);
+		exec_removeuser(db, fresh);
+	});
+	BENCH_QUERY("insert+removeuser_from_group", 1, {
+		exec_insert_user_in_chat(db, names[BENCH_GROUP_USERS], group);
+		exec_removeuser_from_group(db, group, names[BENCH_GROUP_USERS]);
+	});
+
+	exec_finalize(db);
+	sqlite3_close(db);
+	unlink(BENCH_DB);
+	free(names);
+	free(chats);
+	free(members);
+	return EXIT_SUCCESS;
+}
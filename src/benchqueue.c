@@ -0,0 +1,127 @@
+#define _POSIX_C_SOURCE 200809L
+
+/**
+ * @brief il seguente file contiene il microbenchmark di contesa della coda
+ * 		core -> slaves (queues.c): metà dei thread inseriscono messaggi come
+ * 		i reactor, ognuno sulle proprie connessioni, l'altra metà li estrae
+ * 		come gli slaves (queue_pop_batch, queue_done) senza eseguirli.
+ * 		Misura i messaggi trasferiti al secondo
+ *
+ * @file benchqueue.c
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-14
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "config.h"
+#include "queues.h"
+#include "slaves.h"
+#include "utils.h"
+
+/* connessioni di ogni produttore (i descrittori partono da FIRST_FD) */
+#define CONNECTIONS_PER_PRODUCER 16
+#define FIRST_FD 16
+#define MAX_THREADS 64
+
+static message_t job;				/* messaggio inserito (mai eseguito) */
+static long per_producer = 0;		/* messaggi inseriti da ogni produttore */
+static long consumed = 0;			/* messaggi estratti da tutti gli slaves */
+
+/**
+ * @return double istante attuale in secondi (CLOCK_MONOTONIC)
+ */
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void *producer(void *arg)
+{
+	int first = FIRST_FD + (int)(long)arg * CONNECTIONS_PER_PRODUCER;
+
+	for (long i = 0; i < per_producer; i++)
+		queue_push(&job, first + (int)(i % CONNECTIONS_PER_PRODUCER));
+
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	wrapper jobs[SLAVE_BATCH_SIZE];
+	unsigned int id = (unsigned int)(long)arg;
+
+	for (;;)
+	{
+		int n = queue_pop_batch(id, jobs, SLAVE_BATCH_SIZE);
+		if (jobs[0].fd == TERMINATION_FD)
+		{
+			free(jobs[0].msg);
+			break;
+		}
+		__atomic_add_fetch(&consumed, n, __ATOMIC_RELAXED);
+		queue_done(jobs, n);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	if ((argc < 2) || (argc > 3))
+	{
+		fprintf(stderr, "uso: %s <thread> [messaggi]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	int threads = atoi(argv[1]);
+	long total = (argc == 3) ? atol(argv[2]) : 2000000;
+	if ((threads < 1) || (threads > MAX_THREADS) || (total < 1))
+	{
+		fprintf(stderr, "thread tra 1 e %d, almeno un messaggio\n", MAX_THREADS);
+		return EXIT_FAILURE;
+	}
+
+	/* con un solo thread un produttore e uno slave */
+	int producers = (threads > 1) ? threads / 2 : 1;
+	int consumers = (threads > 1) ? threads - producers : 1;
+	pthread_t producers_tid[MAX_THREADS], consumers_tid[MAX_THREADS];
+
+	per_producer = total / producers;
+	memset(&job, 0, sizeof(message_t));
+	job.hdr.op = USRLIST_OP;
+
+	queue_init(consumers, DEFAULT_MAX_QUEUED_MSGS,
+				  DEFAULT_MAX_QUEUED_MSGS * DEFAULT_QUEUE_HIGH_WATERMARK / 100, 0,
+				  DEFAULT_INTERACTIVE_WEIGHT, FIRST_FD + producers * CONNECTIONS_PER_PRODUCER);
+	queue_pool_init(consumers, 0);
+
+	double start = now();
+	for (long i = 0; i < consumers; i++)
+		pthread_create(&(consumers_tid[i]), NULL, consumer, (void *)i);
+	for (long i = 0; i < producers; i++)
+		pthread_create(&(producers_tid[i]), NULL, producer, (void *)i);
+
+	for (int i = 0; i < producers; i++)
+		pthread_join(producers_tid[i], NULL);
+	while (__atomic_load_n(&consumed, __ATOMIC_RELAXED) < per_producer * producers)
+		sched_yield();
+	double elapsed = now() - start;
+
+	queue_free();
+	for (int i = 0; i < consumers; i++)
+		pthread_join(consumers_tid[i], NULL);
+	destroy_queue_mutex();
+
+	printf("%2d %2d %2d %.2f\n", threads, producers, consumers, consumed / elapsed / 1e6);
+	return EXIT_SUCCESS;
+}
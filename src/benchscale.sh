@@ -0,0 +1,43 @@
+#! /bin/bash
+
+# benchmark delle query al crescere dei dati (indici dello schema): per ogni
+# numero di messaggi genera il database con benchqueries (messaggi / 20
+# utenti, due chat private ciascuno, un messaggio su 50 è un file) e misura
+# le query più frequenti con e senza gli indici della migrazione 1
+#
+# autore: Marco Costa - 545144
+#
+# Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+# 	opera originale dell'autore
+
+# messaggio di uso
+function usage () {
+    echo "uso: $0 [messaggi...]" 1>&2;
+}
+
+if [ "$1" == "-h" ]; then
+    usage
+    exit 1
+fi
+
+sizes=${@:-10000 100000 1000000}
+queries="checkexistingchat getprevmsgs getfile insertmessage insertbroadcast createchat+insert_user"
+
+[ -x ./benchqueries ] || { echo "********** benchscale FALLITO: manca benchqueries" 1>&2; exit 1; }
+
+noidx=$(mktemp /tmp/chatty_scale_XXXXXX)
+idx=$(mktemp /tmp/chatty_scale_XXXXXX)
+
+printf "%-28s %10s %14s %14s\n" "query" "messaggi" "senza_indici" "con_indici"
+for m in $sizes; do
+    ./benchqueries -c -n $m $queries > $noidx 2>&1 || { cat $noidx 1>&2; exit 1; }
+    ./benchqueries -c $m $queries > $idx 2>&1 || { cat $idx 1>&2; exit 1; }
+    for q in $queries; do
+        before=$(awk -v q="$q" '$1 == q { print $NF }' $noidx)
+        after=$(awk -v q="$q" '$1 == q { print $NF }' $idx)
+        printf "%-28s %10d %14s %14s\n" $q $m ${before:--} ${after:--}
+    done
+done
+
+rm -f $noidx $idx
+exit 0
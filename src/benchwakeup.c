@@ -0,0 +1,102 @@
+#define _POSIX_C_SOURCE 200809L
+
+/**
+ * @brief il seguente file contiene il client del benchmark del risveglio
+ * 		del core (benchwakeup.sh): apre "idle" connessioni che non inviano
+ * 		nulla e misura il tempo medio di andata e ritorno di una richiesta
+ * 		USRLIST da un'ulteriore connessione. Con un backend che non scorre
+ * 		tutti i descrittori ad ogni risveglio il tempo non dipende da "idle"
+ *
+ * @file benchwakeup.c
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-14
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "connections.h"
+#include "ops.h"
+
+/**
+ * @return double istante attuale in secondi (CLOCK_MONOTONIC)
+ */
+static double now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/**
+ * @brief invia la richiesta "op" di "name" e attende la risposta
+ *
+ * @return int 0 se il server risponde OP_OK, -1 altrimenti
+ */
+static int round_trip(int fd, op_t op, char *name)
+{
+	message_t msg;
+
+	setHeader(&(msg.hdr), op, name);
+	setData(&(msg.data), "", NULL, 0);
+	if (sendRequest(fd, &msg) <= 0)
+		return -1;
+	if (readHeader(fd, &(msg.hdr)) <= 0)
+		return -1;
+	if (readData(fd, &(msg.data)) <= 0)
+		return -1;
+	free(msg.data.buf);
+
+	return (msg.hdr.op == OP_OK) ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	if ((argc < 3) || (argc > 4))
+	{
+		fprintf(stderr, "uso: %s <unix_path> <idle> [richieste]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	char *path = argv[1];
+	int idle = atoi(argv[2]);
+	int requests = (argc == 4) ? atoi(argv[3]) : 3000;
+	char name[MAX_NAME_LENGTH + 1];
+
+	/* connessioni inattive: restano aperte fino alla terminazione */
+	for (int i = 0; i < idle; i++)
+		if (openConnection(path, 10, 1) < 0)
+		{
+			fprintf(stderr, "connessione inattiva %d: impossibile connettersi\n", i);
+			return EXIT_FAILURE;
+		}
+
+	int fd = openConnection(path, 10, 1);
+	if (fd < 0)
+	{
+		perror("openConnection");
+		return EXIT_FAILURE;
+	}
+	snprintf(name, sizeof(name), "wake%d", (int)getpid());
+	if (round_trip(fd, REGISTER_OP, name) < 0)
+	{
+		fprintf(stderr, "registrazione di %s fallita\n", name);
+		return EXIT_FAILURE;
+	}
+
+	double start = now();
+	for (int i = 0; i < requests; i++)
+		if (round_trip(fd, USRLIST_OP, name) < 0)
+		{
+			fprintf(stderr, "richiesta %d fallita\n", i);
+			return EXIT_FAILURE;
+		}
+	double elapsed = now() - start;
+
+	printf("%d %.1f\n", idle, elapsed / requests * 1e6);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,89 @@
+#! /bin/bash
+
+# benchmark del risveglio del core (EventBackend): per ogni numero di
+# connessioni inattive misura il tempo medio di andata e ritorno di una
+# richiesta, che con epoll deve restare costante da 100 a 50000 connessioni
+# (select è limitato a FD_SETSIZE descrittori)
+# @warning ogni connessione occupa un descrittore nel server e nel client:
+# 			i valori oltre il limite RLIMIT_NOFILE vengono saltati
+#
+# autore: Marco Costa - 545144
+#
+# Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+# 	opera originale dell'autore
+
+# messaggio di uso
+function usage () {
+    echo "uso: $0 <unix_path> <stat_path> <dir_path> [connessioni...]" 1>&2;
+}
+
+if [ $# -lt 3 ]; then
+    usage
+    exit 1
+fi
+
+upath=$1
+spath=$2
+dpath=$3
+shift 3
+idles=${@:-100 1000 10000 50000}
+
+conf=$(mktemp /tmp/chatty_wake_XXXXXX.conf)
+
+function fail () {
+    echo "********** benchwakeup FALLITO: $1" 1>&2
+    [ -n "$server" ] && kill -9 $server 2> /dev/null
+    rm -f $conf
+    exit 1
+}
+
+# avvia il server con "backend" e spazio per "idle" connessioni
+function start () {
+    cat > $conf <<EOF
+UnixPath = $upath
+MaxConnections = $(($2 + 64))
+ThreadsInPool = 8
+MaxMsgSize = 512
+MaxFileSize = 1024
+MaxHistMsgs = 16
+DirName = $dpath
+StatFileName = $spath
+EventBackend = $1
+EOF
+    rm -f $upath
+    ./chatty -f $conf > /dev/null &
+    server=$!
+    for i in $(seq 50); do
+        [ -S $upath ] && return
+        sleep 0.1
+    done
+    fail "server non avviato"
+}
+
+# provo ad alzare il limite dei descrittori fino a quello massimo
+ulimit -n $(ulimit -Hn) 2> /dev/null
+limit=$(ulimit -n)
+
+mkdir -p $dpath
+echo "backend connessioni_inattive rtt_medio_us"
+for backend in epoll select; do
+    for idle in $idles; do
+        if [ "$backend" == "select" ] && [ $idle -ge 1000 ]; then
+            echo "$backend $idle -"
+            continue
+        fi
+        if [ "$limit" != "unlimited" ] && [ $((idle + 128)) -gt $limit ]; then
+            echo "$backend $idle - (RLIMIT_NOFILE $limit)"
+            continue
+        fi
+        start $backend $idle
+        out=$(timeout 300 ./benchwakeup $upath $idle) || fail "$backend con $idle connessioni"
+        echo "$backend $out"
+        kill -QUIT $server
+        wait $server
+        server=
+    done
+done
+
+rm -f $conf
+exit 0
@@ -0,0 +1,219 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+/**
+ * @brief il seguente file contiene l'implementazione della cache delle chat
+ * 		tra due utenti.
+ * 		La cache è divisa in partizioni, ognuna con il proprio mutex, scelte
+ * 		in base all'hash della coppia: slaves che inviano messaggi a coppie
+ * 		diverse raramente si contendono lo stesso lock. Ogni partizione è
+ * 		associativa a insiemi di CHAT_CACHE_WAYS posizioni: una coppia nuova
+ * 		prende una posizione libera dell'insieme o sostituisce una delle
+ * 		coppie presenti, a rotazione
+ *
+ * @file chatcache.c
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-14
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "chatcache.h"
+#include "utils.h"
+
+#define CACHE_LINE 64
+
+typedef struct chat_entry
+{
+	long long chat_id; /**< CHATCACHE_MISS se la posizione è libera */
+	unsigned int hash1, hash2;
+	char user1[MAX_NAME_LENGTH + 1]; /**< il minore dei due nomi */
+	char user2[MAX_NAME_LENGTH + 1];
+} chat_entry;
+
+typedef struct chat_shard
+{
+	pthread_mutex_t mutex;
+	chat_entry *entries; /**< no_sets * CHAT_CACHE_WAYS posizioni */
+	unsigned int victim; /**< prossima posizione da sostituire */
+	char pad[CACHE_LINE];
+} chat_shard;
+
+static chat_shard shards[CHAT_CACHE_SHARDS];
+static unsigned int sets_mask = 0;
+static int enabled = 0;
+
+/* incrementata ad ogni chatcache_forget */
+static unsigned long epoch = 0;
+
+//-------------------------------------------------------------------------//
+
+/**
+ * @brief ordina la coppia in modo che (a, b) e (b, a) abbiano la stessa
+ * 		chiave e restituisce la posizione del suo insieme
+ *
+ */
+static chat_entry *find_set(const char **user1, const char **user2, unsigned int *h1, unsigned int *h2,
+									 chat_shard **shard)
+{
+	if (strncmp(*user1, *user2, MAX_NAME_LENGTH) > 0)
+	{
+		const char *t = *user1;
+		*user1 = *user2;
+		*user2 = t;
+	}
+
+	*h1 = name_hash(*user1);
+	*h2 = name_hash(*user2);
+	unsigned int h = *h1 * 31u + *h2;
+	h ^= h >> 15;
+
+	*shard = &shards[h & (CHAT_CACHE_SHARDS - 1)];
+	return (*shard)->entries + ((h / CHAT_CACHE_SHARDS) & sets_mask) * CHAT_CACHE_WAYS;
+}
+
+static inline int same_pair(chat_entry *e, const char *user1, const char *user2, unsigned int h1, unsigned int h2)
+{
+	return (e->chat_id != CHATCACHE_MISS) && (e->hash1 == h1) && (e->hash2 == h2) &&
+			 (strncmp(e->user1, user1, MAX_NAME_LENGTH) == 0) &&
+			 (strncmp(e->user2, user2, MAX_NAME_LENGTH) == 0);
+}
+
+//-------------------------------------------------------------------------//
+
+int chatcache_init(unsigned int size)
+{
+	enabled = 0;
+	if (size == 0)
+		return EXIT_SUCCESS;
+
+	/* insiemi per partizione: potenza di 2, almeno uno */
+	unsigned int no_sets = 1;
+	while ((no_sets * 2 * CHAT_CACHE_SHARDS * CHAT_CACHE_WAYS <= size) && (no_sets < (1u << 20)))
+		no_sets <<= 1;
+	sets_mask = no_sets - 1;
+
+	for (int i = 0; i < CHAT_CACHE_SHARDS; i++)
+	{
+		pthread_mutex_init(&shards[i].mutex, NULL);
+		shards[i].victim = 0;
+		shards[i].entries = malloc(no_sets * CHAT_CACHE_WAYS * sizeof(chat_entry));
+		if (!shards[i].entries)
+		{
+			for (int j = 0; j < i; j++)
+				free(shards[j].entries);
+			return EXIT_FAILURE;
+		}
+		for (unsigned int j = 0; j < no_sets * CHAT_CACHE_WAYS; j++)
+			shards[i].entries[j].chat_id = CHATCACHE_MISS;
+	}
+
+	enabled = 1;
+	return EXIT_SUCCESS;
+}
+
+void chatcache_destroy()
+{
+	if (!enabled)
+		return;
+
+	for (int i = 0; i < CHAT_CACHE_SHARDS; i++)
+	{
+		free(shards[i].entries);
+		shards[i].entries = NULL;
+		pthread_mutex_destroy(&shards[i].mutex);
+	}
+	enabled = 0;
+}
+
+long long chatcache_get(const char *user1, const char *user2, unsigned long *curr_epoch)
+{
+	long long chat_id = CHATCACHE_MISS;
+	unsigned int h1, h2;
+	chat_shard *shard;
+
+	/* letta prima della cache: un utente rimosso dopo la lettura rende
+		non valido il successivo chatcache_put */
+	*curr_epoch = __atomic_load_n(&epoch, __ATOMIC_ACQUIRE);
+	if (!enabled)
+		return chat_id;
+
+	chat_entry *set = find_set(&user1, &user2, &h1, &h2, &shard);
+
+	pthread_mutex_lock(&shard->mutex);
+	for (int i = 0; i < CHAT_CACHE_WAYS; i++)
+		if (same_pair(&set[i], user1, user2, h1, h2))
+		{
+			chat_id = set[i].chat_id;
+			break;
+		}
+	pthread_mutex_unlock(&shard->mutex);
+
+	return chat_id;
+}
+
+void chatcache_put(const char *user1, const char *user2, long long chat_id, unsigned long curr_epoch)
+{
+	unsigned int h1, h2;
+	chat_shard *shard;
+
+	if ((!enabled) || (chat_id == CHATCACHE_MISS))
+		return;
+
+	chat_entry *set = find_set(&user1, &user2, &h1, &h2, &shard);
+
+	pthread_mutex_lock(&shard->mutex);
+	/* controllato con il lock della partizione: chatcache_forget incrementa
+		epoch prima di ripulire le partizioni, quindi o vedo il nuovo valore
+		o la coppia viene rimossa dopo il mio inserimento */
+	if (__atomic_load_n(&epoch, __ATOMIC_ACQUIRE) == curr_epoch)
+	{
+		chat_entry *e = NULL;
+		for (int i = 0; (i < CHAT_CACHE_WAYS) && (!e); i++)
+			if ((set[i].chat_id == CHATCACHE_MISS) || (same_pair(&set[i], user1, user2, h1, h2)))
+				e = &set[i];
+		if (!e)
+			e = &set[(shard->victim++) % CHAT_CACHE_WAYS];
+
+		e->chat_id = chat_id;
+		e->hash1 = h1;
+		e->hash2 = h2;
+		strncpy(e->user1, user1, MAX_NAME_LENGTH);
+		e->user1[MAX_NAME_LENGTH] = '\0';
+		strncpy(e->user2, user2, MAX_NAME_LENGTH);
+		e->user2[MAX_NAME_LENGTH] = '\0';
+	}
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+void chatcache_forget(const char *user)
+{
+	__atomic_add_fetch(&epoch, 1, __ATOMIC_SEQ_CST);
+	if (!enabled)
+		return;
+
+	unsigned int h = name_hash(user);
+	unsigned int no_entries = (sets_mask + 1) * CHAT_CACHE_WAYS;
+
+	/* le chat di un utente possono stare in qualsiasi partizione: la
+		deregistrazione è rara e scandisce l'intera cache */
+	for (int i = 0; i < CHAT_CACHE_SHARDS; i++)
+	{
+		pthread_mutex_lock(&shards[i].mutex);
+		for (unsigned int j = 0; j < no_entries; j++)
+		{
+			chat_entry *e = &shards[i].entries[j];
+			if ((e->chat_id != CHATCACHE_MISS) &&
+				 (((e->hash1 == h) && (strncmp(e->user1, user, MAX_NAME_LENGTH) == 0)) ||
+				  ((e->hash2 == h) && (strncmp(e->user2, user, MAX_NAME_LENGTH) == 0))))
+				e->chat_id = CHATCACHE_MISS;
+		}
+		pthread_mutex_unlock(&shards[i].mutex);
+	}
+}
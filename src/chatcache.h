@@ -0,0 +1,62 @@
+/**
+ * @brief il seguente file contiene le dichiarazioni della cache delle chat
+ * 		tra due utenti: associa la coppia di utenti all'id della loro chat,
+ * 		evitando la ricerca su _Chat_User ad ogni messaggio
+ *
+ * @file chatcache.h
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-14
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+#ifndef _CHATCACHE_H_
+#define _CHATCACHE_H_
+
+/* la coppia non è in cache */
+#define CHATCACHE_MISS -1
+
+/**
+ * @brief alloca la cache
+ *
+ * @param size numero massimo di chat in cache, 0 la disattiva
+ * @return int EXIT_SUCCESS | EXIT_FAILURE
+ */
+int chatcache_init(unsigned int size);
+
+/**
+ * @brief libera la cache
+ * @warning nessun thread deve più accedervi
+ *
+ */
+void chatcache_destroy();
+
+/**
+ * @brief restituisce la chat tra "user1" e "user2" (l'ordine non conta)
+ *
+ * @param user1 utente
+ * @param user2 utente
+ * @param epoch versione della cache da passare a chatcache_put se la
+ * 			coppia non è presente
+ * @return long long chat_id | CHATCACHE_MISS
+ */
+long long chatcache_get(const char *user1, const char *user2, unsigned long *epoch);
+
+/**
+ * @brief inserisce la chat tra "user1" e "user2": se nel frattempo è stato
+ * 		rimosso un utente (chatcache_forget) l'inserimento viene ignorato,
+ * 		perché la chat letta dal database potrebbe non esistere più
+ *
+ * @param chat_id id della chat
+ * @param epoch versione restituita da chatcache_get prima di leggere il database
+ */
+void chatcache_put(const char *user1, const char *user2, long long chat_id, unsigned long epoch);
+
+/**
+ * @brief rimuove dalla cache tutte le chat di "user" (deregistrato)
+ *
+ * @param user nome utente
+ */
+void chatcache_forget(const char *user);
+
+#endif /* _CHATCACHE_H_ */
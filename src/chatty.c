@@ -42,6 +42,8 @@
 #include "mystring.h"
 #include "core.h"
 #include "queries.h"
+#include "reactors.h"
+#include "queues.h"
 
 // #include "driver.h"
 
@@ -91,9 +93,8 @@ void *signal_manager(void *arg)
 {
 	struct arg_wrapper *w = arg;
 	int sig;
-	sqlite3 *db;
+	sqlite3 *db = NULL; /* aperto alla prima richiesta: il journal viene scelto da start_core */
 
-	open_db(&db);
 	for (;;)
 	{
 		/* mi metto in pausa finché non mi arriva uno dei segnali
@@ -115,11 +116,18 @@ void *signal_manager(void *arg)
 			FILE *f = fopen(conf_stat, "a+");
 			if (f == NULL)
 				handle_error(STRING_HANDLE_BAD_FILE_WRITING);
+			if (!db)
+				open_db(&db);
 			manage_getstats(db, &chattyStats);
 			printStats(f);
 #ifdef LOG_MSG
 			printStats(stdout);
 #endif
+			/* le metriche dei reactor e degli slaves non fanno parte del
+				formato del file delle statistiche */
+			reactors_print_stats(stdout);
+			queue_print_stats(stdout);
+			db_print_stats(stdout);
 			fclose(f);
 		}
 		/**
@@ -138,7 +146,8 @@ void *signal_manager(void *arg)
 				perror("write");
 			printf("[!!] server in terminazione\n");
 			free(arg);
-			sqlite3_close(db);
+			if (db)
+				close_db(db);
 
 			return (void *)0;
 		}
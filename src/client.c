@@ -246,6 +246,7 @@ static int manage_requestreply(int connfd, operation_t *o)
 		case OP_NICK_ALREADY:
 		case OP_NICK_UNKNOWN:
 		case OP_MSG_TOOLONG:
+		case OP_BUSY:
 		case OP_FAIL:
 		{
 			if (msg.data.buf)
@@ -28,8 +28,36 @@
 #define DEFAULT_MAX_HIST_MSG 32
 #define DEFAULT_DIR_NAME "/tmp/chatty"
 #define DEFAULT_STAT_FILENAME "/tmp/chatty_stats.txt"
+#define DEFAULT_EVENT_BACKEND "epoll" /* epoll | select */
+#define DEFAULT_IO_THREADS 2
+#define DEFAULT_IO_ENGINE "blocking" /* blocking | io_uring (richiede -DIO_URING) */
+#define DEFAULT_MAX_OUTPUT_SIZE 1024 /* 1MB di messaggi in attesa per connessione */
+#define DEFAULT_OUTPUT_FULL_POLICY "drop" /* drop | close */
+#define DEFAULT_MAX_QUEUED_MSGS 8192 /* messaggi in attesa degli slaves */
+#define DEFAULT_QUEUE_HIGH_WATERMARK 75 /* % di MaxQueuedMsgs oltre cui i reactor smettono di leggere */
+#define DEFAULT_QUEUE_FULL_POLICY "throttle" /* throttle | busy */
+#define DEFAULT_RESERVED_SLAVES 1 /* slaves che eseguono solo operazioni interattive */
+#define DEFAULT_INTERACTIVE_WEIGHT 4 /* operazioni interattive per ogni pesante */
+#define DEFAULT_MIN_THREADS_IN_POOL 2 /* slaves sempre attivi, ThreadsInPool è il massimo */
+#define DEFAULT_POOL_IDLE_TIMEOUT 30 /* secondi di inattività prima di ritirare uno slave */
+#define DEFAULT_DB_JOURNAL_MODE "memory" /* memory | wal */
+#define DEFAULT_WAL_CHECKPOINT_PAGES 1000 /* pagine nel WAL oltre cui parte il checkpoint */
+#define DEFAULT_GROUP_COMMIT_MS 0 /* finestra del group commit (solo wal), 0 lo disattiva */
+#define DEFAULT_GROUP_COMMIT_OPS 128 /* operazioni oltre cui il group commit conferma subito */
+#define DEFAULT_CHAT_CACHE_SIZE 65536 /* chat tra due utenti in cache, 0 la disattiva */
 
 #define MAX_THREADS_IN_POOL 64
+#define JOB_QUEUE_SIZE 4096 /* posizioni della coda core -> slave di ogni slave (potenza di 2) */
+#define SLAVE_BATCH_SIZE 32 /* messaggi massimi eseguiti da uno slave in una transazione */
+#define POOL_CHECK_MS 100 /* intervallo di valutazione della dimensione del pool */
+#define POOL_GROW_WAIT_MS 20 /* attesa in coda oltre cui il pool cresce */
+#define WAL_CHECKPOINT_MS 1000 /* intervallo massimo tra due checkpoint del WAL */
+#define MAX_IO_THREADS 32
+#define FD_TABLE_HEADROOM 1024 /* descrittori oltre MaxConnections (database, file, eventfd, ...) nelle tabelle per descrittore */
+#define CHAT_CACHE_SHARDS 64 /* partizioni della cache delle chat (potenza di 2) */
+#define CHAT_CACHE_WAYS 4 /* posizioni per insieme della cache delle chat */
+#define RESULT_ROWS 16 /* righe allocate alla prima riga di un result_set */
+#define RESULT_BLOCK_SIZE 4096 /* byte di un blocco dell'arena di un result_set */
 
 // to avoid warnings like "ISO C forbids an empty translation unit"
 #ifndef MAKE_ISO_COMPILER_HAPPY
@@ -16,20 +16,42 @@
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <ctype.h>
+#include <limits.h>
 
 #include "utils.h"
 #include "connections.h"
 #include "message.h"
+#include "uring.h"
 
 #define ERROR_CONNECTION -1
 #define CLOSED_CONNECTION 0
 
 static unsigned int max_allocable_buffer = 13107200; /* 100 mb in bytes */
 
+/* operazioni e byte di buffer di ogni istanza io_uring (una per thread) */
+#define URING_ENTRIES 64
+#define URING_BUFFER_SIZE 65536
+
+/* iovec per messaggio: header, header dati, buffer */
+#define IOV_PER_MESSAGE 3
+
+/* byte trasferiti al più da una singola sendfile */
+#define SENDFILE_CHUNK (1 << 20)
+
+static int uring_engine = 0; /* 1 se è stato selezionato IO_ENGINE_URING */
+static __thread uring_t *thread_ring = NULL;
+
+static ssize_t uring_send_requests(long fd, message_t *msgs, int n);
+static ssize_t writev_send_requests(long fd, message_t *msgs, int n);
+static int write_all(long fd, const char *buf, size_t len);
+static int writev_all(long fd, struct iovec *iov, int iovcnt);
+
 /**
  * @function openConnection
  * @brief Apre una connessione AF_UNIX verso il server 
@@ -112,28 +134,9 @@ int openConnection(char *path, unsigned int ntimes, unsigned int secs)
  */
 int sendHeader(int fd, message_hdr_t *hdr)
 {
-
-	message_hdr_t *temp = hdr;
-	ssize_t remaining = sizeof(message_hdr_t);
-
-	/* utilizziamo sempre un ciclo for per l'invio e la ricezione per 
-		essere sicuri che la write/read non inviino/leggano meno byte
-		del previsto */
-	for (;;)
-	{
-		if (remaining <= 0)
-			break;
-		ssize_t write_bytes = write(fd, temp, remaining);
-		if ((write_bytes > 0) && (write_bytes < remaining))
-		{
-			remaining -= write_bytes;
-			temp += write_bytes;
-			continue;
-		}
-
-		check_read_write(write_bytes, remaining);
-		break;
-	}
+	int ret_value = write_all(fd, (const char *)hdr, sizeof(message_hdr_t));
+	if (ret_value <= 0)
+		return ret_value;
 
 	return sizeof(message_hdr_t);
 }
@@ -184,54 +187,26 @@ int readHeader(long connfd, message_hdr_t *hdr)
  */
 int sendData(long fd, message_data_t *msg)
 {
-	message_data_hdr_t *temp = &(msg->hdr);
-	ssize_t remaining = sizeof(message_data_hdr_t);
-
-	for (;;)
-	{
-		if (remaining <= 0)
-			break;
-		ssize_t write_bytes = write(fd, temp, remaining);
-		if ((write_bytes > 0) && (write_bytes < remaining))
-		{
-			remaining -= write_bytes;
-			temp += write_bytes;
-			continue;
-		}
-
-		check_read_write(write_bytes, remaining);
-		break;
-	}
-
-	/* else */
 	ssize_t buf_size = msg->hdr.len * sizeof(char);
 
 	if (buf_size < 0)
 		return ERROR_CONNECTION;
-	if (buf_size == 0) /* messaggio senza buffer */
-		return sizeof(message_data_hdr_t);
 	if (buf_size > max_allocable_buffer)
 	{
 		fprintf(stderr, "[!!] massima dimensione buffer inviabile: %d\n", max_allocable_buffer);
 		return ERROR_CONNECTION;
 	}
 
-	char *curr_pos = msg->buf;
-	ssize_t curr_buff_size = buf_size;
-	for (;;)
-	{
-		if (curr_buff_size <= 0)
-			break;
-		ssize_t new_write_bytes = write(fd, curr_pos, curr_buff_size);
-		if ((new_write_bytes > 0) && (new_write_bytes < curr_buff_size))
-		{
-			curr_pos += new_write_bytes;
-			curr_buff_size -= new_write_bytes;
-			continue;
-		}
-		check_read_write(new_write_bytes, curr_buff_size);
-		break;
-	}
+	/* header e buffer con una sola syscall */
+	struct iovec iov[2];
+	iov[0].iov_base = &(msg->hdr);
+	iov[0].iov_len = sizeof(message_data_hdr_t);
+	iov[1].iov_base = msg->buf;
+	iov[1].iov_len = buf_size;
+
+	int ret_value = writev_all(fd, iov, (buf_size == 0) ? 1 : 2);
+	if (ret_value <= 0)
+		return ret_value;
 
 	return sizeof(message_data_hdr_t) + buf_size;
 }
@@ -333,6 +308,275 @@ int readMsg(long fd, message_t *msg)
 	return first_read + second_read;
 }
 
+/**------------------------------------------------------------------------
+ * @brief 					ricezione incrementale (lato server)
+ ------------------------------------------------------------------------*/
+
+/* dimensione del buffer d'appoggio per i byte da scartare */
+#define DISCARD_BUFFER_SIZE 4096
+
+void initFrame(rx_frame *rx, unsigned int max_msg, unsigned int max_file, const char *spool_dir)
+{
+	memset(rx, 0, sizeof(rx_frame));
+	rx->state = RX_HEADER;
+	rx->max_msg = max_msg;
+	rx->max_file = max_file;
+	rx->spool_dir = spool_dir;
+	rx->spool_fd = -1;
+}
+
+void resetFrame(rx_frame *rx)
+{
+	if (rx->msg)
+		free_message(rx->msg);
+	if (rx->file.buf)
+		free(rx->file.buf);
+	if (rx->chunk)
+		free(rx->chunk);
+	if (rx->spool_fd != -1)
+		close(rx->spool_fd);
+	/* upload incompleto: il file temporaneo non verrà mai utilizzato */
+	if (rx->spool_path)
+	{
+		unlink(rx->spool_path);
+		free(rx->spool_path);
+	}
+
+	initFrame(rx, rx->max_msg, rx->max_file, rx->spool_dir);
+}
+
+void nextFrame(rx_frame *rx)
+{
+	/* il chiamante è ora proprietario di rx->msg, rx->file e rx->spool_path */
+	initFrame(rx, rx->max_msg, rx->max_file, rx->spool_dir);
+}
+
+/**
+ * @brief imposta lo stato "state" in cui devono essere ricevuti "len" byte
+ * 		a partire da "dest"
+ * 
+ */
+static inline void set_rx_state(rx_frame *rx, rx_state state, void *dest, size_t len)
+{
+	rx->state = state;
+	rx->pos = dest;
+	rx->remaining = len;
+	rx->discard = 0;
+}
+
+/**
+ * @brief prepara la ricezione del body descritto da "data": il buffer viene
+ * 		allocato solo se la dimensione rientra in "limit", altrimenti i byte
+ * 		verranno letti e scartati
+ * 
+ * @return int 0 se ok, ERROR_CONNECTION se non è possibile allocare il buffer
+ */
+static int start_rx_body(rx_frame *rx, rx_state state, message_data_t *data, unsigned int limit)
+{
+	size_t len = data->hdr.len * sizeof(char);
+
+	data->buf = NULL;
+	set_rx_state(rx, state, NULL, len);
+	if (len == 0) /* messaggio senza buffer */
+		return 0;
+
+	if ((len > limit) || (len > max_allocable_buffer))
+	{
+		rx->discard = 1;
+		rx->too_long = 1;
+		return 0;
+	}
+
+	data->buf = malloc(len);
+	if (!(data->buf))
+	{
+		fprintf(stderr, STRING_BAD_MALLOC);
+		return ERROR_CONNECTION;
+	}
+	rx->pos = data->buf;
+
+	return 0;
+}
+
+/**
+ * @brief prepara la ricezione del contenuto di un file: i byte vengono
+ * 		raccolti in un blocco di al più FILE_CHUNK_SIZE byte e scritti in
+ * 		un file temporaneo nella cartella dei file, la memoria occupata non
+ * 		dipende quindi dalla dimensione del file
+ * 
+ * @return int 0 se ok, ERROR_CONNECTION se non è possibile creare il file
+ */
+static int start_rx_file(rx_frame *rx)
+{
+	size_t len = rx->file.hdr.len * sizeof(char);
+
+	rx->file.buf = NULL;
+	set_rx_state(rx, RX_FILE_BODY, NULL, len);
+	if (len > rx->max_file)
+	{
+		rx->discard = 1;
+		rx->too_long = 1;
+		return 0;
+	}
+
+	if (asprintf(&(rx->spool_path), "%s/" SPOOL_PREFIX "XXXXXX", rx->spool_dir) == -1)
+	{
+		rx->spool_path = NULL;
+		return ERROR_CONNECTION;
+	}
+	/* creato con permessi 0600 */
+	rx->spool_fd = mkstemp(rx->spool_path);
+	if (rx->spool_fd == -1)
+	{
+		perror(STRING_PERROR(STRING_BAD_SPOOL));
+		free(rx->spool_path);
+		rx->spool_path = NULL;
+		return ERROR_CONNECTION;
+	}
+
+	rx->chunk_used = 0;
+	if (len > 0)
+	{
+		rx->chunk = malloc((len < FILE_CHUNK_SIZE) ? len : FILE_CHUNK_SIZE);
+		if (!(rx->chunk))
+		{
+			fprintf(stderr, STRING_BAD_MALLOC);
+			return ERROR_CONNECTION;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief scrive su disco i byte del blocco di ricezione del file
+ * 
+ * @return int 0 se ok, ERROR_CONNECTION altrimenti
+ */
+static int flush_rx_file(rx_frame *rx)
+{
+	if (rx->chunk_used == 0)
+		return 0;
+
+	if (write_all(rx->spool_fd, rx->chunk, rx->chunk_used) <= 0)
+	{
+		perror(STRING_PERROR(STRING_BAD_SPOOL));
+		return ERROR_CONNECTION;
+	}
+	rx->chunk_used = 0;
+
+	return 0;
+}
+
+int readFrame(long fd, rx_frame *rx)
+{
+	char discard_buffer[DISCARD_BUFFER_SIZE];
+
+	/* inizio di un nuovo messaggio */
+	if (!rx->msg)
+	{
+		rx->msg = malloc(sizeof(message_t));
+		if (!(rx->msg))
+		{
+			fprintf(stderr, STRING_BAD_MALLOC);
+			return ERROR_CONNECTION;
+		}
+		memset(rx->msg, 0, sizeof(message_t));
+		set_rx_state(rx, RX_HEADER, &(rx->msg->hdr), sizeof(message_hdr_t));
+	}
+
+	for (;;)
+	{
+		/* la parte corrente è stata ricevuta: passo alla successiva */
+		if (rx->remaining == 0)
+		{
+			switch (rx->state)
+			{
+			case RX_HEADER:
+				set_rx_state(rx, RX_DATA_HDR, &(rx->msg->data.hdr), sizeof(message_data_hdr_t));
+				continue;
+			case RX_DATA_HDR:
+				if (start_rx_body(rx, RX_BODY, &(rx->msg->data), rx->max_msg) != 0)
+					return ERROR_CONNECTION;
+				continue;
+			case RX_BODY:
+				/* in caso di file devo ricevere anche la seconda parte del messaggio */
+				if (rx->msg->hdr.op == POSTFILE_OP)
+				{
+					memset(&(rx->file), 0, sizeof(message_data_t));
+					set_rx_state(rx, RX_FILE_HDR, &(rx->file.hdr), sizeof(message_data_hdr_t));
+					continue;
+				}
+				return FRAME_COMPLETE;
+			case RX_FILE_HDR:
+				if (start_rx_file(rx) != 0)
+					return ERROR_CONNECTION;
+				continue;
+			case RX_FILE_BODY:
+				/* file completo: chiudo il file temporaneo e libero il blocco */
+				if (rx->spool_fd != -1)
+				{
+					if (close(rx->spool_fd) != 0)
+					{
+						rx->spool_fd = -1;
+						return ERROR_CONNECTION;
+					}
+					rx->spool_fd = -1;
+				}
+				if (rx->chunk)
+				{
+					free(rx->chunk);
+					rx->chunk = NULL;
+				}
+				return FRAME_COMPLETE;
+			}
+		}
+
+		int to_spool = (rx->state == RX_FILE_BODY) && (!(rx->discard));
+		char *dest = rx->pos;
+		size_t len = rx->remaining;
+		if (rx->discard)
+		{
+			dest = discard_buffer;
+			if (len > DISCARD_BUFFER_SIZE)
+				len = DISCARD_BUFFER_SIZE;
+		}
+		else if (to_spool)
+		{
+			dest = rx->chunk + rx->chunk_used;
+			if (len > FILE_CHUNK_SIZE - rx->chunk_used)
+				len = FILE_CHUNK_SIZE - rx->chunk_used;
+		}
+
+		ssize_t read_bytes = recv(fd, dest, len, MSG_DONTWAIT);
+		if (read_bytes > 0)
+		{
+			rx->remaining -= read_bytes;
+			if (to_spool)
+			{
+				/* blocco pieno o file completo: lo scrivo su disco */
+				rx->chunk_used += read_bytes;
+				if (((rx->chunk_used == FILE_CHUNK_SIZE) || (rx->remaining == 0)) &&
+					 (flush_rx_file(rx) != 0))
+					return ERROR_CONNECTION;
+			}
+			else if (!(rx->discard))
+				rx->pos += read_bytes;
+			continue;
+		}
+
+		if (read_bytes == 0)
+			return CLOSED_CONNECTION;
+		if (errno == EINTR)
+			continue;
+		/* non ci sono altri byte disponibili: riprendo al prossimo evento */
+		if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+			return FRAME_PARTIAL;
+
+		return ERROR_CONNECTION;
+	}
+}
+
 /**
  * @function sendRequest
  * @brief Invia un messaggio di richiesta al server 
@@ -346,16 +590,426 @@ int readMsg(long fd, message_t *msg)
  */
 int sendRequest(long fd, message_t *msg)
 {
-	int first_write = sendHeader(fd, &(msg->hdr));
-	if (first_write <= 0)
-		return first_write;
+	return sendRequests(fd, msg, 1);
+}
 
-	int second_write = sendData(fd, &(msg->data));
-	if (second_write <= 0)
-		return second_write;
+/**------------------------------------------------------------------------
+ * @brief 						motore di invio (lato server)
+ ------------------------------------------------------------------------*/
 
-	/* else */
-	return first_write + second_write;
+int setIoEngine(const char *name)
+{
+	uring_engine = 0;
+
+	if (strcmp(name, IO_ENGINE_BLOCKING) == 0)
+		return 0;
+	if (strcmp(name, IO_ENGINE_URING) != 0)
+	{
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* verifico che il kernel (e la compilazione) supportino io_uring */
+	uring_t *test = uring_init(URING_ENTRIES, URING_BUFFER_SIZE);
+	if (!test)
+		return -1;
+	uring_destroy(test);
+	uring_engine = 1;
+
+	return 0;
+}
+
+const char *getIoEngine()
+{
+	return (uring_engine) ? IO_ENGINE_URING : IO_ENGINE_BLOCKING;
+}
+
+void initThreadIo()
+{
+	if ((uring_engine) && (!thread_ring))
+		thread_ring = uring_init(URING_ENTRIES, URING_BUFFER_SIZE);
+}
+
+void destroyThreadIo()
+{
+	uring_destroy(thread_ring);
+	thread_ring = NULL;
+}
+
+/**
+ * @brief scrittura bloccante di "len" byte di "buf"
+ * 
+ * @return int 1 se ok, <=0 come sendHeader
+ */
+static int write_all(long fd, const char *buf, size_t len)
+{
+	while (len > 0)
+	{
+		ssize_t write_bytes = write(fd, buf, len);
+		if (write_bytes < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return ERROR_CONNECTION;
+		}
+		if (write_bytes == 0)
+			return CLOSED_CONNECTION;
+
+		buf += write_bytes;
+		len -= write_bytes;
+	}
+
+	return 1;
+}
+
+/**
+ * @brief scrive tutti i byte descritti dal vettore "iov" riprendendo le
+ * 		scritture parziali (il vettore viene modificato)
+ * 
+ * @return int 1 se ok, <=0 in caso di errore (come write_all)
+ */
+static int writev_all(long fd, struct iovec *iov, int iovcnt)
+{
+	while (iovcnt > 0)
+	{
+		ssize_t write_bytes = writev(fd, iov, iovcnt);
+		if (write_bytes < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return ERROR_CONNECTION;
+		}
+		if (write_bytes == 0)
+			return CLOSED_CONNECTION;
+
+		/* salto i vettori già scritti completamente */
+		while ((iovcnt > 0) && ((size_t)write_bytes >= iov->iov_len))
+		{
+			write_bytes -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base + write_bytes;
+			iov->iov_len -= write_bytes;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * @brief invia i messaggi tramite io_uring con un solo IORING_OP_SENDMSG
+ * 		per blocco: header e header dei dati (e il body se c'è spazio)
+ * 		vengono copiati consecutivamente nel buffer dell'istanza e formano
+ * 		un unico vettore, i body più grandi vengono inviati direttamente
+ * 		dalla loro memoria. Nessuna operazione si blocca: con la socket
+ * 		piena l'invio è parziale e viene restituito quanto inviato
+ * 
+ * @return ssize_t come trySendRequests
+ */
+static ssize_t uring_send_requests(long fd, message_t *msgs, int n)
+{
+	struct iovec iov[IOV_MAX];
+	int res[URING_ENTRIES];
+	size_t hdrs_size = sizeof(message_hdr_t) + sizeof(message_data_hdr_t);
+	ssize_t total = 0;
+	int i = 0;
+
+	while (i < n)
+	{
+		char *buffer = uring_buffer(thread_ring);
+		size_t used = 0;
+		size_t expected = 0;
+		int iovcnt = 0;
+
+		/* riempio il blocco finché ci sono vettori e buffer disponibili */
+		while ((i < n) && (iovcnt + 2 <= IOV_MAX) && (used + hdrs_size <= URING_BUFFER_SIZE))
+		{
+			message_t *msg = msgs + i;
+			size_t body = (msg->data.hdr.len > 0) ? msg->data.hdr.len : 0;
+
+			if (body > max_allocable_buffer)
+			{
+				fprintf(stderr, "[!!] massima dimensione buffer inviabile: %d\n", max_allocable_buffer);
+				return ERROR_CONNECTION;
+			}
+
+			char *pos = buffer + used;
+			memcpy(pos, &(msg->hdr), sizeof(message_hdr_t));
+			memcpy(pos + sizeof(message_hdr_t), &(msg->data.hdr), sizeof(message_data_hdr_t));
+			used += hdrs_size;
+
+			/* body piccolo: prosegue il frame nel buffer */
+			int copied = ((body > 0) && (used + body <= URING_BUFFER_SIZE));
+			if (copied)
+			{
+				memcpy(buffer + used, msg->data.buf, body);
+				used += body;
+			}
+
+			/* i frame copiati uno dopo l'altro estendono l'ultimo vettore */
+			if ((iovcnt > 0) && ((char *)iov[iovcnt - 1].iov_base + iov[iovcnt - 1].iov_len == pos))
+				iov[iovcnt - 1].iov_len += (buffer + used) - pos;
+			else
+			{
+				iov[iovcnt].iov_base = pos;
+				iov[iovcnt++].iov_len = (buffer + used) - pos;
+			}
+			if ((body > 0) && (!copied))
+			{
+				iov[iovcnt].iov_base = msg->data.buf;
+				iov[iovcnt++].iov_len = body;
+			}
+
+			expected += hdrs_size + body;
+			i++;
+		}
+
+		struct msghdr out;
+		memset(&out, 0, sizeof(struct msghdr));
+		out.msg_iov = iov;
+		out.msg_iovlen = iovcnt;
+		uring_prep_sendmsg(thread_ring, fd, &out, 0);
+
+		int no_done = uring_submit_wait(thread_ring, res);
+		if (no_done < 0)
+			return ERROR_CONNECTION;
+
+		ssize_t sent;
+		if (no_done == 0)
+		{
+			/* il kernel non ha accettato l'operazione: stesso invio con writev */
+			sent = trySendv(fd, iov, iovcnt);
+			if (sent < 0)
+				return ERROR_CONNECTION;
+		}
+		else if (res[0] < 0)
+		{
+			if ((res[0] != -EAGAIN) && (res[0] != -EINTR))
+			{
+				errno = -res[0];
+				return ERROR_CONNECTION;
+			}
+			sent = 0;
+		}
+		else
+			sent = res[0];
+
+		/* socket piena: il chiamante conserverà i byte rimanenti */
+		total += sent;
+		if ((size_t)sent < expected)
+			return total;
+	}
+
+	return total;
+}
+
+int sendRequests(long fd, message_t *msgs, int n)
+{
+	struct iovec iov[IOV_MAX];
+	int iovcnt = 0;
+	int total = 0;
+
+	/* i frame vengono accodati nello stesso vettore e inviati con una
+		writev ogni IOV_MAX / IOV_PER_MESSAGE messaggi */
+	for (int i = 0; i < n; i++)
+	{
+		message_t *msg = msgs + i;
+		ssize_t buf_size = msg->data.hdr.len * sizeof(char);
+
+		if ((buf_size < 0) || (buf_size > max_allocable_buffer))
+		{
+			fprintf(stderr, "[!!] massima dimensione buffer inviabile: %d\n", max_allocable_buffer);
+			return ERROR_CONNECTION;
+		}
+
+		if (iovcnt + IOV_PER_MESSAGE > IOV_MAX)
+		{
+			int ret_value = writev_all(fd, iov, iovcnt);
+			if (ret_value <= 0)
+				return ret_value;
+			iovcnt = 0;
+		}
+
+		iov[iovcnt].iov_base = &(msg->hdr);
+		iov[iovcnt++].iov_len = sizeof(message_hdr_t);
+		iov[iovcnt].iov_base = &(msg->data.hdr);
+		iov[iovcnt++].iov_len = sizeof(message_data_hdr_t);
+		if (buf_size > 0)
+		{
+			iov[iovcnt].iov_base = msg->data.buf;
+			iov[iovcnt++].iov_len = buf_size;
+		}
+		total += sizeof(message_hdr_t) + sizeof(message_data_hdr_t) + buf_size;
+	}
+
+	if (iovcnt > 0)
+	{
+		int ret_value = writev_all(fd, iov, iovcnt);
+		if (ret_value <= 0)
+			return ret_value;
+	}
+
+	return total;
+}
+
+ssize_t trySendv(long fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t total = 0;
+
+	while (iovcnt > 0)
+	{
+		ssize_t write_bytes = writev(fd, iov, iovcnt);
+		if (write_bytes < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				break;
+			return ERROR_CONNECTION;
+		}
+		total += write_bytes;
+
+		/* salto i vettori già scritti completamente */
+		while ((iovcnt > 0) && ((size_t)write_bytes >= iov->iov_len))
+		{
+			write_bytes -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0)
+		{
+			iov->iov_base = (char *)iov->iov_base + write_bytes;
+			iov->iov_len -= write_bytes;
+		}
+	}
+
+	return total;
+}
+
+ssize_t trySendRequests(long fd, message_t *msgs, int n)
+{
+	if (thread_ring)
+		return uring_send_requests(fd, msgs, n);
+
+	return writev_send_requests(fd, msgs, n);
+}
+
+/**
+ * @brief invio non bloccante dei messaggi con writev (motore bloccante e
+ * 		operazioni non accettate da io_uring)
+ * 
+ * @return ssize_t come trySendRequests
+ */
+static ssize_t writev_send_requests(long fd, message_t *msgs, int n)
+{
+	struct iovec iov[IOV_MAX];
+	int iovcnt = 0;
+	size_t expected = 0;
+	ssize_t total = 0;
+
+	for (int i = 0; i <= n; i++)
+	{
+		/* vettore pieno o messaggi terminati: scrivo quanto accumulato */
+		if ((iovcnt > 0) && ((i == n) || (iovcnt + IOV_PER_MESSAGE > IOV_MAX)))
+		{
+			ssize_t write_bytes = trySendv(fd, iov, iovcnt);
+			if (write_bytes < 0)
+				return ERROR_CONNECTION;
+			total += write_bytes;
+			if ((size_t)write_bytes < expected)
+				return total; /* socket piena */
+			iovcnt = 0;
+			expected = 0;
+		}
+		if (i == n)
+			break;
+
+		message_t *msg = msgs + i;
+		ssize_t buf_size = msg->data.hdr.len * sizeof(char);
+
+		if ((buf_size < 0) || (buf_size > max_allocable_buffer))
+		{
+			fprintf(stderr, "[!!] massima dimensione buffer inviabile: %d\n", max_allocable_buffer);
+			return ERROR_CONNECTION;
+		}
+
+		iov[iovcnt].iov_base = &(msg->hdr);
+		iov[iovcnt++].iov_len = sizeof(message_hdr_t);
+		iov[iovcnt].iov_base = &(msg->data.hdr);
+		iov[iovcnt++].iov_len = sizeof(message_data_hdr_t);
+		if (buf_size > 0)
+		{
+			iov[iovcnt].iov_base = msg->data.buf;
+			iov[iovcnt++].iov_len = buf_size;
+		}
+		expected += sizeof(message_hdr_t) + sizeof(message_data_hdr_t) + buf_size;
+	}
+
+	return total;
+}
+
+ssize_t trySendFile(long fd, int file_fd, off_t *offset, size_t len)
+{
+	ssize_t total = 0;
+
+	/* il contenuto passa direttamente dalla page cache alla socket */
+	while ((size_t)total < len)
+	{
+		size_t to_send = len - total;
+		if (to_send > SENDFILE_CHUNK)
+			to_send = SENDFILE_CHUNK;
+
+		ssize_t write_bytes = sendfile(fd, file_fd, offset, to_send);
+		if (write_bytes < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+				return total;
+			/* sendfile non supportata per questo file: copia a blocchi */
+			if ((errno == EINVAL) || (errno == ENOSYS))
+				break;
+			return ERROR_CONNECTION;
+		}
+		/* il file è stato troncato nel frattempo */
+		if (write_bytes == 0)
+		{
+			errno = EIO;
+			return ERROR_CONNECTION;
+		}
+		total += write_bytes;
+	}
+
+	while ((size_t)total < len)
+	{
+		char chunk[BUFSIZ];
+		size_t to_read = len - total;
+		if (to_read > sizeof(chunk))
+			to_read = sizeof(chunk);
+
+		ssize_t read_bytes = pread(file_fd, chunk, to_read, *offset);
+		if ((read_bytes < 0) && (errno == EINTR))
+			continue;
+		if (read_bytes <= 0)
+		{
+			errno = (read_bytes == 0) ? EIO : errno;
+			return ERROR_CONNECTION;
+		}
+
+		struct iovec iov = {chunk, read_bytes};
+		ssize_t write_bytes = trySendv(fd, &iov, 1);
+		if (write_bytes < 0)
+			return ERROR_CONNECTION;
+		total += write_bytes;
+		*offset += write_bytes;
+		if (write_bytes < read_bytes)
+			break; /* socket piena */
+	}
+
+	return total;
 }
 
 inline void init_sockaddr(struct sockaddr_un *sa, char *sockname)
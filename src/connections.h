@@ -92,6 +92,99 @@ int readMsg(long fd, message_t *msg);
 
 /* da completare da parte dello studente con altri metodi di interfaccia */
 
+/**
+ * @brief stati della ricezione incrementale di un messaggio:
+ * 		header -> header dati -> body [-> header file -> body file]
+ * 
+ */
+typedef enum _rx_state
+{
+	RX_HEADER,	 /**< header del messaggio */
+	RX_DATA_HDR,  /**< header della parte dati */
+	RX_BODY,		 /**< buffer dati */
+	RX_FILE_HDR,  /**< header della parte dati contenente il file (solo POSTFILE) */
+	RX_FILE_BODY, /**< contenuto del file, salvato su disco a blocchi (solo POSTFILE) */
+} rx_state;
+
+/**
+ * @brief stato di ricezione di una connessione, permette di riprendere la
+ * 		lettura di un messaggio da dove si era interrotta
+ * 
+ */
+typedef struct _rx_frame
+{
+	rx_state state;
+	message_t *msg;			/**< messaggio in costruzione (NULL se nessuno) */
+	message_data_t file;		/**< seconda parte del messaggio per POSTFILE */
+	char *pos;					/**< posizione corrente di scrittura */
+	size_t remaining;			/**< byte ancora da ricevere nello stato corrente */
+	int discard;				/**< il body corrente supera il limite: i byte vengono scartati */
+	int too_long;				/**< il messaggio completo ha superato un limite */
+	unsigned int max_msg;	/**< dimensione massima di un messaggio testuale */
+	unsigned int max_file;	/**< dimensione massima di un file in byte */
+	const char *spool_dir;	/**< cartella dei file temporanei di upload */
+	char *spool_path;			/**< file temporaneo del file in ricezione */
+	int spool_fd;				/**< descrittore del file temporaneo (-1 se chiuso) */
+	char *chunk;				/**< blocco di ricezione del file (FILE_CHUNK_SIZE byte) */
+	size_t chunk_used;		/**< byte del blocco non ancora scritti su disco */
+} rx_frame;
+
+/* dimensione del blocco con il quale un file in upload viene scritto su disco:
+	è la massima memoria occupata da un upload, indipendentemente da MaxFileSize */
+#define FILE_CHUNK_SIZE 65536
+
+/* prefisso dei file temporanei di upload nella cartella dei file */
+#define SPOOL_PREFIX ".upload-"
+
+#define FRAME_COMPLETE 1 /* messaggio completo disponibile in rx->msg */
+#define FRAME_PARTIAL 2	/* dati non ancora disponibili, riprovare al prossimo evento */
+
+/**
+ * @brief inizializza lo stato di ricezione di una connessione
+ * 
+ * @param rx stato di ricezione
+ * @param max_msg dimensione massima di un messaggio testuale
+ * @param max_file dimensione massima di un file in byte
+ * @param spool_dir cartella dove salvare i file in ricezione
+ */
+void initFrame(rx_frame *rx, unsigned int max_msg, unsigned int max_file, const char *spool_dir);
+
+/**
+ * @brief libera l'eventuale messaggio parzialmente ricevuto (eliminando
+ * 		il file temporaneo di un upload incompleto)
+ * 
+ * @param rx stato di ricezione
+ */
+void resetFrame(rx_frame *rx);
+
+/**
+ * @brief da richiamare dopo aver prelevato un messaggio completo (rx->msg,
+ * 		rx->file e rx->spool_path): prepara la ricezione del messaggio
+ * 		successivo senza liberare la memoria ceduta al chiamante
+ * 
+ * @param rx stato di ricezione
+ */
+void nextFrame(rx_frame *rx);
+
+/**
+ * @function readFrame
+ * @brief legge senza bloccarsi i byte disponibili sulla connessione e
+ * 		avanza la ricezione del messaggio corrente
+ * @warning i body oltre i limiti non vengono allocati ma scartati, in questo
+ * 			caso il messaggio restituito ha rx->too_long settato
+ * 
+ * @param fd descrittore della connessione
+ * @param rx stato di ricezione della connessione
+ * @return int (FRAME_COMPLETE) il messaggio completo è in rx->msg (e per
+ * 					POSTFILE l'header del file in rx->file e il suo contenuto
+ * 					nel file temporaneo rx->spool_path), il chiamante ne 
+ * 					diventa proprietario
+ * 				(FRAME_PARTIAL) nessun messaggio completo, stato conservato
+ * 				<=0 se c'e' stato un errore 
+ *         (se <0 errno deve essere settato, se == 0 connessione chiusa)
+ */
+int readFrame(long fd, rx_frame *rx);
+
 /**
  * @brief invia un intero messaggio al client
  * 
@@ -101,6 +194,53 @@ int readMsg(long fd, message_t *msg);
  */
 int sendMessage(int fd, message_t *msg);
 
+/**------------------------------------------------------------------------
+ * @brief 		invii non bloccanti (lato server, connessioni O_NONBLOCK)
+ ------------------------------------------------------------------------*/
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/**
+ * @function trySendv
+ * @brief scrive i byte descritti da "iov" finché la socket li accetta
+ * @warning il vettore viene modificato
+ *
+ * @param fd descrittore non bloccante
+ * @param iov vettore dei buffer
+ * @param iovcnt numero di buffer
+ * @return ssize_t byte scritti (meno di quelli richiesti, anche 0, se la
+ * 			socket è piena), -1 in caso di errore (errno settato)
+ */
+ssize_t trySendv(long fd, struct iovec *iov, int iovcnt);
+
+/**
+ * @function trySendRequests
+ * @brief come sendRequests senza bloccarsi: con il motore io_uring gli
+ * 		invii vengono sottomessi in blocco
+ *
+ * @param fd descrittore non bloccante
+ * @param msgs vettore dei messaggi da inviare
+ * @param n numero di messaggi
+ * @return ssize_t byte scritti del flusso dei messaggi serializzati (meno
+ * 			del totale se la socket è piena), -1 in caso di errore
+ */
+ssize_t trySendRequests(long fd, message_t *msgs, int n);
+
+/**
+ * @function trySendFile
+ * @brief invia al più "len" byte del file "file_fd" a partire da "offset"
+ * 		tramite sendfile, senza copiarli in memoria e senza bloccarsi
+ *
+ * @param fd descrittore non bloccante
+ * @param file_fd descrittore del file (aperto in lettura)
+ * @param offset posizione nel file, viene avanzata dei byte inviati
+ * @param len byte da inviare
+ * @return ssize_t byte inviati (meno di "len" se la socket è piena), -1 in
+ * 			caso di errore (errno settato)
+ */
+ssize_t trySendFile(long fd, int file_fd, off_t *offset, size_t len);
+
 // ------- client side ------
 /**
  * @function sendRequest
@@ -113,6 +253,58 @@ int sendMessage(int fd, message_t *msg);
  */
 int sendRequest(long fd, message_t *msg);
 
+/**
+ * @function sendRequests
+ * @brief invia in ordine "n" messaggi sulla stessa connessione con una
+ * 		writev ogni IOV_MAX / 3 messaggi
+ *
+ * @param fd     descrittore della connessione
+ * @param msgs   vettore dei messaggi da inviare
+ * @param n      numero di messaggi
+ *
+ * @return #byte inviati se operazione a buon fine
+ * 			<=0 se c'e' stato un errore
+ *         (se <0 errno deve essere settato, se == 0 connessione chiusa)
+ */
+int sendRequests(long fd, message_t *msgs, int n);
+
+/**------------------------------------------------------------------------
+ * @brief 						motore di invio (lato server)
+ ------------------------------------------------------------------------*/
+
+#define IO_ENGINE_BLOCKING "blocking"
+#define IO_ENGINE_URING "io_uring"
+
+/**
+ * @brief seleziona il motore utilizzato per gli invii (trySendRequests)
+ * 		dai thread che richiameranno initThreadIo
+ *
+ * @param name IO_ENGINE_BLOCKING | IO_ENGINE_URING
+ * @return int 0 se ok, -1 se il motore non esiste (errno = EINVAL) o non è
+ * 				disponibile (errno = ENOSYS...), in tal caso resta attivo il
+ * 				motore bloccante
+ */
+int setIoEngine(const char *name);
+
+/**
+ * @return const char* nome del motore di invio attivo
+ */
+const char *getIoEngine();
+
+/**
+ * @brief inizializza le strutture del motore di invio per il thread
+ * 		chiamante (senza effetto con il motore bloccante o in caso di
+ * 		errore, in cui il thread continuerà ad usare le scritture bloccanti)
+ *
+ */
+void initThreadIo();
+
+/**
+ * @brief libera le strutture del motore di invio del thread chiamante
+ *
+ */
+void destroyThreadIo();
+
 /**
  * @function sendData
  * @brief Invia il body del messaggio al server
@@ -21,14 +21,15 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <signal.h>
 #include <sys/eventfd.h>
 #include <assert.h>
-#include <libgen.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 
 #include "core.h"
@@ -40,6 +41,12 @@
 #include "connections.h"
 #include "ops.h"
 #include "config.h"
+#include "events.h"
+#include "sessions.h"
+#include "reactors.h"
+#include "presence.h"
+#include "chatcache.h"
+#include "groups.h"
 
 #define INACTIVE_THREAD 0
 
@@ -48,9 +55,10 @@ static sqlite3 *db = NULL;
 /* garantisce l'apertura esclusiva di una connessione col database */
 static pthread_mutex_t access_open_db = PTHREAD_MUTEX_INITIALIZER;
 
-/* thread slaves */
+/* thread slaves: ne sono avviati solo alcuni (vedi queue_pool_scale) */
 static pthread_t **slaves = NULL;
 static unsigned int tot_slaves;
+static int slave_id_dim;
 
 /* necessario volatile sig_atomic_t in quanto vi si accede anche dal 
 	signal handler */
@@ -60,6 +68,9 @@ static volatile sig_atomic_t server_running = 1;
 static int server_sock;
 static char *sock_name;
 
+/* backend degli eventi sui descrittori */
+static event_loop *loop = NULL;
+
 //-------------------------------------------------------------------------//
 
 /**
@@ -84,6 +95,166 @@ char *get_statsfile()
 	return filestats;
 }
 
+/* journal del database scelto con DBJournalMode */
+static int wal_mode = 0;
+
+int get_walmode()
+{
+	return wal_mode;
+}
+
+//-------------------------------------------------------------------------//
+
+/**
+ * @brief checkpoint del WAL: nessuna connessione riporta da sé il WAL nel
+ * 		database al termine di una transazione (sarebbe lo slave di turno a
+ * 		pagarne il costo), se ne occupa un thread dedicato ogni
+ * 		WAL_CHECKPOINT_MS o appena il WAL supera WalCheckpointPages pagine
+ */
+static pthread_t checkpointer;
+static int checkpointer_started = 0;
+static pthread_mutex_t access_checkpoint = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t checkpoint_needed = PTHREAD_COND_INITIALIZER;
+static int checkpoint_requested = 0;
+static int checkpoint_stop = 0;
+static unsigned int checkpoint_pages = DEFAULT_WAL_CHECKPOINT_PAGES;
+
+/* statistiche dei checkpoint, lette da db_print_stats */
+static unsigned long no_checkpoints = 0;
+static unsigned long no_restarts = 0;
+static int wal_pages = 0;
+
+/**
+ * @brief richiamata da sqlite dopo ogni transazione confermata con le
+ * 		pagine attualmente nel WAL: oltre la soglia sveglia il checkpointer
+ * 		(una sola volta per richiesta)
+ */
+static int wal_hook(void *arg, sqlite3 *db, const char *name, int pages)
+{
+	(void)arg;
+	(void)db;
+	(void)name;
+
+	if ((pages >= (int)checkpoint_pages) &&
+		 (!__atomic_exchange_n(&checkpoint_requested, 1, __ATOMIC_ACQ_REL)))
+	{
+		pthread_mutex_lock(&access_checkpoint);
+		pthread_cond_signal(&checkpoint_needed);
+		pthread_mutex_unlock(&access_checkpoint);
+	}
+
+	return SQLITE_OK;
+}
+
+/**
+ * @brief routine del checkpointer: i checkpoint periodici sono PASSIVE e
+ * 		non attendono nessuno. Con letture continue però il WAL non
+ * 		ricomincia mai dall'inizio e cresce senza limite: superata la
+ * 		soglia il checkpoint è RESTART, che attende i lettori in corso
+ * 		perché la scrittura successiva riparta dall'inizio del WAL.
+ * 		Alla terminazione il WAL viene riportato per intero e troncato
+ * 
+ */
+static void *checkpoint_routine(void *arg)
+{
+	sqlite3 *ckpt_db;
+	(void)arg;
+
+	if (open_db(&ckpt_db) != SQLITE_OK)
+		return (void *)0;
+
+	pthread_mutex_lock(&access_checkpoint);
+	while (!checkpoint_stop)
+	{
+		if (!__atomic_load_n(&checkpoint_requested, __ATOMIC_ACQUIRE))
+		{
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += WAL_CHECKPOINT_MS / 1000;
+			deadline.tv_nsec += (WAL_CHECKPOINT_MS % 1000) * 1000000L;
+			if (deadline.tv_nsec >= 1000000000L)
+			{
+				deadline.tv_sec++;
+				deadline.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&checkpoint_needed, &access_checkpoint, &deadline);
+			if (checkpoint_stop)
+				break;
+		}
+		int restart = __atomic_exchange_n(&checkpoint_requested, 0, __ATOMIC_ACQ_REL);
+		pthread_mutex_unlock(&access_checkpoint);
+
+		int log_pages = 0;
+		if (exec_wal_checkpoint(ckpt_db, (restart) ? SQLITE_CHECKPOINT_RESTART : SQLITE_CHECKPOINT_PASSIVE,
+										&log_pages, NULL) == SQLITE_OK)
+		{
+			__atomic_fetch_add(&no_checkpoints, 1, __ATOMIC_RELAXED);
+			if (restart)
+				__atomic_fetch_add(&no_restarts, 1, __ATOMIC_RELAXED);
+		}
+		__atomic_store_n(&wal_pages, log_pages, __ATOMIC_RELAXED);
+
+		pthread_mutex_lock(&access_checkpoint);
+	}
+	pthread_mutex_unlock(&access_checkpoint);
+
+	exec_wal_checkpoint(ckpt_db, SQLITE_CHECKPOINT_TRUNCATE, NULL, NULL);
+	close_db(ckpt_db);
+	return (void *)0;
+}
+
+//-------------------------------------------------------------------------//
+
+/**
+ * @brief group commit (GroupCommitMs > 0 in modalità WAL): il writer
+ * 		conferma la transazione condivisa dagli slaves (vedi
+ * 		exec_group_init), sulla propria connessione
+ */
+static pthread_t writer;
+static int writer_started = 0;
+static sqlite3 *writer_db = NULL;
+
+/* valori dell'ultima stampa, per le medie di db_print_stats */
+static unsigned long last_commits = 0;
+static unsigned long last_ops = 0;
+static struct timespec last_print;
+
+static void *writer_routine(void *arg)
+{
+	(void)arg;
+	exec_group_run();
+	return (void *)0;
+}
+
+void db_print_stats(FILE *fout)
+{
+	if (!wal_mode)
+		return;
+
+	fprintf(fout, STRING_LOG_WAL_STATS,
+			  __atomic_load_n(&no_checkpoints, __ATOMIC_RELAXED),
+			  __atomic_load_n(&no_restarts, __ATOMIC_RELAXED),
+			  __atomic_load_n(&wal_pages, __ATOMIC_RELAXED), checkpoint_pages);
+
+	if (!exec_grouped())
+		return;
+
+	unsigned long commits, ops;
+	struct timespec now;
+	exec_group_stats(&commits, &ops);
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	double elapsed = (now.tv_sec - last_print.tv_sec) + (now.tv_nsec - last_print.tv_nsec) / 1e9;
+	unsigned long new_commits = commits - last_commits;
+	fprintf(fout, STRING_LOG_GROUP_STATS, commits,
+			  (elapsed > 0) ? new_commits / elapsed : 0.0,
+			  (new_commits > 0) ? (double)(ops - last_ops) / new_commits : 0.0);
+
+	last_commits = commits;
+	last_ops = ops;
+	last_print = now;
+}
+
 //-------------------------------------------------------------------------//
 
 int open_db(sqlite3 **db)
@@ -97,17 +268,108 @@ int open_db(sqlite3 **db)
 							  NULL);
 	pthread_mutex_unlock(&access_open_db);
 
-	ret_value += sqlite3_exec(*db, "PRAGMA journal_mode = " JOURNAL_MODE ";", NULL, NULL, NULL);
+	/**
+	 * @note gli slaves avviati col server in funzione trovano il database
+	 * 		in uso: se l'attesa del lock porterebbe ad uno stallo con la
+	 * 		transazione di un altro slave sqlite restituisce subito
+	 * 		SQLITE_BUSY, quindi ritento finché non è terminata
+	 */
+	if (ret_value == SQLITE_OK)
+	{
+		/* in WAL una transazione confermata non attende il disco: viene
+			sincronizzato ad ogni checkpoint */
+		const char *journal = (wal_mode) ? "PRAGMA journal_mode = WAL; PRAGMA synchronous = NORMAL;"
+													: "PRAGMA journal_mode = MEMORY;";
+
+		sqlite3_busy_timeout(*db, DB_BUSY_TIMEOUT);
+		for (int tries = 0;; tries++)
+		{
+			ret_value = sqlite3_exec(*db, journal, NULL, NULL, NULL);
+			if ((ret_value != SQLITE_BUSY) || (tries == DB_BUSY_TIMEOUT))
+				break;
+			usleep(1000);
+		}
+	}
 	if (ret_value != SQLITE_OK)
 	{
 		fprintf(stderr, STRING_BAD_DB_OPEN, sqlite3_errmsg(*db));
 		sqlite3_close(*db);
 	}
+	else if (wal_mode)
+		sqlite3_wal_hook(*db, wal_hook, NULL); /* sostituisce il checkpoint automatico */
 
 	assert(sqlite3_threadsafe());
 	return ret_value;
 }
 
+void close_db(sqlite3 *db)
+{
+	exec_finalize(db);
+	sqlite3_close(db);
+}
+
+/**
+ * @brief callback per la lettura di PRAGMA user_version
+ * 
+ */
+static int read_version(void *version, int argc, char **argv, char **col_name)
+{
+	if ((argc > 0) && (argv[0]))
+		*(int *)version = atoi(argv[0]);
+	return 0;
+}
+
+/**
+ * @brief porta lo schema del database all'ultima versione, applicando
+ * 		in un'unica transazione le migrazioni mancanti
+ * 
+ * @return int (SQLITE_OK) | (SQLITE_FAIL)
+ */
+static int migrate_core_db()
+{
+	int version = 0, ret_value;
+	char *err_msg = 0;
+
+	ret_value = sqlite3_exec(db, "PRAGMA user_version;", read_version, &version, &err_msg);
+	if (ret_value != SQLITE_OK)
+	{
+		BAD_QUERY(err_msg);
+		return ret_value;
+	}
+
+	if (version == schema_version())
+		return SQLITE_OK;
+
+	/* database creato da una versione più recente del server */
+	if (version > schema_version())
+	{
+		fprintf(stderr, STRING_BAD_SCHEMA_VERSION, version, schema_version());
+		return SQLITE_FAIL;
+	}
+
+	int from = version;
+	ret_value = sqlite3_exec(db, "BEGIN IMMEDIATE;", NULL, NULL, &err_msg);
+	for (; (ret_value == SQLITE_OK) && (version < schema_version()); version++)
+		ret_value = sqlite3_exec(db, migratedb(version), NULL, NULL, &err_msg);
+
+	if (ret_value != SQLITE_OK)
+	{
+		BAD_QUERY(err_msg);
+		sqlite3_exec(db, "ROLLBACK;", NULL, NULL, NULL);
+		return ret_value;
+	}
+
+	ret_value = sqlite3_exec(db, "COMMIT;", NULL, NULL, &err_msg);
+	if (ret_value != SQLITE_OK)
+	{
+		BAD_QUERY(err_msg);
+		return ret_value;
+	}
+
+	fprintf(stdout, STRING_LOG_DBMIGRATED, from, version);
+	return SQLITE_OK;
+}
+
 /**
  * @brief esegue l'inizializzazione del database (creazione schema, 
  * 			verifica presenza su disco, ripristino configurazione, ecc.)
@@ -127,6 +389,8 @@ static int init_core_db()
 	 * 3. se il file non esiste si apre un handler e si effettua la query
 	 * 	di creazione del database
 	 * 
+	 * in entrambi i casi lo schema viene poi portato all'ultima versione
+	 * 
 	 */
 
 	ret_value = access(DB_NAME, R_OK | W_OK);
@@ -140,12 +404,14 @@ static int init_core_db()
 		return EXIT_FAILURE;
 
 	system("chmod 777 " DB_NAME "*");
-	/* database già presente, devo resettare il valore dei file descriptor 
-		associati agli utenti che potrebbero essere rimasti aperti in caso
-		di terminazione precedente del server tramite segnale */
+	/* database già presente: gli utenti connessi sono solo in memoria
+		(presence.h), non c'è nulla da ripristinare */
 	if (ret_value == 0)
+		fprintf(stdout, STRING_LOG_DBOPENED);
+	else
 	{
-		ret_value = sqlite3_exec(db, cleardb(), NULL, NULL, &err_msg);
+		/* esecuzione query creazione database */
+		ret_value = sqlite3_exec(db, createdb(), NULL, NULL, &err_msg);
 		if (ret_value != SQLITE_OK)
 		{
 			BAD_QUERY(err_msg);
@@ -153,25 +419,51 @@ static int init_core_db()
 			return ret_value;
 		}
 
-		fprintf(stdout, STRING_LOG_DBOPENED);
-		return EXIT_SUCCESS;
+		sqlite3_free(err_msg);
+
+#ifdef LOG_MSG
+		fprintf(stdout, STRING_LOG_DBCREATED);
+#endif
 	}
-	/* esecuzione query creazione database */
-	ret_value = sqlite3_exec(db, createdb(), NULL, NULL, &err_msg);
+
+	ret_value = migrate_core_db();
 	if (ret_value != SQLITE_OK)
 	{
-		BAD_QUERY(err_msg);
 		sqlite3_close(db);
 		return ret_value;
 	}
 
-	sqlite3_free(err_msg);
+	return EXIT_SUCCESS;
+}
 
-#ifdef LOG_MSG
-	fprintf(stdout, STRING_LOG_DBCREATED);
-#endif
+/**
+ * @brief avvia il thread dello slave "i", attendendo la terminazione del
+ * 		thread che lo ha preceduto con lo stesso indice (già ritirato)
+ * 
+ * @param i indice dello slave
+ */
+static void start_slave(unsigned int i)
+{
+	char slave_id[slave_id_dim];
+	unsigned int *slave_no;
+	int ret_value;
 
-	return EXIT_SUCCESS;
+	if (slaves[i] != INACTIVE_THREAD)
+		pthread_join(*slaves[i], NULL);
+	else
+		slaves[i] = safe_malloc(sizeof(pthread_t));
+
+	slave_no = safe_malloc(sizeof(unsigned int));
+	*slave_no = i;
+	ret_value = pthread_create(slaves[i], NULL, &slave_routine, (void *)slave_no);
+	if (ret_value != 0)
+	{
+		free(slaves[i]);
+		slaves[i] = INACTIVE_THREAD;
+		handle_error(STRING_HANDLE_BAD_THREAD_CREATION);
+	}
+	snprintf(slave_id, sizeof(slave_id), SLAVE_NAME "%u", i);
+	pthread_setname_np(*slaves[i], slave_id); /* utile per il debug */
 }
 
 /**
@@ -184,14 +476,31 @@ static int init_core_db()
  */
 static int init_core_server(conf_param *conf)
 {
-	int i, ret_value;
-	int slave_id_dim = strlen(SLAVE_NAME) + get_digits_number(conf->threads_in_pool) + 1;
+	int ret_value;
+	unsigned int i, no_started;
+	slave_id_dim = strlen(SLAVE_NAME) + get_digits_number(conf->threads_in_pool) + 1;
 
 	/**-----------------------------------------------------------------
-	 * @brief inizializzazione della coda
+	 * @brief inizializzazione delle code (una per slave), la soglia di
+	 * 			sovraccarico è una percentuale della capacità
 	 ------------------------------------------------------------------*/
 
-	queue_init();
+	queue_init(conf->threads_in_pool, conf->max_queued_msgs,
+				  (unsigned int)((unsigned long)conf->max_queued_msgs * conf->queue_high_watermark / 100),
+				  conf->reserved_slaves, conf->interactive_weight, conf->max_connections);
+	/* ThreadsInPool è il massimo, all'avvio solo quelli sempre attivi */
+	no_started = queue_pool_init(conf->min_threads_in_pool, conf->pool_idle_timeout);
+
+	/**-----------------------------------------------------------------
+	 * @brief selezione del motore di invio (prima della creazione 
+	 * 			degli slaves, che ne inizializzano le strutture)
+	 ------------------------------------------------------------------*/
+
+	if (setIoEngine(conf->io_engine) != 0)
+		fprintf(stderr, STRING_BAD_IO_ENGINE, conf->io_engine, strerror(errno));
+#ifdef LOG_MSG
+	fprintf(stdout, STRING_LOG_IO_ENGINE, getIoEngine());
+#endif
 
 	/**-----------------------------------------------------------------
 	 * @brief inizializzazione dei thread
@@ -211,22 +520,35 @@ static int init_core_server(conf_param *conf)
 	if (init_slaves(tot_slaves) != EXIT_SUCCESS)
 		return EXIT_FAILURE;
 
-	for (i = 0; i < tot_slaves; i++)
+	/* la connessione condivisa del group commit deve esistere prima
+		degli slaves che la usano */
+	if ((wal_mode) && (conf->group_commit_ms > 0))
 	{
-		char slave_id[slave_id_dim];
-		unsigned int *slave_no;
+		if (open_db(&writer_db) != SQLITE_OK)
+			return EXIT_FAILURE;
+		exec_group_init(writer_db, conf->group_commit_ms, conf->group_commit_ops);
+		clock_gettime(CLOCK_MONOTONIC, &last_print);
 
-		slaves[i] = safe_malloc(sizeof(pthread_t));
-		slave_no = safe_malloc(sizeof(unsigned int));
-		*slave_no = i;
-		ret_value = pthread_create(slaves[i], NULL, &slave_routine, (void *)slave_no);
-		if (ret_value != 0)
-		{
-			slaves[i] = INACTIVE_THREAD;
+		if (pthread_create(&writer, NULL, &writer_routine, NULL) != 0)
 			handle_error(STRING_HANDLE_BAD_THREAD_CREATION);
-		}
-		snprintf(slave_id, sizeof(slave_id), SLAVE_NAME "%d", i);
-		pthread_setname_np(**(slaves + i), slave_id); /* utile per il debug */
+		pthread_setname_np(writer, WRITER_NAME);
+		writer_started = 1;
+#ifdef LOG_MSG
+		fprintf(stdout, STRING_LOG_GROUP_COMMIT, conf->group_commit_ms, conf->group_commit_ops);
+#endif
+	}
+	else if (conf->group_commit_ms > 0)
+		fprintf(stderr, STRING_BAD_GROUP_COMMIT);
+
+	for (i = 0; i < no_started; i++)
+		start_slave(i);
+
+	if (wal_mode)
+	{
+		if (pthread_create(&checkpointer, NULL, &checkpoint_routine, NULL) != 0)
+			handle_error(STRING_HANDLE_BAD_THREAD_CREATION);
+		pthread_setname_np(checkpointer, CHECKPOINTER_NAME);
+		checkpointer_started = 1;
 	}
 
 	/**-----------------------------------------------------------------
@@ -271,6 +593,7 @@ static int init_core_server(conf_param *conf)
  * @brief routine del server sequenziale multi-client
  * 
  * @param conf struttura con i parametri di configurazione
+ * @param efd descrittore fasullo (eventfd) di terminazione
  * @return int descrittore di comunicazione col signal handler
  */
 int start_core(conf_param *conf, int efd)
@@ -300,6 +623,15 @@ int start_core(conf_param *conf, int efd)
 	}
 #endif
 
+	/* il journal va scelto prima di aprire qualsiasi connessione */
+	wal_mode = (strcmp(conf->db_journal_mode, JOURNAL_WAL) == 0);
+	if ((!wal_mode) && (strcmp(conf->db_journal_mode, JOURNAL_MEMORY) != 0))
+		fprintf(stderr, STRING_BAD_JOURNAL_MODE, conf->db_journal_mode);
+	checkpoint_pages = conf->wal_checkpoint_pages;
+#ifdef LOG_MSG
+	fprintf(stdout, STRING_LOG_JOURNAL_MODE, (wal_mode) ? JOURNAL_WAL : JOURNAL_MEMORY);
+#endif
+
 	/* inizializzazione configurazione database */
 	ret_value = init_core_db(conf);
 	if (ret_value != 0)
@@ -314,9 +646,8 @@ int start_core(conf_param *conf, int efd)
 	}
 
 	/* inizio routine del server */
-	fd_set active_set, read_set;
-	int fd_num = -1;
 	int new_client;
+	int ready[MAX_READY_EVENTS];
 
 	ret_value = listen(server_sock, conf->max_connections + 2);
 	if (ret_value != 0)
@@ -325,159 +656,128 @@ int start_core(conf_param *conf, int efd)
 		handle_error(STRING_HANDLE_BAD_LISTEN);
 	}
 
-	FD_ZERO(&active_set);
-	FD_SET(server_sock, &active_set);
-	FD_SET(efd, &active_set); /* imposto il descrittore fasullo di terminazione */
+	if (sessions_init(conf->max_output_size * 1024, conf->output_full_policy, conf->max_connections) != EXIT_SUCCESS)
+	{
+		stop_core();
+		handle_error(STRING_HANDLE_BAD_SESSIONS);
+	}
+
+	if (presence_init(conf->max_connections) != EXIT_SUCCESS)
+	{
+		stop_core();
+		handle_error(STRING_HANDLE_BAD_PRESENCE);
+	}
 
-	if (server_sock > efd)
-		fd_num = server_sock;
-	else
-		fd_num = efd;
+	if (chatcache_init(conf->chat_cache_size) != EXIT_SUCCESS)
+	{
+		stop_core();
+		handle_error(STRING_HANDLE_BAD_CHATCACHE);
+	}
+
+	/* i gruppi e i loro iscritti vengono letti dal database una sola volta */
+	if ((groups_init(conf->max_connections) != EXIT_SUCCESS) || (exec_loadgroups(db) != SQLITE_OK))
+	{
+		stop_core();
+		handle_error(STRING_HANDLE_BAD_GROUPS);
+	}
+
+	loop = ev_create(conf->event_backend);
+	if (!loop)
+	{
+		stop_core();
+		handle_error(STRING_HANDLE_BAD_EVENT_BACKEND);
+	}
+
+	if (reactors_init(conf) != EXIT_SUCCESS)
+	{
+		reactors_stop();
+		stop_core();
+		handle_error(STRING_HANDLE_BAD_REACTORS);
+	}
+
+	/* il core gestisce solamente la socket del server e il descrittore 
+		fasullo di terminazione */
+	if ((ev_add(loop, server_sock) != 0) || (ev_add(loop, efd) != 0))
+	{
+		stop_core();
+		handle_error(STRING_HANDLE_BAD_EVENT_BACKEND);
+	}
+
+#ifdef LOG_MSG
+	fprintf(stdout, STRING_LOG_EVENT_BACKEND, loop->backend->name);
+#endif
 
 	/**
-	 * @brief routine del server (select + accept)
+	 * @brief routine del server (attesa eventi + accept): vengono
+	 * 		visitati solo i descrittori effettivamente pronti. L'attesa
+	 * 		scade ogni POOL_CHECK_MS per adattare il numero di slaves al
+	 * 		carico
 	 * 
 	 */
 	while (server_running)
 	{
-		read_set = active_set;
-		if (select(fd_num + 1, &read_set, NULL, NULL, NULL) < 0)
+		int no_ready = ev_wait(loop, ready, MAX_READY_EVENTS, POOL_CHECK_MS);
+		if (no_ready < 0)
 		{
+			if (errno == EINTR)
+				continue;
 			stop_core();
-			handle_error(STRING_HANDLE_BAD_SELECT);
+			handle_error(STRING_HANDLE_BAD_EVENT_WAIT);
 		}
 
-		if (FD_ISSET(efd, &read_set))
+		int slot = queue_pool_scale();
+		if (slot >= 0)
+			start_slave(slot);
+
+		for (int i = 0; i < no_ready; i++)
 		{
-			uint64_t ret;
-			if (read(efd, &ret, sizeof(uint64_t)) == sizeof(uint64_t))
+			int fd = ready[i];
+
+			if (fd == efd)
 			{
-				printf("[!!] efd set\n");
+				uint64_t ret;
+				if (read(efd, &ret, sizeof(uint64_t)) == sizeof(uint64_t))
+					printf("[!!] efd set\n");
 				continue;
 			}
-		}
 
-		for (int fd = 0; fd <= fd_num; fd++)
-		{
-			if (FD_ISSET(fd, &read_set))
+			/* nuovo client in ingresso */
+			if (fd == server_sock)
 			{
-				/* nuovo client in ingresso */
-				if (fd == server_sock)
+				new_client = accept(server_sock, NULL, NULL);
+				/* non bloccante in caso di errore */
+				if (new_client < 0)
+					perror(STRING_PERROR(STRING_BAD_ACCEPT));
+				/* il backend non può gestire il descrittore (es. select oltre FD_SETSIZE) */
+				/* la connessione, non bloccante perché gli invii non devono mai
+					bloccare gli slaves (vedi session_send), viene letta da uno dei reactor */
+				else if ((fcntl(new_client, F_SETFL, fcntl(new_client, F_GETFL) | O_NONBLOCK) != 0) ||
+							(!session_open(new_client, conf->max_msg_size, conf->max_file_size * 1024, conf->dir_name)) ||
+							(reactor_assign(new_client) != 0))
 				{
-					new_client = accept(server_sock, NULL, NULL);
-					/* non bloccante in caso di errore */
-					if (new_client < 0)
-						perror(STRING_PERROR(STRING_BAD_ACCEPT));
-					else
-					{
-						FD_SET(new_client, &active_set);
-						if (new_client > fd_num)
-							fd_num = new_client;
-
-#ifdef LOG_MSG
-						fprintf(stdout, STRING_LOG_NEWCONN, new_client);
-						fflush(stdout);
-#endif
-					}
+					perror(STRING_PERROR(STRING_BAD_REACTOR_ASSIGN));
+					session_close(new_client);
+					close(new_client);
 				}
 				else
 				{
-					message_t *new_message = safe_malloc(sizeof(message_t));
-
-					ret_value = readMsg(fd, new_message);
-					/* evitiamo di chiudere tutto il server per errori della read:
-						se causa errori, lo trattiamo come una connessione chiusa */
-
-					if (ret_value <= 0)
-					{
-						/* meglio pulire la memoria allocata */
-						memset(new_message, 0, sizeof(message_t));
-
-						/* imposto la disconnessione dell'utente in base al suo descrittore
-							poiché non ne conosco il nome utente */
-						new_message->hdr.op = DISCONNECT_OP;
-						queue_push(new_message, fd);
-
-						fprintf(stdout, "[++] connessione con fd %d chiusa\n", fd);
-						FD_CLR(fd, &active_set);
-					}
-					/* in caso di file devo aspettare la seconda parte del messaggio */
-					else if (new_message->hdr.op == POSTFILE_OP)
-					{
-						message_data_t *data = safe_malloc(sizeof(message_data_t));
-						memset(data, 0, sizeof(message_data_t));
-						ret_value = readData(fd, data);
-
-						/* connessione chiusa */
-						if (ret_value <= 0)
-						{
-							memset(data, 0, sizeof(message_data_t));
-
-							new_message->hdr.op = DISCONNECT_OP;
-							queue_push(new_message, fd);
-							FD_CLR(fd, &active_set);
-
-							if (data->buf)
-								free(data->buf);
-							free(data);
-						}
-						/* dimensione file permessa superata */
-						else if (data->hdr.len > conf->max_file_size * 1024)
-						{
-							memset(new_message, 0, sizeof(message_t));
-							new_message->hdr.op = OP_MSG_TOOLONG;
-							queue_push(new_message, fd);
-
-							free(data->buf);
-							free(data);
-						}
-						/* inserisco tutto in un unico messaggio
-							il buffer alla fine conterrà: "filename'\0'contenuto del file" */
-						else
-						{
-							new_message->data.buf[new_message->data.hdr.len - 1] = '\0';
-							char *temp = basename(new_message->data.buf);
-							char *p = new_message->data.buf;
-							new_message->data.hdr.len = strlen(temp) + data->hdr.len + 1;
-							new_message->data.buf = safe_malloc(new_message->data.hdr.len * sizeof(char));
-							strcpy(new_message->data.buf, temp);
-							memcpy(&(new_message->data.buf[strlen(temp) + 1]), data->buf, data->hdr.len);
-
-							free(p);
-							free(data->buf);
-							free(data);
-							queue_push(new_message, fd);
-						}
-					}
-					else if (new_message->data.hdr.len > conf->max_msg_size)
-					{
-						memset(new_message, 0, sizeof(message_t));
-						/* liberiamo preventivamente la memoria allocata per il buffer */
-						free(new_message->data.buf);
-						new_message->data.buf = NULL;
-						new_message->hdr.op = OP_MSG_TOOLONG;
-						queue_push(new_message, fd);
-					}
-					/* mi è stato inviato un messaggio con una operazione
-						riservata allo spazio applicativo */
-					else if (new_message->hdr.op < 0)
-					{
-						memset(new_message, 0, sizeof(message_t));
-						new_message->hdr.op = OP_FAIL;
-						queue_push(new_message, fd);
-					}
-					/* tutto ok: passo il messaggio agli slaves */
-					else
-						queue_push(new_message, fd);
+
+#ifdef LOG_MSG
+					fprintf(stdout, STRING_LOG_NEWCONN, new_client);
+					fflush(stdout);
+#endif
 				}
 			}
 		}
 	}
 
-	/* chiudo i descrittori rimasti ancora aperti */
-	for (int i = 0; i <= fd_num; i++)
-		if (FD_ISSET(i, &active_set))
-			close(i);
+	/* i reactor devono terminare prima della chiusura dei descrittori,
+		le connessioni vengono liberate dopo la terminazione degli slaves
+		(stop_core) */
+	reactors_stop();
+
+	ev_destroy(loop);
+	loop = NULL;
 
 	return EXIT_SUCCESS;
 }
@@ -517,6 +817,26 @@ void stop_core()
 		}
 	}
 
+	/* gli slaves hanno atteso le proprie conferme: il writer conferma
+		quanto rimasto e termina */
+	if (writer_started)
+	{
+		exec_group_stop();
+		pthread_join(writer, NULL);
+		writer_started = 0;
+	}
+
+	/* nessuno scrive più sul database: l'ultimo checkpoint svuota il WAL */
+	if (checkpointer_started)
+	{
+		pthread_mutex_lock(&access_checkpoint);
+		checkpoint_stop = 1;
+		pthread_cond_signal(&checkpoint_needed);
+		pthread_mutex_unlock(&access_checkpoint);
+		pthread_join(checkpointer, NULL);
+		checkpointer_started = 0;
+	}
+
 	/* pulisco il vettore di thread */
 	if (slaves)
 	{
@@ -524,17 +844,28 @@ void stop_core()
 		slaves = NULL;
 	}
 
+	/* nessuno scrive più sulle connessioni */
+	sessions_destroy();
+
 	/* pulisco le strutture dati condivise (coda ecc.) */
 	destroy_slaves();
 	destroy_queue_mutex();
+	presence_destroy();
+	chatcache_destroy();
+	groups_destroy();
 
 	unlink(sock_name);
 
 	if (db)
 	{
-		sqlite3_close(db);
+		close_db(db);
 		db = NULL;
 	}
+	if (writer_db)
+	{
+		close_db(writer_db);
+		writer_db = NULL;
+	}
 
 	pthread_mutex_destroy(&access_open_db);
 }
\ No newline at end of file
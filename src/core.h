@@ -14,6 +14,8 @@
 #define _CORE_H_
 
 #define CORE_NAME "CORE"
+#define CHECKPOINTER_NAME "CHECKPOINTER"
+#define WRITER_NAME "WRITER"
 
 #include "sqlite3.h"
 
@@ -22,15 +24,16 @@
 #endif
 
 /**
- * @brief modalità di apertura del database, si veda la relazione
+ * @brief modalità del journal del database (DBJournalMode), si veda la
+ * 		relazione: con "wal" le letture procedono in parallelo alle
+ * 		scritture
  * 
  */
-#ifndef WAL_MODE
-#define JOURNAL_MODE "MEMORY"
-#endif
-#ifdef WAL_MODE
-#define JOURNAL_MODE "WAL"
-#endif
+#define JOURNAL_MEMORY "memory"
+#define JOURNAL_WAL "wal"
+
+/* millisecondi di attesa di un lock sul database prima di SQLITE_BUSY */
+#define DB_BUSY_TIMEOUT 1000
 
 /**
  * @brief restituisce un handler al database
@@ -40,6 +43,14 @@
  */
 int open_db(sqlite3 **db);
 
+/**
+ * @brief chiude l'handler "db" dopo aver liberato le query compilate
+ * 		dal thread chiamante (vedi exec_finalize)
+ * 
+ * @param db 
+ */
+void close_db(sqlite3 *db);
+
 #include "utils.h"
 
 void stop_server();
@@ -90,4 +101,19 @@ int get_maxmsgs();
  */
 char *get_statsfile();
 
+/**
+ * @brief indica se il database è in modalità WAL
+ * 
+ * @return int 1 se in modalità WAL, 0 altrimenti
+ */
+int get_walmode();
+
+/**
+ * @brief stampa su "fout" i checkpoint del WAL eseguiti e, con il group
+ * 		commit, le transazioni confermate al secondo e i messaggi per
+ * 		transazione dall'ultima stampa (nulla se il journal non è WAL)
+ * 
+ */
+void db_print_stats(FILE *fout);
+
 #endif
\ No newline at end of file
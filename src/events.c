@@ -0,0 +1,309 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+/**
+ * @brief il seguente file contiene l'implementazione dei backend di notifica
+ * 		degli eventi sui descrittori:
+ * 		- epoll: costo di ogni risveglio proporzionale ai soli descrittori
+ * 			pronti, nessun limite sul numero di connessioni (default)
+ * 		- select: mantenuto come alternativa portabile, limitato a
+ * 			FD_SETSIZE descrittori e con costo O(max fd) ad ogni risveglio
+ *
+ * @file events.c
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-03
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/epoll.h>
+
+#include "events.h"
+#include "utils.h"
+
+/**------------------------------------------------------------------------
+ * @brief 								backend select
+ ------------------------------------------------------------------------*/
+
+struct select_state
+{
+	fd_set active_set; /**< descrittori registrati */
+	fd_set read_set;	 /**< descrittori di cui notificare la lettura */
+	fd_set write_set;	 /**< descrittori di cui notificare la scrittura */
+	int fd_num;			/**< massimo descrittore registrato */
+};
+
+static int select_init(event_loop *loop)
+{
+	struct select_state *d = safe_malloc(sizeof(struct select_state));
+
+	FD_ZERO(&(d->active_set));
+	FD_ZERO(&(d->read_set));
+	FD_ZERO(&(d->write_set));
+	d->fd_num = -1;
+	loop->data = d;
+
+	return 0;
+}
+
+static int select_add(event_loop *loop, int fd)
+{
+	struct select_state *d = loop->data;
+
+	/* select non può gestire descrittori oltre FD_SETSIZE */
+	if ((fd < 0) || (fd >= FD_SETSIZE))
+	{
+		errno = EMFILE;
+		return -1;
+	}
+
+	FD_SET(fd, &(d->active_set));
+	FD_SET(fd, &(d->read_set));
+	if (fd > d->fd_num)
+		d->fd_num = fd;
+
+	return 0;
+}
+
+static int select_del(event_loop *loop, int fd)
+{
+	struct select_state *d = loop->data;
+
+	if ((fd < 0) || (fd >= FD_SETSIZE))
+	{
+		errno = EBADF;
+		return -1;
+	}
+
+	FD_CLR(fd, &(d->active_set));
+	FD_CLR(fd, &(d->read_set));
+	FD_CLR(fd, &(d->write_set));
+	/* abbasso il massimo se ho rimosso l'ultimo descrittore */
+	while ((d->fd_num >= 0) && (!FD_ISSET(d->fd_num, &(d->active_set))))
+		d->fd_num--;
+
+	return 0;
+}
+
+static int select_watch(event_loop *loop, int fd, int read, int write)
+{
+	struct select_state *d = loop->data;
+
+	if ((fd < 0) || (fd >= FD_SETSIZE) || (!FD_ISSET(fd, &(d->active_set))))
+	{
+		errno = EBADF;
+		return -1;
+	}
+
+	if (read)
+		FD_SET(fd, &(d->read_set));
+	else
+		FD_CLR(fd, &(d->read_set));
+	if (write)
+		FD_SET(fd, &(d->write_set));
+	else
+		FD_CLR(fd, &(d->write_set));
+
+	return 0;
+}
+
+static int select_wait(event_loop *loop, int *ready, int max_ready, int timeout)
+{
+	struct select_state *d = loop->data;
+	struct timeval tv, *p_tv = NULL;
+	fd_set read_set = d->read_set;
+	fd_set write_set = d->write_set;
+	int n = 0;
+
+	if (timeout >= 0)
+	{
+		tv.tv_sec = timeout / 1000;
+		tv.tv_usec = (timeout % 1000) * 1000;
+		p_tv = &tv;
+	}
+
+	if (select(d->fd_num + 1, &read_set, &write_set, NULL, p_tv) < 0)
+		return -1;
+
+	for (int fd = 0; (fd <= d->fd_num) && (n < max_ready); fd++)
+		if ((FD_ISSET(fd, &read_set)) || (FD_ISSET(fd, &write_set)))
+			ready[n++] = fd;
+
+	return n;
+}
+
+static void select_destroy(event_loop *loop)
+{
+	free(loop->data);
+	loop->data = NULL;
+}
+
+static const event_backend select_backend = {
+	 EVENT_BACKEND_SELECT,
+	 select_init,
+	 select_add,
+	 select_del,
+	 select_watch,
+	 select_wait,
+	 select_destroy};
+
+/**------------------------------------------------------------------------
+ * @brief 								backend epoll
+ ------------------------------------------------------------------------*/
+
+struct epoll_state
+{
+	int epfd;
+	struct epoll_event events[MAX_READY_EVENTS];
+};
+
+static int epoll_init(event_loop *loop)
+{
+	struct epoll_state *d = safe_malloc(sizeof(struct epoll_state));
+
+	d->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (d->epfd == -1)
+	{
+		free(d);
+		return -1;
+	}
+	loop->data = d;
+
+	return 0;
+}
+
+static int epoll_add(event_loop *loop, int fd)
+{
+	struct epoll_state *d = loop->data;
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+
+	return epoll_ctl(d->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+static int epoll_del(event_loop *loop, int fd)
+{
+	struct epoll_state *d = loop->data;
+	struct epoll_event ev; /* kernel < 2.6.9 richiedono un puntatore non nullo */
+
+	return epoll_ctl(d->epfd, EPOLL_CTL_DEL, fd, &ev);
+}
+
+static int epoll_watch(event_loop *loop, int fd, int read, int write)
+{
+	struct epoll_state *d = loop->data;
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = ((read) ? EPOLLIN : 0) | ((write) ? EPOLLOUT : 0);
+	ev.data.fd = fd;
+
+	return epoll_ctl(d->epfd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+static int epoll_wait_ready(event_loop *loop, int *ready, int max_ready, int timeout)
+{
+	struct epoll_state *d = loop->data;
+	int n;
+
+	if (max_ready > MAX_READY_EVENTS)
+		max_ready = MAX_READY_EVENTS;
+
+	n = epoll_wait(d->epfd, d->events, max_ready, timeout);
+	for (int i = 0; i < n; i++)
+		ready[i] = d->events[i].data.fd;
+
+	return n;
+}
+
+static void epoll_destroy(event_loop *loop)
+{
+	struct epoll_state *d = loop->data;
+
+	close(d->epfd);
+	free(d);
+	loop->data = NULL;
+}
+
+static const event_backend epoll_backend = {
+	 EVENT_BACKEND_EPOLL,
+	 epoll_init,
+	 epoll_add,
+	 epoll_del,
+	 epoll_watch,
+	 epoll_wait_ready,
+	 epoll_destroy};
+
+/**------------------------------------------------------------------------
+ * @brief 							interfaccia pubblica
+ ------------------------------------------------------------------------*/
+
+static const event_backend *backends[] = {&epoll_backend, &select_backend, NULL};
+
+event_loop *ev_create(const char *name)
+{
+	const event_backend *b = NULL;
+
+	for (int i = 0; backends[i]; i++)
+		if (strcmp(backends[i]->name, name) == 0)
+		{
+			b = backends[i];
+			break;
+		}
+
+	if (!b)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	event_loop *loop = safe_malloc(sizeof(event_loop));
+	loop->backend = b;
+	loop->data = NULL;
+	if (b->init(loop) != 0)
+	{
+		free(loop);
+		return NULL;
+	}
+
+	return loop;
+}
+
+int ev_add(event_loop *loop, int fd)
+{
+	return loop->backend->add(loop, fd);
+}
+
+int ev_del(event_loop *loop, int fd)
+{
+	return loop->backend->del(loop, fd);
+}
+
+int ev_watch(event_loop *loop, int fd, int read, int write)
+{
+	return loop->backend->watch(loop, fd, read, write);
+}
+
+int ev_wait(event_loop *loop, int *ready, int max_ready, int timeout)
+{
+	return loop->backend->wait(loop, ready, max_ready, timeout);
+}
+
+void ev_destroy(event_loop *loop)
+{
+	if (!loop)
+		return;
+
+	loop->backend->destroy(loop);
+	free(loop);
+}
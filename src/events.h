@@ -0,0 +1,113 @@
+/**
+ * @brief interfaccia del backend di notifica degli eventi sui descrittori
+ * 		utilizzato dal core: il backend viene scelto all'avvio tramite il
+ * 		file di configurazione (EventBackend), di default epoll
+ *
+ * @file events.h
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-03
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+#ifndef _EVENTS_H_
+#define _EVENTS_H_
+
+#define EVENT_BACKEND_EPOLL "epoll"
+#define EVENT_BACKEND_SELECT "select"
+
+/* numero massimo di descrittori pronti restituiti da una singola attesa */
+#define MAX_READY_EVENTS 256
+
+typedef struct event_loop event_loop;
+
+/**
+ * @brief tabella delle operazioni che ogni backend deve implementare
+ *
+ */
+typedef struct event_backend
+{
+	const char *name;
+	int (*init)(event_loop *loop);
+	int (*add)(event_loop *loop, int fd);
+	int (*del)(event_loop *loop, int fd);
+	int (*watch)(event_loop *loop, int fd, int read, int write);
+	int (*wait)(event_loop *loop, int *ready, int max_ready, int timeout);
+	void (*destroy)(event_loop *loop);
+} event_backend;
+
+/**
+ * @brief istanza del ciclo di eventi
+ *
+ */
+struct event_loop
+{
+	const event_backend *backend;
+	void *data; /**< stato privato del backend */
+};
+
+/**
+ * @brief crea un ciclo di eventi con il backend di nome "name"
+ *
+ * @param name nome del backend (EVENT_BACKEND_EPOLL | EVENT_BACKEND_SELECT)
+ * @return event_loop* il ciclo di eventi | NULL (errno settato) se il backend
+ * 				non esiste o non può essere inizializzato
+ */
+event_loop *ev_create(const char *name);
+
+/**
+ * @brief registra il descrittore "fd" per gli eventi in lettura
+ *
+ * @param loop ciclo di eventi
+ * @param fd descrittore
+ * @return int 0 se ok, -1 altrimenti (errno settato)
+ */
+int ev_add(event_loop *loop, int fd);
+
+/**
+ * @brief rimuove il descrittore "fd" dal ciclo di eventi
+ * @warning va eseguita PRIMA che il descrittore venga chiuso da qualsiasi
+ * 			thread, altrimenti il numero potrebbe essere già stato riassegnato
+ *
+ * @param loop ciclo di eventi
+ * @param fd descrittore
+ * @return int 0 se ok, -1 altrimenti (errno settato)
+ */
+int ev_del(event_loop *loop, int fd);
+
+/**
+ * @brief sceglie gli eventi notificati per il descrittore (già registrato)
+ * 		"fd": in lettura (attivi alla registrazione) e/o in scrittura
+ * @note con epoll chiusura ed errori vengono notificati anche senza
+ * 		eventi attivi
+ *
+ * @param loop ciclo di eventi
+ * @param fd descrittore
+ * @param read 1 per notificare quando è leggibile, 0 altrimenti
+ * @param write 1 per notificare quando è scrivibile, 0 altrimenti
+ * @return int 0 se ok, -1 altrimenti (errno settato)
+ */
+int ev_watch(event_loop *loop, int fd, int read, int write);
+
+/**
+ * @brief attende che almeno un descrittore sia pronto in lettura o in
+ * 		scrittura, secondo quanto richiesto con ev_watch
+ *
+ * @param loop ciclo di eventi
+ * @param ready vettore dove vengono inseriti i descrittori pronti (una sola
+ * 			volta anche se pronti sia in lettura che in scrittura)
+ * @param max_ready dimensione del vettore
+ * @param timeout millisecondi di attesa (-1 attesa indefinita)
+ * @return int numero di descrittori pronti, -1 in caso di errore (errno settato)
+ */
+int ev_wait(event_loop *loop, int *ready, int max_ready, int timeout);
+
+/**
+ * @brief libera le risorse del ciclo di eventi
+ * @warning non chiude i descrittori registrati
+ *
+ * @param loop ciclo di eventi
+ */
+void ev_destroy(event_loop *loop);
+
+#endif
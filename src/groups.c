@@ -0,0 +1,472 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+/**
+ * @brief il seguente file contiene l'implementazione dell'indice dei gruppi.
+ * 		Ogni iscrizione (member) collega un gruppo e un utente ed è
+ * 		raggiungibile da entrambi: il gruppo tiene il vettore degli
+ * 		iscritti e quello compatto degli iscritti connessi, l'utente il
+ * 		vettore delle sue iscrizioni. Ogni elemento conosce la propria
+ * 		posizione nei vettori, quindi inserimenti e rimozioni sono O(1),
+ * 		mentre connessione e disconnessione costano quanto il numero di
+ * 		gruppi dell'utente.
+ * 		Gruppi, utenti iscritti ad almeno un gruppo e iscrizioni stanno in
+ * 		tabelle hash che raddoppiano quando si riempiono. Un rwlock protegge
+ * 		l'intero indice: gli invii ai gruppi leggono in parallelo
+ *
+ * @file groups.c
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-15
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "groups.h"
+#include "presence.h"
+#include "utils.h"
+
+/**
+ * @brief elemento di una tabella hash, primo campo di ogni struttura
+ * 		indicizzata
+ *
+ */
+typedef struct node
+{
+	struct node *next;
+	unsigned int hash;
+} node;
+
+typedef struct table
+{
+	node **buckets;
+	unsigned int mask;
+	unsigned int count;
+} table;
+
+struct member;
+
+typedef struct group_user
+{
+	node link;
+	char name[MAX_NAME_LENGTH + 1];
+	int fd;						  /**< descrittore, -1 se non connesso */
+	struct member **groups; /**< iscrizioni */
+	int no_groups, groups_dim;
+} group_user;
+
+typedef struct group
+{
+	node link;
+	char name[MAX_NAME_LENGTH + 1];
+	long long chat_id;
+	struct member **members; /**< iscritti */
+	int no_members, members_dim;
+	struct member **online; /**< iscritti connessi */
+	int no_online, online_dim;
+} group;
+
+typedef struct member
+{
+	node link;
+	group *g;
+	group_user *u;
+	int member_pos; /**< posizione in g->members */
+	int user_pos;	 /**< posizione in u->groups */
+	int online_pos; /**< posizione in g->online, -1 se non connesso */
+} member;
+
+static table groups, users, members;
+
+/* utente iscritto ad almeno un gruppo connesso su ogni descrittore */
+static group_user **fd_users = NULL;
+static int fd_users_dim = 0;
+
+static pthread_rwlock_t access_groups = PTHREAD_RWLOCK_INITIALIZER;
+
+//-------------------------------------------------------------------------//
+
+static inline unsigned int member_hash(group *g, group_user *u)
+{
+	return (g->link.hash * 16777619u) ^ u->link.hash;
+}
+
+static int table_init(table *t, unsigned int dim)
+{
+	t->buckets = calloc(dim, sizeof(node *));
+	t->mask = dim - 1;
+	t->count = 0;
+	return (t->buckets) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static void table_insert(table *t, node *n)
+{
+	/* più di due elementi per bucket: raddoppio la tabella */
+	if (t->count >= 2 * (t->mask + 1))
+	{
+		unsigned int dim = 2 * (t->mask + 1);
+		node **buckets = safe_malloc(dim * sizeof(node *));
+		memset(buckets, 0, dim * sizeof(node *));
+		for (unsigned int i = 0; i <= t->mask; i++)
+			while (t->buckets[i])
+			{
+				node *curr = t->buckets[i];
+				t->buckets[i] = curr->next;
+				curr->next = buckets[curr->hash & (dim - 1)];
+				buckets[curr->hash & (dim - 1)] = curr;
+			}
+		free(t->buckets);
+		t->buckets = buckets;
+		t->mask = dim - 1;
+	}
+
+	n->next = t->buckets[n->hash & t->mask];
+	t->buckets[n->hash & t->mask] = n;
+	t->count++;
+}
+
+static void table_remove(table *t, node *n)
+{
+	node **prev = &t->buckets[n->hash & t->mask];
+	while (*prev != n)
+		prev = &((*prev)->next);
+	*prev = n->next;
+	t->count--;
+}
+
+static group *find_group(const char *name)
+{
+	unsigned int h = name_hash(name);
+	for (node *n = groups.buckets[h & groups.mask]; n; n = n->next)
+		if ((n->hash == h) && (strncmp(((group *)n)->name, name, MAX_NAME_LENGTH) == 0))
+			return (group *)n;
+	return NULL;
+}
+
+static group_user *find_user(const char *name)
+{
+	unsigned int h = name_hash(name);
+	for (node *n = users.buckets[h & users.mask]; n; n = n->next)
+		if ((n->hash == h) && (strncmp(((group_user *)n)->name, name, MAX_NAME_LENGTH) == 0))
+			return (group_user *)n;
+	return NULL;
+}
+
+static member *find_member(group *g, group_user *u)
+{
+	unsigned int h = member_hash(g, u);
+	for (node *n = members.buckets[h & members.mask]; n; n = n->next)
+		if ((n->hash == h) && (((member *)n)->g == g) && (((member *)n)->u == u))
+			return (member *)n;
+	return NULL;
+}
+
+/**
+ * @brief aggiunge "m" in fondo al vettore "v" e ne restituisce la posizione
+ *
+ */
+static int push(member ***v, int *no, int *dim, member *m)
+{
+	if (*no == *dim)
+	{
+		*dim = (*dim) ? 2 * (*dim) : 4;
+		*v = realloc(*v, (*dim) * sizeof(member *));
+		if (!*v)
+			handle_error("realloc");
+	}
+	(*v)[*no] = m;
+	return (*no)++;
+}
+
+//-------------------------------------------------------------------------//
+
+static void online_add(member *m)
+{
+	group *g = m->g;
+	m->online_pos = push(&g->online, &g->no_online, &g->online_dim, m);
+}
+
+static void online_del(member *m)
+{
+	group *g = m->g;
+	member *last = g->online[--g->no_online];
+	g->online[m->online_pos] = last;
+	last->online_pos = m->online_pos;
+	m->online_pos = -1;
+}
+
+static void set_online(group_user *u, int fd)
+{
+	u->fd = fd;
+	fd_users[fd] = u;
+	for (int i = 0; i < u->no_groups; i++)
+		online_add(u->groups[i]);
+}
+
+static void set_offline(group_user *u)
+{
+	for (int i = 0; i < u->no_groups; i++)
+		online_del(u->groups[i]);
+	fd_users[u->fd] = NULL;
+	u->fd = -1;
+}
+
+/**
+ * @brief rimuove l'iscrizione "m": l'utente che non ha più gruppi esce
+ * 		dall'indice
+ *
+ */
+static void del_member(member *m)
+{
+	group *g = m->g;
+	group_user *u = m->u;
+
+	if (m->online_pos >= 0)
+		online_del(m);
+
+	g->members[m->member_pos] = g->members[--g->no_members];
+	g->members[m->member_pos]->member_pos = m->member_pos;
+	u->groups[m->user_pos] = u->groups[--u->no_groups];
+	u->groups[m->user_pos]->user_pos = m->user_pos;
+
+	table_remove(&members, &m->link);
+	free(m);
+
+	if (u->no_groups == 0)
+	{
+		if (u->fd >= 0)
+			fd_users[u->fd] = NULL;
+		table_remove(&users, &u->link);
+		free(u->groups);
+		free(u);
+	}
+}
+
+//-------------------------------------------------------------------------//
+
+int groups_init(unsigned int max_connections)
+{
+	if ((fd_users_dim = fd_table_dim(max_connections)) < 0)
+	{
+		fd_users_dim = 0;
+		return EXIT_FAILURE;
+	}
+	fd_users = calloc(fd_users_dim, sizeof(group_user *));
+
+	if ((!fd_users) || (table_init(&groups, 64) != EXIT_SUCCESS) ||
+		 (table_init(&users, 64) != EXIT_SUCCESS) || (table_init(&members, 64) != EXIT_SUCCESS))
+	{
+		groups_destroy();
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+void groups_destroy()
+{
+	if (groups.buckets)
+		for (unsigned int i = 0; i <= groups.mask; i++)
+			while (groups.buckets[i])
+			{
+				group *g = (group *)groups.buckets[i];
+				groups.buckets[i] = g->link.next;
+				while (g->no_members > 0)
+					del_member(g->members[g->no_members - 1]);
+				free(g->members);
+				free(g->online);
+				free(g);
+			}
+
+	free(groups.buckets);
+	free(users.buckets);
+	free(members.buckets);
+	free(fd_users);
+	memset(&groups, 0, sizeof(table));
+	memset(&users, 0, sizeof(table));
+	memset(&members, 0, sizeof(table));
+	fd_users = NULL;
+	fd_users_dim = 0;
+}
+
+void groups_create(const char *name, long long chat_id)
+{
+	pthread_rwlock_wrlock(&access_groups);
+	group *g = find_group(name);
+	if (!g)
+	{
+		g = safe_malloc(sizeof(group));
+		memset(g, 0, sizeof(group));
+		strncpy(g->name, name, MAX_NAME_LENGTH);
+		g->link.hash = name_hash(name);
+		table_insert(&groups, &g->link);
+	}
+	g->chat_id = chat_id;
+	pthread_rwlock_unlock(&access_groups);
+}
+
+void groups_delete(const char *name)
+{
+	pthread_rwlock_wrlock(&access_groups);
+	group *g = find_group(name);
+	if (g)
+	{
+		while (g->no_members > 0)
+			del_member(g->members[g->no_members - 1]);
+		table_remove(&groups, &g->link);
+		free(g->members);
+		free(g->online);
+		free(g);
+	}
+	pthread_rwlock_unlock(&access_groups);
+}
+
+void groups_add(const char *name, const char *user)
+{
+	pthread_rwlock_wrlock(&access_groups);
+	group *g = find_group(name);
+	if (!g)
+	{
+		pthread_rwlock_unlock(&access_groups);
+		return;
+	}
+
+	group_user *u = find_user(user);
+	if (!u)
+	{
+		u = safe_malloc(sizeof(group_user));
+		memset(u, 0, sizeof(group_user));
+		strncpy(u->name, user, MAX_NAME_LENGTH);
+		u->link.hash = name_hash(user);
+		u->fd = -1;
+		table_insert(&users, &u->link);
+
+		/* primo gruppo dell'utente: se è già connesso prendo il descrittore
+			dal registro, le connessioni successive arrivano da groups_connect */
+		int fd = presence_fd(user);
+		if ((fd >= 0) && (fd < fd_users_dim))
+		{
+			if (fd_users[fd])
+				set_offline(fd_users[fd]);
+			set_online(u, fd);
+		}
+	}
+
+	if (!find_member(g, u))
+	{
+		member *m = safe_malloc(sizeof(member));
+		m->g = g;
+		m->u = u;
+		m->link.hash = member_hash(g, u);
+		m->member_pos = push(&g->members, &g->no_members, &g->members_dim, m);
+		m->user_pos = push(&u->groups, &u->no_groups, &u->groups_dim, m);
+		m->online_pos = -1;
+		table_insert(&members, &m->link);
+		if (u->fd >= 0)
+			online_add(m);
+	}
+	pthread_rwlock_unlock(&access_groups);
+}
+
+void groups_remove(const char *name, const char *user)
+{
+	pthread_rwlock_wrlock(&access_groups);
+	group *g = find_group(name);
+	group_user *u = find_user(user);
+	member *m = ((g) && (u)) ? find_member(g, u) : NULL;
+	if (m)
+		del_member(m);
+	pthread_rwlock_unlock(&access_groups);
+}
+
+void groups_forget(const char *user)
+{
+	pthread_rwlock_wrlock(&access_groups);
+	group_user *u = find_user(user);
+	/* l'ultima rimozione libera anche "u" */
+	for (int i = (u) ? u->no_groups - 1 : -1; i >= 0; i--)
+		del_member(u->groups[i]);
+	pthread_rwlock_unlock(&access_groups);
+}
+
+void groups_connect(const char *user, int fd)
+{
+	if ((fd < 0) || (fd >= fd_users_dim))
+		return;
+
+	pthread_rwlock_wrlock(&access_groups);
+	group_user *u = find_user(user);
+	if ((fd_users[fd]) && (fd_users[fd] != u))
+		set_offline(fd_users[fd]);
+	if ((u) && (u->fd != fd))
+	{
+		if (u->fd >= 0)
+			set_offline(u);
+		set_online(u, fd);
+	}
+	pthread_rwlock_unlock(&access_groups);
+}
+
+void groups_disconnect(int fd)
+{
+	if ((fd < 0) || (fd >= fd_users_dim))
+		return;
+
+	pthread_rwlock_wrlock(&access_groups);
+	if (fd_users[fd])
+		set_offline(fd_users[fd]);
+	pthread_rwlock_unlock(&access_groups);
+}
+
+/**
+ * @brief cerca l'iscrizione di "user" a "name"
+ * @warning richiede access_groups
+ *
+ */
+static int lookup_member(const char *name, const char *user, long long *chat_id, group **g)
+{
+	*g = find_group(name);
+	if (!*g)
+		return GROUP_UNKNOWN;
+
+	*chat_id = (*g)->chat_id;
+	group_user *u = find_user(user);
+	return ((u) && (find_member(*g, u))) ? GROUP_MEMBER : GROUP_NOT_MEMBER;
+}
+
+int groups_member(const char *name, const char *user, long long *chat_id)
+{
+	group *g;
+
+	pthread_rwlock_rdlock(&access_groups);
+	int ret = lookup_member(name, user, chat_id, &g);
+	pthread_rwlock_unlock(&access_groups);
+
+	return ret;
+}
+
+int groups_fanout(const char *name, const char *sender, long long *chat_id, long **fds, int *no_fds)
+{
+	group *g;
+
+	*fds = NULL;
+	*no_fds = 0;
+
+	pthread_rwlock_rdlock(&access_groups);
+	int ret = lookup_member(name, sender, chat_id, &g);
+	if ((ret == GROUP_MEMBER) && (g->no_online > 0))
+	{
+		*no_fds = g->no_online;
+		*fds = safe_malloc(g->no_online * sizeof(long));
+		for (int i = 0; i < g->no_online; i++)
+			(*fds)[i] = g->online[i]->u->fd;
+	}
+	pthread_rwlock_unlock(&access_groups);
+
+	return ret;
+}
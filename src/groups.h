@@ -0,0 +1,105 @@
+/**
+ * @brief il seguente file contiene le dichiarazioni dell'indice dei gruppi:
+ * 		per ogni gruppo gli iscritti e i descrittori di quelli connessi,
+ * 		aggiornati ad ogni iscrizione, uscita, connessione e disconnessione.
+ * 		Il database resta la copia persistente, letta solo all'avvio
+ *
+ * @file groups.h
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-15
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+#ifndef _GROUPS_H_
+#define _GROUPS_H_
+
+/* esito delle ricerche nell'indice */
+#define GROUP_MEMBER 0		/* l'utente è iscritto al gruppo */
+#define GROUP_NOT_MEMBER 1 /* il gruppo esiste, l'utente non è iscritto */
+#define GROUP_UNKNOWN 2	  /* il gruppo non esiste */
+
+/**
+ * @brief alloca l'indice, con una posizione per ogni descrittore della
+ * 		tabella delle connessioni (fd_table_dim)
+ *
+ * @param max_connections MaxConnections
+ * @return int EXIT_SUCCESS | EXIT_FAILURE
+ */
+int groups_init(unsigned int max_connections);
+
+/**
+ * @brief libera l'indice
+ * @warning nessun thread deve più accedervi
+ *
+ */
+void groups_destroy();
+
+/**
+ * @brief aggiunge all'indice il gruppo "name" (senza iscritti)
+ *
+ * @param name nome del gruppo
+ * @param chat_id id della chat del gruppo nel database
+ */
+void groups_create(const char *name, long long chat_id);
+
+/**
+ * @brief rimuove il gruppo "name" e tutte le sue iscrizioni
+ *
+ */
+void groups_delete(const char *name);
+
+/**
+ * @brief iscrive "user" al gruppo "name": se l'utente è connesso il suo
+ * 		descrittore entra subito tra quelli del gruppo
+ * @note nessun effetto se il gruppo non esiste (eliminato nel frattempo)
+ *
+ */
+void groups_add(const char *name, const char *user);
+
+/**
+ * @brief rimuove l'iscrizione di "user" al gruppo "name"
+ *
+ */
+void groups_remove(const char *name, const char *user);
+
+/**
+ * @brief rimuove tutte le iscrizioni di "user" (deregistrato)
+ *
+ */
+void groups_forget(const char *user);
+
+/**
+ * @brief "user" si è connesso su "fd": il descrittore entra in tutti i suoi
+ * 		gruppi, prendendo il posto di un eventuale altro utente su "fd"
+ *
+ */
+void groups_connect(const char *user, int fd);
+
+/**
+ * @brief l'utente connesso su "fd" si è disconnesso
+ *
+ */
+void groups_disconnect(int fd);
+
+/**
+ * @brief controlla l'iscrizione di "user" al gruppo "name"
+ *
+ * @param chat_id id della chat del gruppo (se esiste)
+ * @return int GROUP_MEMBER | GROUP_NOT_MEMBER | GROUP_UNKNOWN
+ */
+int groups_member(const char *name, const char *user, long long *chat_id);
+
+/**
+ * @brief restituisce i descrittori degli iscritti connessi al gruppo "name",
+ * 		se "sender" vi è iscritto
+ *
+ * @param chat_id id della chat del gruppo (se esiste)
+ * @param fds vettore allocato (da liberare), NULL se l'esito non è
+ * 			GROUP_MEMBER
+ * @param no_fds numero di descrittori
+ * @return int GROUP_MEMBER | GROUP_NOT_MEMBER | GROUP_UNKNOWN
+ */
+int groups_fanout(const char *name, const char *sender, long long *chat_id, long **fds, int *no_fds);
+
+#endif /* _GROUPS_H_ */
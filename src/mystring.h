@@ -51,16 +51,32 @@ typedef int make_iso_compilers_happy;
 #define STRING_BAD_DB_OPEN SEG("apertura del database %s")
 #define STRING_BAD_QUERY SEG("SQL: %s")
 #define STRING_BAD_DB_ACCESS STRING_PERROR("accesso database salvato")
+#define STRING_BAD_SCHEMA_VERSION SEG("schema del database alla versione %d, il server gestisce al più la %d")
 
 #define STRING_HANDLE_BAD_THREAD_CREATION "creazione thread"
 #define STRING_HANDLE_BAD_SOCKET_CREATION "creazione socket"
 #define STRING_HANDLE_BAD_BIND "assegnamento indirizzo server"
 #define STRING_HANDLE_BAD_LISTEN "ascolto sulla socket"
 #define STRING_HANDLE_BAD_SELECT "utilizzo funzione select"
+#define STRING_HANDLE_BAD_EVENT_WAIT "attesa eventi sui descrittori"
+#define STRING_HANDLE_BAD_EVENT_BACKEND "inizializzazione backend eventi"
+#define STRING_HANDLE_BAD_SESSIONS "allocazione tabella connessioni"
+#define STRING_HANDLE_BAD_PRESENCE "allocazione registro utenti connessi"
+#define STRING_HANDLE_BAD_CHATCACHE "allocazione cache delle chat"
+#define STRING_HANDLE_BAD_GROUPS "caricamento indice dei gruppi"
+#define STRING_HANDLE_BAD_REACTORS "avvio thread reactor"
 #define STRING_HANDLE_BAD_FILE_WRITING "scrittura su file"
 #define STRING_HANDLE_BAD_FILE_READING "lettura su file"
 #define STRING_HANDLE_BAD_FOLDER "accesso cartella temporanea"
 #define STRING_BAD_ACCEPT "accettazione client"
+#define STRING_BAD_EVENT_ADD "registrazione client nel backend eventi"
+#define STRING_BAD_SPOOL "salvataggio file in ricezione"
+#define STRING_BAD_REACTOR_ASSIGN "assegnamento client ad un reactor"
+#define STRING_BAD_IO_ENGINE SEG("motore di invio %s non disponibile (%s), utilizzo quello bloccante")
+#define STRING_BAD_OUTPUT_POLICY SEG("politica di coda piena %s sconosciuta, utilizzo \"drop\"")
+#define STRING_BAD_QUEUE_POLICY SEG("politica di sovraccarico %s sconosciuta, utilizzo \"throttle\"")
+#define STRING_BAD_JOURNAL_MODE SEG("journal del database %s sconosciuto, utilizzo \"memory\"")
+#define STRING_BAD_GROUP_COMMIT SEG("il group commit richiede DBJournalMode = wal, disattivato")
 
 /**************************************************************************************************
  * 												STRINGHE DI LOG
@@ -71,11 +87,23 @@ typedef int make_iso_compilers_happy;
 
 #define STRING_LOG_DBCREATED LOG("database creato")
 #define STRING_LOG_DBOPENED LOG("database salvato aperto correttamente")
+#define STRING_LOG_DBMIGRATED LOG("schema del database aggiornato dalla versione %d alla %d")
+#define STRING_LOG_JOURNAL_MODE LOG("journal del database: %s")
+#define STRING_LOG_GROUP_COMMIT LOG("group commit: finestra %ums, al più %u operazioni")
+#define STRING_LOG_GROUP_STATS LOG("group commit: %lu commit, %.1f commit/s e %.1f messaggi per commit dall'ultima stampa")
+#define STRING_LOG_WAL_STATS LOG("WAL: %lu checkpoint (%lu con attesa dei lettori), %d pagine dopo l'ultimo (soglia %u)")
 
 #define STRING_LOG_DEFCONF LOG("configurazione di default caricata")
 #define STRING_LOG_USRCONF LOG("configurazione utente caricata")
 
 #define STRING_LOG_NEWCONN LOG("nuova connessione accettata su fd: %d")
+#define STRING_LOG_EVENT_BACKEND LOG("backend eventi: %s")
+#define STRING_LOG_IO_ENGINE LOG("motore di invio: %s")
+#define STRING_LOG_REACTOR_STATS LOG("reactor %u: %lu connessioni, %.1f eventi/s (%lu totali), %lu letture sospese, %lu richieste rifiutate")
+#define STRING_LOG_QUEUE_STATS LOG("slave %u: %lu messaggi in coda, %lu connessioni rubate")
+#define STRING_LOG_QUEUE_CLASS LOG("operazioni %s: %lu eseguite, latenza p50 %.1fms p99 %.1fms")
+#define STRING_LOG_QUEUE_LOAD LOG("coda: %lu/%lu messaggi (massimo %lu), sovraccarico %lu volte per %.3fs")
+#define STRING_LOG_QUEUE_POOL LOG("pool: %u slaves attivi (minimo %u, massimo %u), %lu attivazioni, %lu ritiri")
 
 #define STRING_MAX_VALUE_EXCEEDED                                            \
 	SEG("file di configurazione, superato il valore limite %d alla linea %d") \
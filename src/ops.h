@@ -60,6 +60,7 @@ typedef enum
     OP_NICK_UNKNOWN = 27, // nickname non riconosciuto
     OP_MSG_TOOLONG = 28,  // messaggio con size troppo lunga
     OP_NO_SUCH_FILE = 29, // il file richiesto non esiste
+    OP_BUSY = 30,         // server sovraccarico, richiesta non eseguita
 
     /* 
      * aggiungere qui altri messaggi di ritorno che possono servire 
@@ -69,4 +70,50 @@ typedef enum
 
 } op_t;
 
+/**
+ * @brief classi di priorità delle richieste nella coda degli slaves: le
+ * 		operazioni pesanti (trasferimenti di file, history, broadcast)
+ * 		vengono eseguite separatamente da quelle interattive
+ */
+typedef enum
+{
+    OP_CLASS_INTERACTIVE = 0, /// connessione, lista utenti, messaggi, gruppi
+    OP_CLASS_BULK = 1,        /// operazioni che possono richiedere centinaia di ms
+
+    OP_CLASSES = 2
+} op_class_t;
+
+static inline op_class_t op_class(op_t op)
+{
+    switch (op)
+    {
+    case POSTTXTALL_OP:
+    case POSTFILE_OP:
+    case GETFILE_OP:
+    case GETPREVMSGS_OP:
+        return OP_CLASS_BULK;
+    default:
+        return OP_CLASS_INTERACTIVE;
+    }
+}
+
+/**
+ * @brief operazioni che leggono il database senza modificarlo (a parte le
+ *      statistiche degli errori)
+ */
+static inline int op_readonly(op_t op)
+{
+    switch (op)
+    {
+    case GETFILE_OP:
+    case GETPREVMSGS_OP:
+    case USRLIST_OP:
+    case CONNECT_OP:    /* la presenza è in memoria (presence.h) */
+    case DISCONNECT_OP:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
 #endif /* OPS_H_ */
@@ -0,0 +1,412 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+/**
+ * @brief il seguente file contiene l'implementazione del registro degli
+ * 		utenti connessi.
+ * 		Le letture non acquisiscono lock (seqlock): le scritture, serializzate
+ * 		da un mutex, rendono dispari il contatore "seq" mentre modificano il
+ * 		registro e il lettore che trova il contatore cambiato ripete la
+ * 		lettura. Le strutture lette non vengono mai liberate prima della
+ * 		terminazione, quindi una lettura concorrente ad una scrittura legge
+ * 		al più dati non consistenti, mai memoria non valida
+ *
+ * @file presence.c
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-12
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "config.h"
+#include "presence.h"
+#include "utils.h"
+
+/* il nome in parole, completato con zeri: il confronto legge parole intere */
+#define NAME_WORDS ((MAX_NAME_LENGTH + sizeof(unsigned long)) / sizeof(unsigned long))
+
+/**
+ * @brief stato di un descrittore nel registro
+ * @warning allocato alla prima connessione sul descrittore e mai liberato
+ * 			prima della terminazione del server
+ *
+ */
+typedef struct presence_slot
+{
+	unsigned long name[NAME_WORDS]; /**< utente connesso */
+	unsigned int hash;				  /**< hash del nome */
+	int online;							  /**< posizione in online + 1, 0 se nessuno è connesso */
+	int next;							  /**< descrittore successivo nella lista del bucket */
+} presence_slot;
+
+static presence_slot **slots = NULL; /* indicizzati per descrittore */
+static int slots_dim = 0;
+
+/* tabella per nome: ogni bucket è la lista (per descrittore) dei nomi con
+	lo stesso hash, -1 se vuota */
+static int *buckets = NULL;
+static unsigned int buckets_mask;
+
+/* descrittori degli utenti connessi, compatti per le liste */
+static int *online = NULL;
+static int no_online = 0;
+
+static pthread_mutex_t access_presence = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long seq = 0;
+
+//-------------------------------------------------------------------------//
+
+static inline unsigned long read_begin()
+{
+	unsigned long s;
+	/* scrittura in corso: lascio il processore allo scrittore */
+	while ((s = __atomic_load_n(&seq, __ATOMIC_ACQUIRE)) & 1)
+		sched_yield();
+	return s;
+}
+
+static inline int read_retry(unsigned long s)
+{
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&seq, __ATOMIC_RELAXED) != s;
+}
+
+static inline void write_begin()
+{
+	pthread_mutex_lock(&access_presence);
+	__atomic_store_n(&seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void write_end()
+{
+	__atomic_store_n(&seq, seq + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&access_presence);
+}
+
+#define load(x) __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define store(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+//-------------------------------------------------------------------------//
+
+/**
+ * @brief copia "user" in "key" e ne restituisce l'hash (name_hash)
+ *
+ */
+static unsigned int make_key(const char *user, unsigned long *key)
+{
+	memset(key, 0, NAME_WORDS * sizeof(unsigned long));
+	strncpy((char *)key, user, MAX_NAME_LENGTH);
+
+	return name_hash((const char *)key);
+}
+
+static inline int same_name(presence_slot *s, const unsigned long *key)
+{
+	for (size_t i = 0; i < NAME_WORDS; i++)
+		if (load(s->name[i]) != key[i])
+			return 0;
+	return 1;
+}
+
+/**
+ * @brief cerca il descrittore di "key" nel bucket "h"
+ * @warning da eseguire tra read_begin e read_retry (o con il mutex)
+ *
+ * @return int descrittore | PRESENCE_OFFLINE | (-2) se la lista è stata
+ * 			modificata durante la lettura
+ */
+static int lookup(const unsigned long *key, unsigned int h)
+{
+	int fd = load(buckets[h & buckets_mask]);
+	int steps = 0;
+
+	while (fd >= 0)
+	{
+		presence_slot *s;
+		if ((fd >= slots_dim) || (++steps > slots_dim) ||
+			 !(s = __atomic_load_n(&slots[fd], __ATOMIC_ACQUIRE)))
+			return -2;
+		if (same_name(s, key))
+			return fd;
+		fd = load(s->next);
+	}
+
+	return PRESENCE_OFFLINE;
+}
+
+/**
+ * @brief aggiunge "key" al registro sul descrittore "fd" (non connesso)
+ * @warning richiede write_begin
+ *
+ */
+static void link_fd(int fd, const unsigned long *key, unsigned int h)
+{
+	presence_slot *s = slots[fd];
+	if (!s)
+	{
+		s = safe_malloc(sizeof(presence_slot));
+		memset(s, 0, sizeof(presence_slot));
+		__atomic_store_n(&slots[fd], s, __ATOMIC_RELEASE);
+	}
+
+	for (size_t i = 0; i < NAME_WORDS; i++)
+		store(s->name[i], key[i]);
+	s->hash = h;
+	store(s->next, buckets[h & buckets_mask]);
+	store(buckets[h & buckets_mask], fd);
+
+	store(online[no_online], fd);
+	store(s->online, no_online + 1);
+	store(no_online, no_online + 1);
+}
+
+/**
+ * @brief rimuove dal registro l'utente connesso su "fd"
+ * @warning richiede write_begin
+ *
+ */
+static void unlink_fd(int fd)
+{
+	presence_slot *s = slots[fd];
+
+	int *prev = &buckets[s->hash & buckets_mask];
+	while (*prev != fd)
+		prev = &(slots[*prev]->next);
+	store(*prev, s->next);
+
+	/* l'ultimo connesso prende il posto di quello rimosso */
+	int pos = s->online - 1, last = online[no_online - 1];
+	store(online[pos], last);
+	store(slots[last]->online, pos + 1);
+	store(no_online, no_online - 1);
+	store(s->online, 0);
+}
+
+//-------------------------------------------------------------------------//
+
+int presence_init(unsigned int expected)
+{
+	if ((slots_dim = fd_table_dim(expected)) < 0)
+	{
+		slots_dim = 0;
+		return EXIT_FAILURE;
+	}
+
+	unsigned int no_buckets = 64;
+	while ((no_buckets < 2 * expected) && (no_buckets < (1u << 20)))
+		no_buckets <<= 1;
+	buckets_mask = no_buckets - 1;
+
+	slots = calloc(slots_dim, sizeof(presence_slot *));
+	online = calloc(slots_dim, sizeof(int));
+	buckets = malloc(no_buckets * sizeof(int));
+	if ((!slots) || (!online) || (!buckets))
+	{
+		presence_destroy();
+		return EXIT_FAILURE;
+	}
+	memset(buckets, -1, no_buckets * sizeof(int));
+	no_online = 0;
+
+	return EXIT_SUCCESS;
+}
+
+void presence_destroy()
+{
+	if (slots)
+		for (int i = 0; i < slots_dim; i++)
+			if (slots[i])
+				free(slots[i]);
+
+	free(slots);
+	free(online);
+	free(buckets);
+	slots = NULL;
+	online = NULL;
+	buckets = NULL;
+	slots_dim = 0;
+	no_online = 0;
+}
+
+int presence_connect(const char *user, int fd)
+{
+	if ((fd < 0) || (fd >= slots_dim))
+		return PRESENCE_FAIL;
+
+	unsigned long key[NAME_WORDS];
+	unsigned int h = make_key(user, key);
+	int ret = PRESENCE_OK;
+
+	write_begin();
+	int curr_fd = lookup(key, h);
+	if (curr_fd == fd)
+		ret = PRESENCE_SAME;
+	else if (curr_fd != PRESENCE_OFFLINE)
+		ret = PRESENCE_BUSY;
+	else
+	{
+		if ((slots[fd]) && (slots[fd]->online))
+			unlink_fd(fd);
+		link_fd(fd, key, h);
+	}
+	write_end();
+
+	return ret;
+}
+
+void presence_disconnect(int fd)
+{
+	if ((fd < 0) || (fd >= slots_dim))
+		return;
+
+	write_begin();
+	if ((slots[fd]) && (slots[fd]->online))
+		unlink_fd(fd);
+	write_end();
+}
+
+void presence_remove(const char *user)
+{
+	unsigned long key[NAME_WORDS];
+	unsigned int h = make_key(user, key);
+
+	write_begin();
+	int fd = lookup(key, h);
+	if (fd >= 0)
+		unlink_fd(fd);
+	write_end();
+}
+
+int presence_fd(const char *user)
+{
+	unsigned long key[NAME_WORDS];
+	unsigned int h = make_key(user, key);
+	unsigned long s;
+	int fd;
+
+	do
+	{
+		s = read_begin();
+		fd = lookup(key, h);
+	} while ((read_retry(s)) || (fd == -2));
+
+	return fd;
+}
+
+int presence_count()
+{
+	return load(no_online);
+}
+
+/**
+ * @brief copia in "dest" (almeno "size" posizioni) i descrittori connessi
+ * @warning da eseguire tra read_begin e read_retry
+ *
+ * @return int numero di connessi | (-1) se "dest" è troppo piccolo
+ */
+static int copy_online(int *dest, int size)
+{
+	int n = load(no_online);
+	if ((n > size) || (n > slots_dim))
+		return -1;
+
+	for (int i = 0; i < n; i++)
+		dest[i] = load(online[i]);
+	return n;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp((const char *)a, (const char *)b);
+}
+
+char *presence_names(int *buf_dim)
+{
+	const int width = MAX_NAME_LENGTH + 1;
+	int size = 0, n;
+	int *fds = NULL;
+	char *names = NULL;
+	unsigned long s;
+
+	do
+	{
+		s = read_begin();
+		n = copy_online(fds, size);
+		if (n < 0)
+		{
+			/* più connessi dello spazio allocato: rialloco (i dati letti
+				non servono) e ripeto la lettura */
+			free(fds);
+			free(names);
+			size = load(no_online) + 16;
+			fds = safe_malloc(size * sizeof(int));
+			names = safe_malloc(size * width);
+			continue;
+		}
+
+		for (int i = 0; i < n; i++)
+		{
+			presence_slot *slot = __atomic_load_n(&slots[fds[i]], __ATOMIC_ACQUIRE);
+			unsigned long name[NAME_WORDS];
+			for (size_t w = 0; (slot) && (w < NAME_WORDS); w++)
+				name[w] = load(slot->name[w]);
+			if (!slot)
+				n = -1;
+			else
+				memcpy(names + i * width, name, width);
+		}
+	} while ((read_retry(s)) || (n < 0));
+
+	free(fds);
+	if (n == 0)
+	{
+		free(names);
+		names = safe_malloc(1);
+	}
+	else
+	{
+		for (int i = 0; i < n; i++)
+			names[(i + 1) * width - 1] = '\0';
+		qsort(names, n, width, compare_names);
+	}
+
+	*buf_dim = n * width;
+	return names;
+}
+
+int presence_fds(long **fds)
+{
+	int size = 0, n;
+	int *buf = NULL;
+	unsigned long s;
+
+	do
+	{
+		s = read_begin();
+		n = copy_online(buf, size);
+		if (n < 0)
+		{
+			free(buf);
+			size = load(no_online) + 16;
+			buf = safe_malloc(size * sizeof(int));
+		}
+	} while ((read_retry(s)) || (n < 0));
+
+	*fds = NULL;
+	if (n > 0)
+	{
+		*fds = safe_malloc(n * sizeof(long));
+		for (int i = 0; i < n; i++)
+			(*fds)[i] = buf[i];
+	}
+	free(buf);
+
+	return n;
+}
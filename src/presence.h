@@ -0,0 +1,101 @@
+/**
+ * @brief il seguente file contiene le dichiarazioni del registro degli
+ * 		utenti connessi: l'unica fonte per sapere se un utente è online e
+ * 		su quale descrittore, indicizzato per nome e per descrittore
+ *
+ * @file presence.h
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-12
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+#ifndef _PRESENCE_H_
+#define _PRESENCE_H_
+
+/* utente non connesso (stesso valore di DISCONNECTED_FD) */
+#define PRESENCE_OFFLINE -1
+
+/* esito di presence_connect */
+#define PRESENCE_OK 0	  /* utente connesso sul descrittore */
+#define PRESENCE_SAME 1	  /* utente già connesso sullo stesso descrittore */
+#define PRESENCE_BUSY 2	  /* utente già connesso su un altro descrittore */
+#define PRESENCE_FAIL 3	  /* descrittore fuori dalla tabella */
+
+/**
+ * @brief alloca il registro
+ *
+ * @param expected numero di utenti connessi atteso (MaxConnections): 
+ * 			dimensiona la tabella per nome, che può comunque contenerne di
+ * 			più, e quella per descrittore (fd_table_dim)
+ * @return int EXIT_SUCCESS | EXIT_FAILURE
+ */
+int presence_init(unsigned int expected);
+
+/**
+ * @brief libera il registro
+ * @warning nessun thread deve più accedervi
+ *
+ */
+void presence_destroy();
+
+/**
+ * @brief registra "user" come connesso su "fd": un utente diverso già
+ * 		connesso su "fd" viene disconnesso (relazione 1:1 tra utente e
+ * 		descrittore)
+ *
+ * @param user nome utente
+ * @param fd descrittore
+ * @return int PRESENCE_OK | PRESENCE_SAME | PRESENCE_BUSY | PRESENCE_FAIL
+ */
+int presence_connect(const char *user, int fd);
+
+/**
+ * @brief disconnette l'utente connesso su "fd" (se presente)
+ *
+ * @param fd descrittore
+ */
+void presence_disconnect(int fd);
+
+/**
+ * @brief disconnette "user" (se connesso), ad esempio perché deregistrato
+ *
+ * @param user nome utente
+ */
+void presence_remove(const char *user);
+
+/**
+ * @brief restituisce il descrittore su cui è connesso "user"
+ * @note non acquisisce alcun lock
+ *
+ * @param user nome utente
+ * @return int descrittore | PRESENCE_OFFLINE
+ */
+int presence_fd(const char *user);
+
+/**
+ * @brief numero di utenti connessi
+ *
+ */
+int presence_count();
+
+/**
+ * @brief restituisce i nomi degli utenti connessi in ordine alfabetico, in
+ * 		posizioni di MAX_NAME_LENGTH + 1 caratteri
+ * @note non acquisisce alcun lock
+ *
+ * @param buf_dim dimensione del buffer restituito
+ * @return char* buffer allocato (da liberare)
+ */
+char *presence_names(int *buf_dim);
+
+/**
+ * @brief restituisce i descrittori di tutti gli utenti connessi
+ * @note non acquisisce alcun lock
+ *
+ * @param fds vettore allocato (da liberare), NULL se nessuno è connesso
+ * @return int numero di descrittori
+ */
+int presence_fds(long **fds);
+
+#endif /* _PRESENCE_H_ */
@@ -25,6 +25,8 @@
 #include <unistd.h>
 #include <pthread.h>
 #include <semaphore.h>
+#include <errno.h>
+#include <time.h>
 
 #include "sqlite3.h"
 #include "message.h"
@@ -33,6 +35,8 @@
 #include "core.h"
 #include "stats.h"
 #include "slaves.h"
+#include "chatcache.h"
+#include "groups.h"
 
 //-------------------------------------------------------------------------//
 
@@ -73,13 +77,42 @@ static const char query_createdb[] = QUOTE(
 	 INSERT INTO _Stats VALUES('0', '0', '0', '0', '0'););
 
 /**
- * @brief imposta tutti gli utenti come disconessi, da eseguire all'avvio
- * 		del server
+ * @brief migrazioni dello schema: query_migrations[v] porta un database
+ * 		dalla versione v (PRAGMA user_version) alla v + 1. Lo schema di
+ * 		query_createdb è la versione 0, quella dei database creati prima
+ * 		del versionamento
  * 
+ * 1. indici per le query più frequenti: disconnessione per descrittore e
+ * 	utenti online (curr_fd, gli offline hanno -1 e restano fuori dal
+ * 	range curr_fd >= 0), chat di un utente e cronologia di una chat
+ * 	ordinata per tempo
+ * 2. la presenza degli utenti è in memoria (presence.h): curr_fd resta
+ * 	nello schema ma vale sempre -1 e il suo indice non serve più
+ * 3. i messaggi a tutti (POSTTXTALL) sono salvati una sola volta in
+ * 	_Broadcast: un utente li riceve se registrato prima dell'invio, cioè
+ * 	se broadcast_id supera il suo broadcast_from (ultimo broadcast alla
+ * 	registrazione, gli utenti già presenti partono da 0)
  */
-static const char query_cleardb[] = QUOTE(
-	 UPDATE _User
-		  SET curr_fd = -1;);
+static const char *const query_migrations[] = {
+	 QUOTE(
+		  CREATE INDEX IF NOT EXISTS _User_curr_fd ON _User(curr_fd);
+		  CREATE INDEX IF NOT EXISTS _Chat_User_username ON _Chat_User(username, chat_id);
+		  CREATE INDEX IF NOT EXISTS _Message_chat_time ON _Message(chat_id, sent_time);
+		  PRAGMA user_version = 1;),
+	 QUOTE(
+		  DROP INDEX IF EXISTS _User_curr_fd;
+		  UPDATE _User SET curr_fd = -1;
+		  PRAGMA user_version = 2;),
+	 QUOTE(
+		  CREATE TABLE IF NOT EXISTS _Broadcast(
+				broadcast_id integer PRIMARY KEY AUTOINCREMENT,
+				message varchar NOT NULL,
+				sent_by varchar NOT NULL,
+				sent_time datetime NOT NULL);
+		  ALTER TABLE _User ADD COLUMN broadcast_from integer NOT NULL DEFAULT 0;
+		  PRAGMA user_version = 3;)};
+
+#define SCHEMA_VERSION ((int)(sizeof(query_migrations) / sizeof(*query_migrations)))
 
 //-------------------------------------------------------------------------//
 
@@ -100,6 +133,9 @@ static const char query_cleardb[] = QUOTE(
 static pthread_mutex_t access_db_op = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t db_busy = PTHREAD_COND_INITIALIZER;
 
+/* unico percorso di scrittura in modalità WAL */
+static pthread_mutex_t access_db_write = PTHREAD_MUTEX_INITIALIZER;
+
 /* non è necessario che sia volatile sig_atomic_t in quanto non ha 
 	relazione con nessun signal handler */
 static int terminate_queries = 0;
@@ -122,6 +158,33 @@ static type_db_op db_op = noop;
 /* numero di lettori contemporaneamente attivi */
 static int no_reader = 0;
 
+/* 1 se il thread ha aperto una transazione con exec_begin_batch */
+static __thread int in_batch = 0;
+/* connessione della transazione aperta dal thread */
+static __thread sqlite3 *batch_db = NULL;
+
+/**
+ * @brief group commit: le transazioni degli slaves vengono eseguite una
+ * 		dopo l'altra sulla connessione condivisa "db" e restano aperte
+ * 		finché il writer non le conferma tutte con un solo COMMIT.
+ * 		Protetto da access_db_write
+ */
+static struct
+{
+	sqlite3 *db;				  /* NULL se il group commit non è attivo */
+	unsigned int window_ms;	  /* attesa massima della transazione aperta */
+	unsigned int max_ops;	  /* operazioni oltre cui si conferma subito */
+	int open;					  /* transazione aperta su db */
+	struct timespec opened;	  /* istante di apertura (CLOCK_REALTIME) */
+	unsigned int ops;			  /* operazioni nella transazione aperta */
+	unsigned int joining;	  /* slaves in attesa di unirsi (atomico) */
+	unsigned long id;			  /* transazioni confermate */
+	unsigned long committed_ops; /* operazioni confermate */
+	int stop;
+	pthread_cond_t pending;	  /* transazione da confermare (writer) */
+	pthread_cond_t committed; /* transazione confermata (slaves) */
+} batch_group = {.pending = PTHREAD_COND_INITIALIZER, .committed = PTHREAD_COND_INITIALIZER};
+
 /**
  * @brief indica alle connessioni in coda nel database che è stata richiesta
  * 		la terminazione
@@ -133,122 +196,424 @@ void terminate_db()
 	pthread_cond_broadcast(&db_busy);
 }
 
-int exec_query(sqlite3 *db, char *query, int(callback)(void *, int, char **, char **), void *result)
+/**
+ * @brief esegue "query" senza sincronizzazione: termina il server in caso
+ * 		di errore come exec_prepared
+ *
+ */
+static int exec_unlocked(sqlite3 *db, const char *query, int(callback)(void *, int, char **, char **), void *result)
 {
 	char *err = 0;
-	int i, second_chance = 0;
-	char query_op = *query;
+	int i = sqlite3_exec(db, query, callback, result, &err);
 
-#ifdef WAL_MODE
-	/**
-	 * @warning la modalità WAL permette la scrittura e lettura
-	 * 		concorrente multipla sul database senza necessità di 
-	 * 		sincronizzazione manuale
-	 * 
-	 * @warning NON TESTATA
-	 */
+	if ((i != SQLITE_OK) && (i != SQLITE_CONSTRAINT))
+	{
+		fprintf(stderr, "[!!] Errore nel database: %s -- %d\n", err, sqlite3_extended_errcode(db));
+		sqlite3_free(err);
+		exit(EXIT_FAILURE);
+	}
+
+	sqlite3_free(err);
+	return i;
+}
 
-	for (;;)
+/**
+ * @brief acquisisce l'accesso al database per l'operazione "op": possiamo
+ * 		eseguire letture parallele ma solo una scrittura per volta.
+ * 		In modalità WAL i lettori non vengono sincronizzati (leggono
+ * 		l'ultima versione confermata anche durante una scrittura), gli
+ * 		scrittori si alternano sul mutex invece di attendere il lock di
+ * 		sqlite, che ritenta a intervalli crescenti
+ * 
+ * @return int 1 se acquisito, 0 se è stata richiesta la terminazione
+ */
+static int db_acquire(type_db_op op)
+{
+	if (get_walmode())
 	{
-		i = sqlite3_exec(db, query, callback, result, &err);
+		if (op == writing)
+			pthread_mutex_lock(&access_db_write);
+		return 1;
+	}
+
+	pthread_mutex_lock(&access_db_op);
+	if (op == reading)
+		while ((!terminate_queries) && (db_op == writing))
+			pthread_cond_wait(&db_busy, &access_db_op);
+	else
+		while ((!terminate_queries) && (db_op != noop))
+			pthread_cond_wait(&db_busy, &access_db_op);
+
+	/* richiesta la terminazione */
+	if (terminate_queries)
+	{
+		pthread_cond_broadcast(&db_busy);
+		pthread_mutex_unlock(&access_db_op);
+		return 0;
+	}
+
+	db_op = op;
+	if (op == reading)
+		no_reader++; // incremento il numero di lettori
+	pthread_mutex_unlock(&access_db_op);
+
+	return 1;
+}
 
-		if (second_chance)
-			break;
+/**
+ * @brief rilascia l'accesso acquisito con db_acquire
+ * 
+ */
+static void db_release(type_db_op op)
+{
+	if (get_walmode())
+	{
+		if (op == writing)
+			pthread_mutex_unlock(&access_db_write);
+		return;
+	}
 
-		if ((i == SQLITE_BUSY) || (i == SQLITE_LOCKED))
+	pthread_mutex_lock(&access_db_op);
+	if (op == reading)
+	{
+		no_reader--;
+		/* se sono terminati i lettori imposto il db in no-operation */
+		if (no_reader == 0)
 		{
-			second_chance = 1;
-			continue;
+			db_op = noop;
+			pthread_cond_signal(&db_busy); // sveglio un writer
 		}
+	}
+	else
+	{
+		db_op = noop;
+		pthread_cond_broadcast(&db_busy);
+	}
+	pthread_mutex_unlock(&access_db_op);
+}
 
-		break;
+int exec_begin_batch(sqlite3 *db)
+{
+	/* acquisisco l'accesso in scrittura per l'intera transazione: le
+		query del gruppo non passano più dalla sincronizzazione */
+	if (batch_group.db)
+		__atomic_add_fetch(&batch_group.joining, 1, __ATOMIC_RELAXED);
+	int acquired = db_acquire(writing);
+	if (batch_group.db)
+		__atomic_sub_fetch(&batch_group.joining, 1, __ATOMIC_RELAXED);
+	if (!acquired)
+		return 0;
+
+	if (batch_group.db)
+	{
+		/* mi unisco alla transazione aperta, se non c'è la apro e il
+			writer inizia a contare la finestra */
+		if (!batch_group.open)
+		{
+			exec_unlocked(batch_group.db, "BEGIN IMMEDIATE;", NULL, NULL);
+			batch_group.open = 1;
+			clock_gettime(CLOCK_REALTIME, &batch_group.opened);
+			pthread_cond_signal(&batch_group.pending);
+		}
+		batch_db = batch_group.db;
+	}
+	else
+	{
+		exec_unlocked(db, "BEGIN IMMEDIATE;", NULL, NULL);
+		batch_db = db;
 	}
+	in_batch = 1;
 
-#endif
-#ifndef WAL_MODE
-	type_db_op requested_op;
+	return 1;
+}
 
-	/**
-	 * @warning possiamo eseguire letture parallele del database 
-	 * 			ma solo una scrittura per volta
-	 */
-	switch (query_op)
-	{
-	case 'S': /* select */
-		requested_op = reading;
-		break;
-	case 'I': /* insert */
-	case 'D': /* delete */
-	case 'U': /* update */
-	case 'C': /* create */
-		requested_op = writing;
-		break;
-	default:
-		fprintf(stderr, "[!!] Unknown query operation\n");
-		exit(EXIT_FAILURE);
-	}
+/**
+ * @brief conferma la transazione condivisa e sveglia gli slaves che la
+ * 		attendono
+ * @warning richiede access_db_write
+ * 
+ */
+static void group_commit()
+{
+	if (!batch_group.open)
+		return;
+
+	exec_unlocked(batch_group.db, "COMMIT;", NULL, NULL);
+	batch_group.open = 0;
+	batch_group.committed_ops += batch_group.ops;
+	batch_group.ops = 0;
+	batch_group.id++;
+	pthread_cond_broadcast(&batch_group.committed);
+}
+
+void exec_end_batch(sqlite3 *db, int no_ops)
+{
+	if (!in_batch)
+		return;
 
-	if (requested_op == reading)
+	in_batch = 0;
+	batch_db = NULL;
+
+	if (!batch_group.db)
 	{
-		pthread_mutex_lock(&access_db_op);
-		while ((!terminate_queries) && (db_op == writing))
-			pthread_cond_wait(&db_busy, &access_db_op);
+		exec_unlocked(db, "COMMIT;", NULL, NULL);
+		db_release(writing);
+		return;
+	}
 
-		/* richiesta la terminazione */
-		if (terminate_queries)
+	/* se nessuno slave è in coda per unirsi la finestra non aggiungerebbe
+		altre operazioni, solo latenza: confermo subito */
+	unsigned long my_commit = batch_group.id;
+	batch_group.ops += no_ops;
+	if ((batch_group.ops >= batch_group.max_ops) || (batch_group.stop) ||
+		 (__atomic_load_n(&batch_group.joining, __ATOMIC_RELAXED) == 0))
+		group_commit();
+
+	/* le risposte partono solo a transazione confermata */
+	while (batch_group.id == my_commit)
+		pthread_cond_wait(&batch_group.committed, &access_db_write);
+	db_release(writing);
+}
+
+void exec_group_init(sqlite3 *writer, unsigned int window_ms, unsigned int max_ops)
+{
+	batch_group.db = writer;
+	batch_group.window_ms = window_ms;
+	batch_group.max_ops = (max_ops > 0) ? max_ops : 1;
+}
+
+int exec_grouped()
+{
+	return (batch_group.db != NULL);
+}
+
+void exec_group_run()
+{
+	pthread_mutex_lock(&access_db_write);
+	while (!batch_group.stop)
+	{
+		if (!batch_group.open)
 		{
-			pthread_cond_broadcast(&db_busy);
-			pthread_mutex_unlock(&access_db_op);
-			sqlite3_free(err);
-			return SQLITE_FAIL;
+			pthread_cond_wait(&batch_group.pending, &access_db_write);
+			continue;
 		}
 
-		if (db_op == noop)
-			db_op = reading;
-		if (db_op == reading)
+		struct timespec deadline = batch_group.opened;
+		deadline.tv_sec += batch_group.window_ms / 1000;
+		deadline.tv_nsec += (batch_group.window_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L)
 		{
-			no_reader++; // incremento il numero di lettori
-			pthread_mutex_unlock(&access_db_op);
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
 
-			i = sqlite3_exec(db, query, callback, result, &err);
+		/* la transazione può essere confermata da uno slave (max_ops)
+			mentre attendo: ricontrollo dall'inizio */
+		unsigned long id = batch_group.id;
+		if ((pthread_cond_timedwait(&batch_group.pending, &access_db_write, &deadline) == ETIMEDOUT) &&
+			 (batch_group.id == id))
+			group_commit();
+	}
+	group_commit();
+	pthread_mutex_unlock(&access_db_write);
+}
 
-			pthread_mutex_lock(&access_db_op);
-			no_reader--;
-			/* se sono terminati i lettori imposto il db in no-operation */
-			if (no_reader == 0)
-			{
-				db_op = noop;
-				pthread_cond_signal(&db_busy); // sveglio un writer
-			}
-			pthread_mutex_unlock(&access_db_op);
+void exec_group_stop()
+{
+	pthread_mutex_lock(&access_db_write);
+	batch_group.stop = 1;
+	pthread_cond_signal(&batch_group.pending);
+	pthread_mutex_unlock(&access_db_write);
+}
+
+void exec_group_stats(unsigned long *commits, unsigned long *ops)
+{
+	pthread_mutex_lock(&access_db_write);
+	*commits = batch_group.id;
+	*ops = batch_group.committed_ops;
+	pthread_mutex_unlock(&access_db_write);
+}
+
+int exec_wal_checkpoint(sqlite3 *db, int mode, int *log_pages, int *done_pages)
+{
+	int ret;
+
+	/* un checkpoint che attende i lettori blocca anche le scritture: gli
+		scrittori attendono sul mutex e non nel busy handler di sqlite */
+	if (mode == SQLITE_CHECKPOINT_PASSIVE)
+		return sqlite3_wal_checkpoint_v2(db, NULL, mode, log_pages, done_pages);
+
+	db_acquire(writing);
+	group_commit(); /* la transazione aperta bloccherebbe il checkpoint */
+	ret = sqlite3_wal_checkpoint_v2(db, NULL, mode, log_pages, done_pages);
+	db_release(writing);
+
+	return ret;
+}
+
+/**--------------------------------------------------------------------------
+ * @brief 						query preparate
+ *--------------------------------------------------------------------------*/
+
+/* testo delle query, indicizzato per enum query_id */
+static const char *query_text[QUERIES] = {
+	 [Q_INSERTUSER] = query_insertuser,
+	 [Q_REMOVEUSER] = query_removeuser,
+	 [Q_REMOVEUSER_CHATS] = query_removeuser_chats,
+	 [Q_REMOVEUSER_MESSAGES] = query_removeuser_messages,
+	 [Q_REMOVEUSER_BROADCASTS] = query_removeuser_broadcasts,
+	 [Q_CHECKEXISTUSER] = query_checkexistuser,
+	 [Q_CHECKEXISTNAME] = query_checkexistname,
+	 [Q_CREATECHAT] = query_createchat,
+	 [Q_CREATEGROUP] = query_creategroup,
+	 [Q_INSERT_USER_IN_CHAT] = query_insert_user_in_chat,
+	 [Q_CHECKEXISTINGCHAT] = query_checkexistingchat,
+	 [Q_INSERTMESSAGE] = query_insertmessage,
+	 [Q_INSERTBROADCAST] = query_insertbroadcast,
+	 [Q_POSTFILE] = query_postfile,
+	 [Q_DELFILE] = query_delfile,
+	 [Q_GETFILE] = query_getfile,
+	 [Q_GETTOTALUSER] = query_gettotaluser,
+	 [Q_GETGROUPOWNER] = query_getgroupowner,
+	 [Q_DELGROUP_MESSAGES] = query_delgroup_messages,
+	 [Q_DELGROUP_USERS] = query_delgroup_users,
+	 [Q_DELGROUP] = query_delgroup,
+	 [Q_REMOVEUSER_FROM_GROUP] = query_removeuser_from_group,
+	 [Q_REMOVEUSER_FROM_GROUP_MESSAGES] = query_removeuser_from_group_messages,
+	 [Q_LOADGROUPS] = query_loadgroups,
+	 [Q_GETPREVMSGS] = query_getprevmsgs,
+#ifndef MAKE_TEST_HAPPY
+	 [Q_INCREASESTATS] = query_increasestats,
+	 [Q_GET_FROM_STATS] = query_get_from_stats,
+#endif
+};
+
+/**
+ * @brief query già compilate dal thread per l'handler "db": ogni slave
+ * 		usa sempre lo stesso handler, quindi le compila una volta sola.
+ * 		La seconda posizione contiene quelle per la connessione del
+ * 		group commit
+ * 
+ */
+struct stmt_cache
+{
+	sqlite3 *db;
+	sqlite3_stmt *stmts[QUERIES];
+};
+static __thread struct stmt_cache cache[2];
+
+/**
+ * @brief libera le query compilate in "c"
+ * 
+ */
+static void cache_finalize(struct stmt_cache *c)
+{
+	for (int i = 0; i < QUERIES; i++)
+		if (c->stmts[i])
+		{
+			sqlite3_finalize(c->stmts[i]);
+			c->stmts[i] = NULL;
 		}
+	c->db = NULL;
+}
+
+/**
+ * @brief termina il server in caso di errore del database (come in
+ * 		exec_unlocked)
+ * 
+ */
+static void db_failure(sqlite3 *db)
+{
+	fprintf(stderr, "[!!] Errore nel database: %s -- %d\n", sqlite3_errmsg(db), sqlite3_extended_errcode(db));
+	exit(EXIT_FAILURE);
+}
+
+sqlite3_stmt *exec_prepare(sqlite3 *db, enum query_id id)
+{
+	if (in_batch)
+		db = batch_db;
+
+	struct stmt_cache *c = &cache[(batch_group.db) && (db == batch_group.db)];
+	if (c->db != db)
+	{
+		cache_finalize(c);
+		c->db = db;
 	}
-	else // writing
+
+	sqlite3_stmt **stmt = &(c->stmts[id]);
+	if ((!*stmt) &&
+		 (sqlite3_prepare_v3(db, query_text[id], -1, SQLITE_PREPARE_PERSISTENT, stmt, NULL) != SQLITE_OK))
+		db_failure(db);
+
+	return *stmt;
+}
+
+void exec_finalize(sqlite3 *db)
+{
+	if ((db) && (cache[0].db == db))
+		cache_finalize(&cache[0]);
+
+	/* il thread smette di usare il database: anche le query per la
+		connessione condivisa, compilate anche da uno slave che ha eseguito
+		solo scritture raggruppate (cache[0] mai utilizzata) */
+	cache_finalize(&cache[1]);
+}
+
+/**
+ * @brief esegue in ordine le query "stmts" passando ogni riga risultato a
+ * 		"reader", quindi le reimposta per l'esecuzione successiva
+ * 
+ * @return int SQLITE_OK o il codice d'errore della prima query fallita
+ */
+static int run_statements(sqlite3_stmt **stmts, int no_stmts, row_reader reader, void *result)
+{
+	int ret = SQLITE_OK;
+
+	for (int k = 0; (k < no_stmts) && (ret == SQLITE_OK); k++)
 	{
-		for (;;)
-		{
-			pthread_mutex_lock(&access_db_op);
-			while ((!terminate_queries) && (db_op != noop))
-				pthread_cond_wait(&db_busy, &access_db_op);
+		int i;
 
-			/* richiesta la terminazione */
-			if (terminate_queries)
-			{
-				pthread_cond_broadcast(&db_busy);
-				pthread_mutex_unlock(&access_db_op);
-				sqlite3_free(err);
-				return SQLITE_OK;
-			}
+		while ((i = sqlite3_step(stmts[k])) == SQLITE_ROW)
+			if (reader)
+				reader(stmts[k], result);
+
+		if (i != SQLITE_DONE)
+			ret = i;
+		sqlite3_reset(stmts[k]);
+	}
 
-			db_op = writing;
-			pthread_mutex_unlock(&access_db_op);
+	return ret;
+}
 
-			i = sqlite3_exec(db, query, callback, result, &err); // accesso esclusivo
 
-			pthread_mutex_lock(&access_db_op);
-			db_op = noop;
-			pthread_cond_broadcast(&db_busy);
-			pthread_mutex_unlock(&access_db_op);
+int exec_prepared(sqlite3 *db, sqlite3_stmt **stmts, int no_stmts, row_reader reader, void *result)
+{
+	int i, second_chance = 0;
+
+	/* dentro una transazione il thread possiede già l'accesso al database */
+	if (in_batch)
+		i = run_statements(stmts, no_stmts, reader, result);
+	else
+	{
+		type_db_op requested_op = reading;
+
+		for (int k = 0; k < no_stmts; k++)
+			if (!sqlite3_stmt_readonly(stmts[k]))
+				requested_op = writing;
+
+		for (;;)
+		{
+			if (!db_acquire(requested_op))
+				return (requested_op == reading) ? SQLITE_FAIL : SQLITE_OK;
+			/* una scrittura fuori dal group commit attende il lock di
+				sqlite, tenuto dalla transazione condivisa: la confermo */
+			if (requested_op == writing)
+				group_commit();
+			i = run_statements(stmts, no_stmts, reader, result);
+			db_release(requested_op);
+			/* le letture non vengono ripetute */
+			if (requested_op == reading)
+				break;
 
 			if (second_chance)
 				break;
@@ -262,16 +627,10 @@ int exec_query(sqlite3 *db, char *query, int(callback)(void *, int, char **, cha
 			break; // query eseguita
 		}
 	}
-#endif
 
 	if ((i != SQLITE_OK) && (i != SQLITE_CONSTRAINT))
-	{
-		fprintf(stderr, "[!!] Errore nel database: %s -- %d\n", err, sqlite3_extended_errcode(db));
-		sqlite3_free(err);
-		exit(EXIT_FAILURE);
-	}
+		db_failure(sqlite3_db_handle(stmts[0]));
 
-	sqlite3_free(err);
 	return i;
 }
 
@@ -294,101 +653,164 @@ void set_error_message(message_t *ans, op_t OP, char *buffer, int buf_dim, char
 }
 
 /**--------------------------------------------------------------------------
- * @brief 						funzioni di callback
+ * @brief 				raccolta delle righe risultato
  *--------------------------------------------------------------------------*/
 
-int getstringlist_callback(void *param, int argc, char **argv, char **col_name)
+void result_init(result_set *set, size_t row_size)
+{
+	set->rows = NULL;
+	set->row_size = row_size;
+	set->no_rows = 0;
+	set->size = 0;
+	set->arena = NULL;
+}
+
+void *result_add(result_set *set)
+{
+	if (set->no_rows == set->size)
+	{
+		unsigned int size = (set->size == 0) ? RESULT_ROWS : set->size * 2;
+		char *rows = realloc(set->rows, size * set->row_size);
+		if (!rows)
+			handle_error(STRING_BAD_REALLOC);
+		set->rows = rows;
+		set->size = size;
+	}
+
+	void *row = set->rows + (set->no_rows++) * set->row_size;
+	memset(row, 0, set->row_size);
+	return row;
+}
+
+char *result_text(result_set *set, sqlite3_stmt *stmt, int col, unsigned int *len)
+{
+	const unsigned char *text = sqlite3_column_text(stmt, col);
+	*len = 0;
+	if (!text)
+		return NULL;
+
+	*len = sqlite3_column_bytes(stmt, col) + 1;
+	size_t dim = (size_t)*len;
+
+	result_block *block = set->arena;
+	if ((!block) || (block->size - block->used < dim))
+	{
+		/* i testi più grandi di un blocco ne ricevono uno dedicato, inserito
+			dopo quello corrente che resta in uso per i successivi */
+		size_t size = (dim > RESULT_BLOCK_SIZE) ? dim : RESULT_BLOCK_SIZE;
+		result_block *new_block = safe_malloc(sizeof(result_block) + size);
+		new_block->used = 0;
+		new_block->size = size;
+		if ((block) && (dim > RESULT_BLOCK_SIZE))
+		{
+			new_block->next = block->next;
+			block->next = new_block;
+		}
+		else
+		{
+			new_block->next = block;
+			set->arena = new_block;
+		}
+		block = new_block;
+	}
+
+	char *copy = block->data + block->used;
+	memcpy(copy, text, dim);
+	block->used += dim;
+
+	return copy;
+}
+
+void result_free(result_set *set)
 {
-	struct callback_param_string *c = (struct callback_param_string *)param;
+	while (set->arena)
+	{
+		result_block *next = set->arena->next;
+		free(set->arena);
+		set->arena = next;
+	}
+	free(set->rows);
+	result_init(set, set->row_size);
+}
 
-	/* per un qualche motivo il numero di utenti è maggiore della dimensione allocata */
-	if (c->curr_pos >= c->size)
-		return EXIT_SUCCESS;
+/**--------------------------------------------------------------------------
+ * @brief 				lettura tipizzata delle righe risultato
+ *--------------------------------------------------------------------------*/
 
-	char *curr_pos = (c->result) + ((c->curr_pos * (MAX_NAME_LENGTH + 1)));
-	if (argv[0])
-		strcpy(curr_pos, argv[0]);
-	c->curr_pos++;
+int read_stringlist(sqlite3_stmt *stmt, void *param)
+{
+	char *name = result_add((result_set *)param);
+	const unsigned char *text = sqlite3_column_text(stmt, 0);
+	if (text)
+	{
+		int len = sqlite3_column_bytes(stmt, 0);
+		if (len > MAX_NAME_LENGTH)
+			len = MAX_NAME_LENGTH;
+		memcpy(name, text, len);
+		name[len] = '\0';
+	}
 
 	return EXIT_SUCCESS;
 }
 
-int getlong_callback(void *param, int argc, char **argv, char **col_name)
+int read_long(sqlite3_stmt *stmt, void *param)
 {
 	long *par = (long *)param;
-	if (argv[0])
-		*par = strtol(argv[0], NULL, 10);
-	else
-		*par = GETLONG_ERROR;
+
+	*par = (sqlite3_column_type(stmt, 0) == SQLITE_NULL) ? GETLONG_ERROR : (long)sqlite3_column_int64(stmt, 0);
 
 	return EXIT_SUCCESS;
 }
 
-int getstats_callback(void *param, int argc, char **argv, char **col_name)
+int read_group(sqlite3_stmt *stmt, void *param)
 {
-	unsigned long *vector = (unsigned long *)param;
+	const char *name = (const char *)sqlite3_column_text(stmt, 1);
 
-	for (int i = 0; i < argc; i++)
-		*(vector + i) = (argv[i]) ? strtol(argv[i], NULL, 10) : GETLONG_ERROR;
+	groups_create(name, sqlite3_column_int64(stmt, 0));
+	/* gruppo senza iscritti */
+	if (sqlite3_column_type(stmt, 2) != SQLITE_NULL)
+		groups_add(name, (const char *)sqlite3_column_text(stmt, 2));
 
 	return EXIT_SUCCESS;
 }
 
-int getlonglist_callback(void *param, int argc, char **argv, char **col_name)
+int read_stats(sqlite3_stmt *stmt, void *param)
 {
-	struct callback_param_long *c = (struct callback_param_long *)param;
-
-	if (c->curr_pos >= c->size)
-		return EXIT_SUCCESS;
+	unsigned long *vector = (unsigned long *)param;
 
-	long *curr_pos = (c->result) + (c->curr_pos);
-	*curr_pos = (argv[0]) ? strtol(argv[0], NULL, 10) : GETLONG_ERROR;
+	for (int i = 0; i < sqlite3_column_count(stmt); i++)
+		*(vector + i) = (sqlite3_column_type(stmt, i) == SQLITE_NULL) ? GETLONG_ERROR : (unsigned long)sqlite3_column_int64(stmt, i);
 
-	(c->curr_pos)++;
 	return EXIT_SUCCESS;
 }
 
-int getmessagelist_callback(void *param, int argc, char **argv, char **col_name)
+int read_messagelist(sqlite3_stmt *stmt, void *param)
 {
-	struct callback_param_message *m = (struct callback_param_message *)param;
+	result_set *set = (result_set *)param;
+	message_t *msg = result_add(set);
 
-	if (m->curr_pos >= m->size)
-		return EXIT_SUCCESS;
-
-	message_t *curr_pos = m->result + m->curr_pos;
-	if (!curr_pos)
-		return EXIT_FAILURE;
-	curr_pos->data.buf = NULL;
-	curr_pos->data.hdr.len = 0;
 	/* message - filename - sent_by */
-	if (argv[0]) /* message */
-	{
-		curr_pos->hdr.op = TXT_MESSAGE;
-		curr_pos->data.hdr.len = strlen(argv[0]) + 1;
-		curr_pos->data.buf = safe_malloc(curr_pos->data.hdr.len * sizeof(char));
-		strcpy(curr_pos->data.buf, argv[0]);
-	}
-	else if (argv[1]) /* filename */
-	{
-		curr_pos->hdr.op = FILE_MESSAGE;
-		curr_pos->data.hdr.len = strlen(argv[1]) + 1;
-		curr_pos->data.buf = safe_malloc(curr_pos->data.hdr.len * sizeof(char));
-		strcpy(curr_pos->data.buf, argv[1]);
-	}
+	if ((msg->data.buf = result_text(set, stmt, 0, &(msg->data.hdr.len)))) /* message */
+		msg->hdr.op = TXT_MESSAGE;
+	else if ((msg->data.buf = result_text(set, stmt, 1, &(msg->data.hdr.len)))) /* filename */
+		msg->hdr.op = FILE_MESSAGE;
 	else
-		curr_pos->hdr.op = OP_FAIL;
+		msg->hdr.op = OP_FAIL;
 
-	if (argv[2]) /* sent_by */
-		strcpy(curr_pos->hdr.sender, argv[2]);
+	const unsigned char *sent_by = sqlite3_column_text(stmt, 2);
+	if (sent_by)
+	{
+		strncpy(msg->hdr.sender, (const char *)sent_by, MAX_NAME_LENGTH);
+		msg->hdr.sender[MAX_NAME_LENGTH] = '\0';
+	}
 
-	(m->curr_pos)++;
 	return EXIT_SUCCESS;
 }
 /*-------------------------------------------------------*/
 
 /**
- * @brief - inserisce l'utente nel database e imposta come paramentro curr_fd l'attuale descrittore
- * 		 - chiama la funzione "exec_get_online_user" per mostrare la lista di utenti online
+ * @brief - inserisce l'utente nel database e lo registra come connesso sull'attuale descrittore
+ * 		 - risponde con la lista di utenti online (presence_names)
  * 
  * @param user utente da inserire nel database
  * @param *ans il messaggio di risposta (allocato dalla funzione)
@@ -425,7 +847,7 @@ op_t manage_insertuser(char *user, int fd, message_t *ans, sqlite3 *db)
 		return OP_NICK_ALREADY;
 	}
 
-	ret_value = exec_insertuser(db, user, fd);
+	ret_value = exec_insertuser(db, user);
 
 	/* utente già presente */
 	if (ret_value == SQLITE_CONSTRAINT)
@@ -435,7 +857,9 @@ op_t manage_insertuser(char *user, int fd, message_t *ans, sqlite3 *db)
 	else
 	{
 		int buf_dim;
-		char *s = exec_get_online_user(db, &buf_dim);
+		if (presence_connect(user, fd) == PRESENCE_OK)
+			groups_connect(user, fd);
+		char *s = presence_names(&buf_dim);
 		set_reply_message(ans, OP_OK, s, buf_dim, "", "");
 	}
 
@@ -450,6 +874,9 @@ op_t manage_unregisteruser(char *user, sqlite3 *db)
 	if (ret_value != SQLITE_OK)
 		return OP_FAIL;
 
+	presence_remove(user);
+	chatcache_forget(user);
+	groups_forget(user);
 	return OP_OK;
 }
 
@@ -481,61 +908,40 @@ op_t manage_connectuser(char *user, int fd, message_t *ans, sqlite3 *db)
 	}
 
 	/**
-	 * @brief controlla che l'utente non sia già collegato
+	 * @brief registra l'utente come collegato, se non lo è già
 	 * 
 	 */
-	exec_getuserfd(db, user, &query_result);
+	ret_value = presence_connect(user, fd);
 
-	/* connessione successiva a registrazione, non devo fare nient'altro */
-	if (query_result == fd)
-	{
-		int buf_dim;
-		char *s = exec_get_online_user(db, &buf_dim);
-		set_reply_message(ans, OP_OK, s, buf_dim, "", "");
-#ifdef MAKE_TEST_HAPPY
-		increase_sem_stats(sem_stats[1], -1);
-#endif
-		return OP_OK;
-	}
-
-	/* l'utente è già connesso */
-	if (query_result != DISCONNECTED_FD)
+	/* l'utente è già connesso su un'altra connessione */
+	if ((ret_value == PRESENCE_BUSY) || (ret_value == PRESENCE_FAIL))
 	{
 		/* set_error_message(ans, OP_FAIL, STRING_CLIENT_USER_BUSY,
 								strlen(STRING_CLIENT_USER_BUSY) + 1, "", ""); */
 		return OP_FAIL;
 	}
 
-	/* COND: l'utente non è connesso */
-
-	/**
-	 * @brief inserisce l'utente nel database come collegato
-	 * 
-	 */
-	ret_value = exec_connectuser(db, user, fd);
+#ifdef MAKE_TEST_HAPPY
+	/* connessione successiva a registrazione, non devo fare nient'altro */
+	if (ret_value == PRESENCE_SAME)
+		increase_sem_stats(sem_stats[1], -1);
+#endif
 
-	/* utente non presente */
-	if (ret_value == SQLITE_CONSTRAINT)
-	{
-		/* set_error_message(ans, OP_NICK_UNKNOWN, STRING_CLIENT_USER_NICK_ALREADY,
-								strlen(STRING_CLIENT_USER_NICK_ALREADY) + 1, "", ""); */
-		return OP_NICK_UNKNOWN;
-	}
+	if (ret_value == PRESENCE_OK)
+		groups_connect(user, fd);
 
-	/* registrazione eseguita correttamente, richiedo lista utenti online */
-	else
-	{
-		int buf_dim;
-		char *s = exec_get_online_user(db, &buf_dim);
-		set_reply_message(ans, OP_OK, s, buf_dim, "", "");
-	}
+	/* connessione eseguita correttamente, richiedo lista utenti online */
+	int buf_dim;
+	char *s = presence_names(&buf_dim);
+	set_reply_message(ans, OP_OK, s, buf_dim, "", "");
 
 	return OP_OK;
 }
 
-void manage_disconnectuser(int fd, sqlite3 *db)
+void manage_disconnectuser(int fd)
 {
-	exec_disconnectuser(db, fd);
+	presence_disconnect(fd);
+	groups_disconnect(fd);
 }
 
 /**
@@ -548,10 +954,12 @@ void manage_disconnectuser(int fd, sqlite3 *db)
  * @return int* 
  */
 
-long *manage_postmessage(message_t *msg, int sender_fd, int *no_fd, enum operation *branch, sqlite3 *db)
+long *manage_postmessage(message_t *msg, int *no_fd, enum operation *branch, sqlite3 *db)
 {
-	long receiver_fd = GETLONG_ERROR, group_id = GETLONG_ERROR;
+	long receiver_fd = GETLONG_ERROR;
+	long long group_id = -1;
 	sqlite3_int64 chat_id = -1;
+	unsigned long cache_epoch;
 
 	*branch = user;
 	long *fd = NULL;
@@ -583,59 +991,49 @@ long *manage_postmessage(message_t *msg, int sender_fd, int *no_fd, enum operati
 	/* CASO 1/2: */
 	if ((msg->hdr.op == POSTTXT_OP) || (msg->hdr.op == POSTFILE_OP))
 	{
-		/* controllo che l'utente ricevente esista e ne prendo il fd */
-		exec_getuserfd(db, receiver, &receiver_fd);
-
-		if (receiver_fd == GETLONG_ERROR) /* l'utente non esiste: potrebbe essere un gruppo */
+		/* i nomi di utenti e gruppi sono distinti: se è un gruppo prendo
+			dall'indice i fd degli iscritti online, controllando che il
+			mittente ne faccia parte */
+		int in_group = groups_fanout(receiver, sender, &group_id, &fd, no_fd);
+		if (in_group == GROUP_NOT_MEMBER)
 		{
-			exec_checkexistinggroup(db, receiver, &group_id);
-			if (group_id == GETLONG_ERROR) /* non esiste nemmeno il gruppo */
-			{
-				*no_fd = -1;
-				fd = NULL;
-				return fd;
-			}
-			else /* recupero i fd di tutti gli utenti del gruppo attualmente online */
+			*no_fd = NOT_IN_GROUP;
+			return NULL;
+		}
+		else if (in_group == GROUP_MEMBER)
+			*branch = group;
+		else
+		{
+			/* prendo il fd del ricevente: se non è connesso controllo che
+				esista nel database, a meno che la cache non contenga già la
+				loro chat (le chat degli utenti deregistrati vengono rimosse) */
+			chat_id = chatcache_get(sender, receiver, &cache_epoch);
+			receiver_fd = presence_fd(receiver);
+			if ((receiver_fd == DISCONNECTED_FD) && (chat_id == CHATCACHE_MISS))
 			{
-				int isInGroup = 0;
-
-				*branch = group;
-
-				exec_getonlineuser_in_group(db, group_id, &fd, no_fd);
-
-				/* controllo che l'utente faccia parte del gruppo */
-				for (int i = 0; i < *no_fd; i++)
-					if ((fd[i]) && (fd[i] == sender_fd))
-					{
-						isInGroup = 1;
-						break;
-					}
-
-				if (!isInGroup)
+				long exists;
+				exec_checkexistuser(db, receiver, &exists);
+				if (exists != 1) /* non esiste né l'utente né il gruppo */
 				{
-					*no_fd = NOT_IN_GROUP;
-					if (fd)
-					{
-						free(fd);
-						fd = NULL;
-					}
-					return fd;
+					*no_fd = -1;
+					return NULL;
 				}
 			}
-		}
-		else
-		{
+
 			*branch = user;
 			fd = safe_malloc(sizeof(long));
-			/* da cambiare in caso di gruppi */
 			*no_fd = 1;
 			*fd = receiver_fd;
 		}
 	}
+	/* CASO 3: il messaggio viene salvato una sola volta, i destinatari lo
+		trovano nella cronologia (exec_getprevmsgs) */
 	else if (msg->hdr.op == POSTTXTALL_OP)
 	{
 		*branch = user;
-		exec_getonlineuserfd(db, &fd, no_fd);
+		*no_fd = presence_fds(&fd);
+		exec_insertbroadcast(db, sender, message);
+		return fd;
 	}
 
 	/** 
@@ -643,49 +1041,19 @@ long *manage_postmessage(message_t *msg, int sender_fd, int *no_fd, enum operati
 	 *			altrimenti va aggiunta 
 	*/
 
-	if (*branch == user)
+	if ((*branch == user) && (chat_id == CHATCACHE_MISS)) /* chat non in cache */
 	{
-		char *user_list;
-		int no_user;
-
-		if (msg->hdr.op == POSTTXTALL_OP) /* POSTTXT_ALL */
+		chat_id = exec_checkexistingchat(db, sender, receiver);
+		if (chat_id == GETLONG_ERROR) /* chat non esistente */
 		{
-			exec_getallusername(db, &user_list, &no_user);
-			if (no_user <= 1) // ci sei solo te nel database
+			chat_id = exec_createchat(db);
+			if (chat_id != -1)
 			{
-				return NULL; // ??
+				exec_insert_user_in_chat(db, sender, chat_id);
+				exec_insert_user_in_chat(db, receiver, chat_id);
 			}
 		}
-		else
-		{
-			user_list = receiver;
-			no_user = 1;
-		}
-
-		for (int i = 0; i < no_user; i++)
-		{
-			char *curr_user = user_list + (i * (MAX_NAME_LENGTH + 1));
-			/* non voglio inviarmi il messaggio da solo */
-			if (strcmp(curr_user, sender) != 0)
-			{
-				chat_id = exec_checkexistingchat(db, sender, curr_user);
-				if (chat_id == GETLONG_ERROR) /* chat non esistente */
-				{
-					chat_id = exec_createchat(db);
-					if (chat_id != -1)
-					{
-						exec_insert_user_in_chat(db, sender, chat_id);
-						exec_insert_user_in_chat(db, curr_user, chat_id);
-					}
-				}
-				/* gestisco subito nel ciclo la posttxt_all */
-				if (msg->hdr.op == POSTTXTALL_OP)
-					exec_insertmessage(db, sender, msg->data.buf, chat_id);
-			}
-		} /* CASO 3: chiuso */
-
-		if (msg->hdr.op == POSTTXTALL_OP)
-			free(user_list);
+		chatcache_put(sender, receiver, chat_id, cache_epoch);
 	}
 
 	/* inserisco il filename nel database e salvo il file nella cartella */
@@ -693,34 +1061,44 @@ long *manage_postmessage(message_t *msg, int sender_fd, int *no_fd, enum operati
 	{
 		char *filename = message;
 
-		/* il buffer contiene "filename'\0'dati del file" */
-		char *file_data = strchr(msg->data.buf, '\0');
-		file_data++;
+		/* il buffer contiene "filename'\0'percorso del file temporaneo'\0'" */
+		char *spool_path = strchr(msg->data.buf, '\0');
+		spool_path++;
 		char *filepath = get_filepath();
 
+		/* salvo il file non con il suo filename ma con la sua chiave primaria */
+		sqlite3_int64 save_as = -1;
 		if (*branch == group)
-			exec_postfile(db, sender, filename, group_id);
+			save_as = exec_postfile(db, sender, filename, group_id);
 		else if (*branch == user)
-			exec_postfile(db, sender, filename, chat_id);
+			save_as = exec_postfile(db, sender, filename, chat_id);
 
-		/* salvo il file non con il suo filename ma con la sua chiave primaria */
-		sqlite3_int64 save_as = sqlite3_last_insert_rowid(db);
+		/* inserimento fallito: il file temporaneo viene eliminato dal
+			chiamante (no_fd == -1) */
+		if (save_as == -1)
+		{
+			free(fd);
+			*no_fd = -1;
+			return NULL;
+		}
 
 		char *temp;
 		asprintf(&temp, "%s/%lld", filepath, save_as);
 
-		/* A  call  to creat() is equivalent to calling open() with flags equal to
-       O_CREAT|O_WRONLY|O_TRUNC. */
-		int file_fd = creat(temp, 0);
-		fchmod(file_fd, S_IRUSR | S_IWUSR);
-		if (file_fd == -1)
+		/* il file è già stato salvato dal reactor in ricezione (si trova 
+			nella stessa cartella): la rename lo rende visibile in modo 
+			atomico solo dopo l'inserimento della riga nel database.
+			Se fallisce la riga viene rimossa, il file non sarebbe scaricabile */
+		if (rename(spool_path, temp) != 0)
 		{
+			perror(STRING_PERROR(STRING_HANDLE_BAD_FILE_WRITING));
+			exec_delfile(db, save_as);
 			free(temp);
-			handle_error(STRING_BAD_FILE_OPEN);
+			free(fd);
+			*no_fd = -1;
+			return NULL;
 		}
 
-		int ret = write(file_fd, file_data, msg->data.hdr.len - strlen(filename) - 1);
-
 #ifdef MAKE_TEST_HAPPY /* salvo una copia del file con il nome originale */
 		char *system_command = NULL;
 		asprintf(&system_command, "cp %s %s/%s", temp, filepath, filename);
@@ -728,15 +1106,7 @@ long *manage_postmessage(message_t *msg, int sender_fd, int *no_fd, enum operati
 		free(system_command);
 #endif
 
-		if (ret <= 0)
-		{
-			free(temp);
-			close(file_fd);
-			handle_error(STRING_HANDLE_BAD_FILE_WRITING);
-		}
-
 		free(temp);
-		close(file_fd);
 	}
 	else if (msg->hdr.op == POSTTXT_OP)
 	{
@@ -749,7 +1119,7 @@ long *manage_postmessage(message_t *msg, int sender_fd, int *no_fd, enum operati
 	return fd;
 }
 
-op_t manage_getfile(message_t *msg, message_t *ans, sqlite3 *db)
+op_t manage_getfile(message_t *msg, message_t *ans, int *file_fd, sqlite3 *db)
 {
 	long id_file = GETLONG_ERROR;
 
@@ -772,22 +1142,21 @@ op_t manage_getfile(message_t *msg, message_t *ans, sqlite3 *db)
 		free(temp);
 		handle_error(STRING_HANDLE_BAD_FILE_READING);
 	}
+	free(temp);
 
-	FILE *stream = fdopen(fd, "r");
-	fseek(stream, 0L, SEEK_END); // posizione iniziale
-	ans->data.hdr.len = ftell(stream); // leggo dimensione del file per l'allocazione
-	rewind(stream);
-	fclose(stream);
-	ans->data.buf = safe_malloc(ans->data.hdr.len * sizeof(char));
-#ifdef MAKE_VALGRIND_HAPPY
-	memset(ans->data.buf, 0, ans->data.hdr.len * sizeof(char));
-#endif
-	read(fd, ans->data.buf, ans->data.hdr.len);
-	ans->hdr.op = OP_OK;
+	/* il contenuto non viene letto: sarà inviato direttamente dal descrittore */
+	struct stat info;
+	if (fstat(fd, &info) == -1)
+	{
+		close(fd);
+		return OP_FAIL;
+	}
 
-	close(fd);
+	ans->hdr.op = OP_OK;
+	ans->data.hdr.len = info.st_size;
+	ans->data.buf = NULL;
+	*file_fd = fd;
 
-	free(temp);
 	return OP_OK;
 }
 
@@ -809,56 +1178,40 @@ op_t manage_creategroup(char *group_name, char *creator, sqlite3 *db)
 		return OP_FAIL;
 
 	exec_insert_user_in_chat(db, creator, chat_id);
+	groups_create(group_name, chat_id);
+	groups_add(group_name, creator);
 	return OP_OK;
 }
 
 op_t manage_addtogroup(char *group_name, char *user, sqlite3 *db)
 {
-	long chat_id;
+	long long chat_id;
 	int query_result;
 
-	exec_checkexistinggroup(db, group_name, &chat_id);
-
-	if (chat_id == GETLONG_ERROR) /* gruppo non esistente */
+	query_result = groups_member(group_name, user, &chat_id);
+	if (query_result == GROUP_UNKNOWN) /* gruppo non esistente */
 		return OP_FAIL;
+	if (query_result == GROUP_MEMBER) /* utente già nel gruppo */
+		return OP_NICK_ALREADY;
 
 	query_result = exec_insert_user_in_chat(db, user, chat_id);
 	if (query_result == SQLITE_CONSTRAINT) /* utente già nel gruppo */
 		return OP_NICK_ALREADY;
 
+	groups_add(group_name, user);
 	return OP_OK;
 }
 
-op_t manage_removeuserfromgroup(char *group_name, char *user, int curr_fd, sqlite3 *db)
+op_t manage_removeuserfromgroup(char *group_name, char *user, sqlite3 *db)
 {
-	long chat_id;
-
-	exec_checkexistinggroup(db, group_name, &chat_id);
+	long long chat_id;
 
-	if (chat_id == GETLONG_ERROR) /* il gruppo non esiste */
-		return OP_NICK_UNKNOWN;
-
-	long *fd = NULL;
-	int no_fd, isInGroup = 0;
-
-	exec_getonlineuser_in_group(db, chat_id, &fd, &no_fd);
-	if (no_fd <= 0)
-		return OP_FAIL;
-
-	for (int i = 0; i < no_fd; i++)
-		if ((fd[i]) && (fd[i] == curr_fd)) /* l'utente è nel gruppo */
-		{
-			isInGroup = 1;
-			break;
-		}
-
-	if (fd)
-		free(fd);
-
-	if (!isInGroup) /* l'utente non è nel gruppo */
+	/* il gruppo non esiste o l'utente non è nel gruppo */
+	if (groups_member(group_name, user, &chat_id) != GROUP_MEMBER)
 		return OP_NICK_UNKNOWN;
 
 	exec_removeuser_from_group(db, chat_id, user);
+	groups_remove(group_name, user);
 
 	return OP_OK;
 }
@@ -867,11 +1220,14 @@ op_t manage_deletegroup(char *group_name, char *sender, sqlite3 *db)
 {
 	int ret = exec_delgroup(db, sender, group_name);
 	if (ret == SQLITE_OK)
+	{
+		groups_delete(group_name);
 		return OP_OK;
+	}
 	/* else */
 	return OP_FAIL;
 }
-int manage_getprevmsgs(char *sender, message_t **ans, sqlite3 *db)
+int manage_getprevmsgs(char *sender, result_set *ans, sqlite3 *db)
 {
 	int message_number = exec_getprevmsgs(db, sender, get_maxmsgs(), ans);
 	if (message_number < 0)
@@ -891,7 +1247,7 @@ void manage_getstats(sqlite3 *db, struct statistics *stats)
 	exec_gettotaluser(db, &temp);
 	if (temp > 0)
 		stats->nusers = temp;
-	exec_getnumberonlineuser(db, &temp);
+	temp = presence_count();
 	if (temp > 0)
 		stats->nonline = temp;
 
@@ -904,7 +1260,15 @@ const char *createdb()
 	return query_createdb;
 }
 
-const char *cleardb()
+int schema_version()
 {
-	return query_cleardb;
+	return SCHEMA_VERSION;
+}
+
+const char *migratedb(int version)
+{
+	if ((version < 0) || (version >= SCHEMA_VERSION))
+		return NULL;
+
+	return query_migrations[version];
 }
\ No newline at end of file
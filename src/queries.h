@@ -24,6 +24,7 @@
 #include "utils.h"
 #include "message.h"
 #include "stats.h"
+#include "presence.h"
 
 #ifndef _QUERIES_H_
 #define _QUERIES_H_
@@ -34,49 +35,70 @@
 #define QUOTE(...) #__VA_ARGS__
 
 /**
- * @brief wrapper per la restituzione di parametri di tipo vettore di stringhe 
- * 	da parte del database
+ * @brief blocco dell'area (arena) in cui vengono copiati i testi delle righe
+ * 		risultato: i blocchi non vengono mai spostati, i puntatori restano
+ * 		validi fino a result_free
  * 
  */
-struct callback_param_string
+typedef struct result_block
 {
-	char *result;
-	unsigned int curr_pos;
-	long size;
-};
+	struct result_block *next;
+	size_t used;
+	size_t size;
+	char data[];
+} result_block;
 
 /**
- * @brief wrapper per la restituzione di parametri di tipo vettore di long 
- * 	da parte del database
+ * @brief righe risultato raccolte in un solo passaggio, senza conoscerne
+ * 	prima il numero: il vettore delle righe raddoppia quando è pieno
  * 
  */
-struct callback_param_long
+typedef struct result_set
 {
-	long *result;
-	unsigned int curr_pos;
-	long size;
-};
+	char *rows;				  /**< no_rows righe di row_size byte */
+	size_t row_size;
+	unsigned int no_rows;
+	unsigned int size;	  /**< righe allocate */
+	result_block *arena;
+} result_set;
 
 /**
- * @brief wrapper per la restituzione di parametri di tipo vettore di messaggi 
- * 	da parte del database
+ * @brief puntatore alla riga "i" di "set", di tipo "type"
  * 
  */
-struct callback_param_message
-{
-	message_t *result;
-	unsigned int curr_pos;
-	long size;
-};
+#define result_row(set, type, i) (((type *)((set)->rows)) + (i))
 
 /**
- * @brief costruttore di liste di tipo generico (string, long, message)
+ * @brief inizializza un insieme vuoto (nessuna allocazione)
  * 
+ * @param set insieme risultato
+ * @param row_size dimensione di una riga
  */
-#define init_list_callback(type, name) \
-	struct callback_param_##type(name); \
-	(name).curr_pos = 0;                \
-	(name).result = NULL;
+void result_init(result_set *set, size_t row_size);
+
+/**
+ * @brief aggiunge una riga (azzerata) in fondo all'insieme
+ * 
+ * @param set insieme risultato
+ * @return void* riga aggiunta, valida fino alla successiva result_add
+ */
+void *result_add(result_set *set);
+
+/**
+ * @brief copia nell'arena di "set" la colonna di testo "col" della riga
+ * 		corrente
+ * 
+ * @param len dimensione della copia (terminatore compreso), 0 se la
+ * 			colonna è NULL
+ * @return char* copia del testo, NULL se la colonna è NULL
+ */
+char *result_text(result_set *set, sqlite3_stmt *stmt, int col, unsigned int *len);
+
+/**
+ * @brief libera le righe e l'arena di "set", che torna vuoto
+ * 
+ */
+void result_free(result_set *set);
 
 //-------------------------------------------------------------------------//
 
@@ -87,115 +109,231 @@ struct callback_param_message
 void terminate_db();
 
 /**
- * @brief esegue una generica query "query" ed è responsabile della 
- * 	sincronizzazione tra le varie operazioni simultanee
+ * @brief apre una transazione in cui vengono eseguite tutte le query
+ * 		successive del thread chiamante fino a exec_end_batch: i
+ * 		cambiamenti vengono scritti su disco una volta sola
+ * @warning il thread mantiene l'accesso esclusivo al database fino a
+ * 			exec_end_batch, tra le due chiamate non deve attendere altri
+ * 			thread
  * 
  * @param db handler del database
- * @param query la query in formato stringa
- * @param callback la funzione di callback (eseguita per ogni riga risultato)
+ * @return int 1 se la transazione è aperta, 0 se è stata richiesta la
+ * 			terminazione
+ */
+int exec_begin_batch(sqlite3 *db);
+
+/**
+ * @brief conferma la transazione aperta da exec_begin_batch (se aperta).
+ * 		Con il group commit attivo la transazione è condivisa con gli
+ * 		altri slaves: la chiamata ritorna quando il writer l'ha confermata
+ * 
+ * @param db handler del database
+ * @param no_ops operazioni eseguite nella transazione (messaggi)
+ */
+void exec_end_batch(sqlite3 *db, int no_ops);
+
+/**
+ * @brief attiva il group commit (solo in modalità WAL): le transazioni
+ * 		aperte con exec_begin_batch vengono eseguite sulla connessione
+ * 		condivisa "writer" e confermate insieme da exec_group_run
+ * @warning da chiamare prima di avviare gli slaves
+ * 
+ * @param writer connessione condivisa delle scritture
+ * @param window_ms attesa massima di una transazione prima della conferma
+ * @param max_ops operazioni oltre le quali la transazione viene confermata
+ * 			subito
+ */
+void exec_group_init(sqlite3 *writer, unsigned int window_ms, unsigned int max_ops);
+
+/**
+ * @brief indica se il group commit è attivo
+ * 
+ * @return int 1 se attivo, 0 altrimenti
+ */
+int exec_grouped();
+
+/**
+ * @brief routine del writer: conferma la transazione condivisa quando è
+ * 		aperta da "window_ms", finché non viene chiamata exec_group_stop
+ * 
+ */
+void exec_group_run();
+
+/**
+ * @brief termina exec_group_run dopo aver confermato l'ultima transazione
+ * 
+ */
+void exec_group_stop();
+
+/**
+ * @brief restituisce le transazioni confermate dal group commit e le
+ * 		operazioni che contenevano
+ * 
+ * @param commits transazioni confermate
+ * @param ops operazioni confermate
+ */
+void exec_group_stats(unsigned long *commits, unsigned long *ops);
+
+/**
+ * @brief esegue un checkpoint del WAL (sqlite3_wal_checkpoint_v2): i
+ * 		checkpoint diversi da SQLITE_CHECKPOINT_PASSIVE attendono la fine
+ * 		delle letture in corso, quindi vengono eseguiti come una scrittura
+ * 
+ * @param db handler del database
+ * @param mode SQLITE_CHECKPOINT_*
+ * @param log_pages pagine nel WAL (o NULL)
+ * @param done_pages pagine del WAL già riportate nel database (o NULL)
+ * @return int SQLITE_OK o il codice d'errore di sqlite
+ */
+int exec_wal_checkpoint(sqlite3 *db, int mode, int *log_pages, int *done_pages);
+
+/**
+ * @brief indici delle query preparate (vedi exec_prepare): le query
+ * 		composte da più istruzioni hanno un indice per istruzione
+ * 
+ */
+enum query_id
+{
+	Q_INSERTUSER,
+	Q_REMOVEUSER,
+	Q_REMOVEUSER_CHATS,
+	Q_REMOVEUSER_MESSAGES,
+	Q_REMOVEUSER_BROADCASTS,
+	Q_CHECKEXISTUSER,
+	Q_CHECKEXISTNAME,
+	Q_CREATECHAT,
+	Q_CREATEGROUP,
+	Q_INSERT_USER_IN_CHAT,
+	Q_CHECKEXISTINGCHAT,
+	Q_INSERTMESSAGE,
+	Q_INSERTBROADCAST,
+	Q_POSTFILE,
+	Q_DELFILE,
+	Q_GETFILE,
+	Q_GETTOTALUSER,
+	Q_GETGROUPOWNER,
+	Q_DELGROUP_MESSAGES,
+	Q_DELGROUP_USERS,
+	Q_DELGROUP,
+	Q_REMOVEUSER_FROM_GROUP,
+	Q_REMOVEUSER_FROM_GROUP_MESSAGES,
+	Q_LOADGROUPS,
+	Q_GETPREVMSGS,
+	Q_INCREASESTATS,
+	Q_GET_FROM_STATS,
+	QUERIES
+};
+
+/**
+ * @brief funzione eseguita per ogni riga risultato di una query preparata,
+ * 		legge le colonne con sqlite3_column_*
+ * 
+ */
+typedef int (*row_reader)(sqlite3_stmt *stmt, void *result);
+
+/**
+ * @brief restituisce la query "id" compilata per l'handler "db", pronta
+ * 		per l'assegnamento dei parametri: ogni thread compila una query
+ * 		solo al primo utilizzo e la riutilizza finché usa lo stesso handler
+ * @warning la query deve essere eseguita (exec_prepared) prima di
+ * 			richiedere di nuovo lo stesso "id"
+ * @warning dentro una transazione del group commit la query viene
+ * 			compilata per la connessione condivisa, non per "db"
+ * 
+ * @param db handler del database
+ * @param id indice della query
+ * @return sqlite3_stmt* la query (termina il server in caso di errore)
+ */
+sqlite3_stmt *exec_prepare(sqlite3 *db, enum query_id id);
+
+/**
+ * @brief esegue in ordine le query preparate "stmts" ed è responsabile
+ * 	della sincronizzazione tra le varie operazioni simultanee
+ * 
+ * @param db handler del database
+ * @param stmts query ottenute con exec_prepare, con i parametri assegnati
+ * @param no_stmts numero di query
+ * @param reader funzione eseguita per ogni riga risultato (o NULL)
  * @param result parametro risultato della query
  * @return int (SQLITE_OK) query eseguita correttamente
  * 				(SQLITE_CONSTRAINT) impossibile eseguire la query per 
  * 											contraddizione su un vincolo
  * 											(es. chiave primaria già presente)
  */
-int exec_query(sqlite3 *db, char *query, int(callback)(void *, int, char **, char **), void *result);
+int exec_prepared(sqlite3 *db, sqlite3_stmt **stmts, int no_stmts, row_reader reader, void *result);
 
 /**
- * @brief funzione di callback per risultati di tipo vettore di liste
+ * @brief libera le query compilate dal thread chiamante per "db" e quelle
+ * 		per la connessione condivisa del group commit
+ * @warning da chiamare prima di chiudere l'handler (vedi close_db)
  * 
- * @param param wrapper di tipo callback_param_list
- * @param argc numero di colonne risultanti
- * @param argv vettore riga del database
- * @param col_name vettore nome delle colonne 
- * @return int (EXIT_SUCCESS) operazione ok
- * 				(EXIT_FAILURE) errore imprevisto => terminare la query
+ * @param db handler del database
  */
-int getstringlist_callback(void *param, int argc, char **argv, char **col_name);
+void exec_finalize(sqlite3 *db);
 
-#define GETLONG_ERROR LONG_MIN
 /**
- * @brief funzione di callback per risultati di tipo  long
+ * @brief assegnamento dei parametri di una query preparata: le stringhe
+ * 		devono restare valide fino all'esecuzione
  * 
- * @param param puntatore a long
- * @param argc numero di colonne risultanti
- * @param argv vettore riga del database
- * @param col_name vettore nome delle colonne 
- * @return int (EXIT_SUCCESS) operazione ok
- * 				(EXIT_FAILURE) errore imprevisto => terminare la query
  */
-int getlong_callback(void *param, int argc, char **argv, char **col_name);
+#define bind_text(stmt, i, text) sqlite3_bind_text((stmt), (i), (text), -1, SQLITE_STATIC)
+#define bind_int(stmt, i, n) sqlite3_bind_int64((stmt), (i), (sqlite3_int64)(n))
 
 /**
- * @brief funzione di callback per risultati di tipo vettore di long
+ * @brief esecuzione di una query preparata composta da una sola istruzione
  * 
- * @param param wrapper di tipo callback_param_long
- * @param argc numero di colonne risultanti
- * @param argv vettore riga del database
- * @param col_name vettore nome delle colonne 
- * @return int (EXIT_SUCCESS) operazione ok
- * 				(EXIT_FAILURE) errore imprevisto => terminare la query
  */
-int getlonglist_callback(void *param, int argc, char **argv, char **col_name);
+#define exec_stmt(db, stmt, reader, result) exec_prepared((db), &(stmt), 1, (reader), (result))
 
 /**
- * @brief funzione di callback per risultati di tipo vettore di messaggi
+ * @brief lettura di righe risultato di tipo nome utente (o gruppo)
  * 
- * @param param wrapper di tipo callback_param_message
- * @param argc numero di colonne risultanti
- * @param argv vettore riga del database
- * @param col_name vettore nome delle colonne 
+ * @param stmt query in esecuzione, posizionata sulla riga
+ * @param param result_set con righe di MAX_NAME_LENGTH + 1 caratteri
  * @return int (EXIT_SUCCESS) operazione ok
- * 				(EXIT_FAILURE) errore imprevisto => terminare la query
  */
-int getmessagelist_callback(void *param, int argc, char **argv, char **col_name);
+int read_stringlist(sqlite3_stmt *stmt, void *param);
 
-#ifndef MAKE_TEST_HAPPY
+#define GETLONG_ERROR LONG_MIN
 /**
- * @brief funzione di callback per risultati di tipo vettore di statistiche
+ * @brief lettura di un risultato di tipo long (GETLONG_ERROR se NULL)
  * 
- * @param param vettore di long 
- * @param argc numero di colonne risultanti
- * @param argv vettore riga del database
- * @param col_name vettore nome delle colonne 
+ * @param stmt query in esecuzione, posizionata sulla riga
+ * @param param puntatore a long
  * @return int (EXIT_SUCCESS) operazione ok
- * 				(EXIT_FAILURE) errore imprevisto => terminare la query
  */
-int getstats_callback(void *param, int argc, char **argv, char **col_name);
-#endif
-//-------------------------------------------------------------------------//
+int read_long(sqlite3_stmt *stmt, void *param);
 
 /**
- * @brief costruisce la query in formato stringa da eseguire sul database
+ * @brief lettura di righe (chat_id, nome del gruppo, iscritto) aggiunte
+ * 		all'indice dei gruppi (groups.h)
  * 
- * @warning asprintf alloca la stringa p con la dimensione necessaria
+ * @param stmt query in esecuzione, posizionata sulla riga
+ * @param param non utilizzato
+ * @return int (EXIT_SUCCESS) operazione ok
  */
-
-#define fill_query(p, ...)                     \
-	do                                          \
-	{                                           \
-		if (asprintf(&(p), ##__VA_ARGS__) == -1) \
-		{                                        \
-			fprintf(stderr, STRING_BAD_MALLOC);   \
-			exit(EXIT_FAILURE);                   \
-		}                                        \
-	} while (0);
+int read_group(sqlite3_stmt *stmt, void *param);
 
 /**
- * @brief costruttore generico per una query "query_name"
- * 	prende come parametro i parametri della query ORDINATI
- * @note la query è inizializzata alla variabile "q"
+ * @brief lettura di righe risultato di tipo messaggio, i testi vengono
+ * 		copiati nell'arena
+ * 
+ * @param stmt query in esecuzione, posizionata sulla riga
+ * @param param result_set con righe di tipo message_t
+ * @return int (EXIT_SUCCESS) operazione ok
  */
-#define init_param(query_name, ...) \
-	char *q;                         \
-	fill_##query_name(q, __VA_ARGS__);
+int read_messagelist(sqlite3_stmt *stmt, void *param);
 
+#ifndef MAKE_TEST_HAPPY
 /**
- * @brief distruttore generico, da richiamare DOPO l'esecuzione della query
+ * @brief lettura di un risultato di tipo vettore di statistiche
  * 
+ * @param stmt query in esecuzione, posizionata sulla riga
+ * @param param vettore di unsigned long (uno per colonna)
+ * @return int (EXIT_SUCCESS) operazione ok
  */
-#define destroy_param \
-	free(q);
+int read_stats(sqlite3_stmt *stmt, void *param);
+#endif
 //-------------------------------------------------------------------------//
 
 /**
@@ -216,46 +354,52 @@ int getstats_callback(void *param, int argc, char **argv, char **col_name);
  * @warning le query sono in ordine "abbastanza" sparso, molte sono scritte
  * 			in un ordine basato sulla necessità di programmazione
  * 
+ * @note i parametri sono assegnati alla query preparata (?N) e mai inseriti
+ * 		nel testo: un apice in un nome o in un messaggio non altera la query
+ * 
  */
 //-------------------------------------------------------------------------//
 
-#define query_insertuser \
-	"INSERT INTO _User "  \
-	"VALUES('%s', '%d');"
-
-#define fill_insertuser(p, user, fd) \
-	fill_query(p, query_insertuser, user, fd)
+/* curr_fd non è più aggiornato: chi è online lo sa il registro (presence.h).
+	broadcast_from esclude i messaggi a tutti inviati prima della registrazione */
+#define query_insertuser                                 \
+	"INSERT INTO _User (username, curr_fd, broadcast_from) " \
+	"SELECT ?1, -1, IFNULL(MAX(broadcast_id), 0) "         \
+	"FROM _Broadcast;"
 
 /**
- * @brief inserisce l'utente "user" attualmente attivo sul file descriptor
- * 		"fd" nel database
+ * @brief inserisce l'utente "user" nel database
  * 
  * @param db handler del database
  * @param user utente da inserire
- * @param fd file descriptor sul qual è attualmente attivo
  * @return int (SQLITE_OK) utente correttamente inserito
  * 				(SQLITE_CONSTRAINT) username già presente nel database
  */
-static inline int exec_insertuser(sqlite3 *db, char *user, int fd)
+static inline int exec_insertuser(sqlite3 *db, char *user)
 {
-	init_param(insertuser, user, fd);
-	int val = exec_query(db, q, NULL, NULL);
-	destroy_param;
-	return val;
+	sqlite3_stmt *s = exec_prepare(db, Q_INSERTUSER);
+	bind_text(s, 1, user);
+	return exec_stmt(db, s, NULL, NULL);
 }
 //-------------------------------------------------------------------------//
 
-#define query_removeuser            \
-	"DELETE FROM _User "             \
-	"WHERE username = '%s'; "        \
-	"DELETE FROM _Chat_User "        \
-	"WHERE username = '%s'; "        \
+#define query_removeuser \
+	"DELETE FROM _User "  \
+	"WHERE username = ?1;"
+
+#define query_removeuser_chats \
+	"DELETE FROM _Chat_User "   \
+	"WHERE username = ?1;"
+
+#define query_removeuser_messages    \
 	"UPDATE _Message "               \
 	"SET sent_by = '#deleted_user' " \
-	"WHERE sent_by = '%s';"
+	"WHERE sent_by = ?1;"
 
-#define fill_removeuser(p, user) \
-	fill_query(p, query_removeuser, user, user, user)
+#define query_removeuser_broadcasts  \
+	"UPDATE _Broadcast "             \
+	"SET sent_by = '#deleted_user' " \
+	"WHERE sent_by = ?1;"
 
 /**
  * @brief rimuove l'utente "user" e tutte le sue chat dal database 			
@@ -271,10 +415,13 @@ static inline int exec_insertuser(sqlite3 *db, char *user, int fd)
  */
 static inline int exec_removeuser(sqlite3 *db, char *user)
 {
-	init_param(removeuser, user);
-	int val = exec_query(db, q, NULL, NULL);
-	destroy_param;
-	return val;
+	sqlite3_stmt *s[4] = {exec_prepare(db, Q_REMOVEUSER),
+								 exec_prepare(db, Q_REMOVEUSER_CHATS),
+								 exec_prepare(db, Q_REMOVEUSER_MESSAGES),
+								 exec_prepare(db, Q_REMOVEUSER_BROADCASTS)};
+	for (int i = 0; i < 4; i++)
+		bind_text(s[i], 1, user);
+	return exec_prepared(db, s, 4, NULL, NULL);
 }
 
 //-------------------------------------------------------------------------//
@@ -282,10 +429,7 @@ static inline int exec_removeuser(sqlite3 *db, char *user)
 #define query_checkexistuser \
 	"SELECT COUNT(username) " \
 	"FROM _User "             \
-	"WHERE _User.username = '%s';"
-
-#define fill_checkexistuser(p, user) \
-	fill_query(p, query_checkexistuser, user)
+	"WHERE _User.username = ?1;"
 
 /**
  * @brief controlla la presenza dell'utente "user" come registrato nel database
@@ -296,21 +440,18 @@ static inline int exec_removeuser(sqlite3 *db, char *user)
  */
 static inline void exec_checkexistuser(sqlite3 *db, char *user, long *result)
 {
-	init_param(checkexistuser, user);
-	exec_query(db, q, getlong_callback, result);
-	destroy_param;
+	sqlite3_stmt *s = exec_prepare(db, Q_CHECKEXISTUSER);
+	bind_text(s, 1, user);
+	exec_stmt(db, s, read_long, result);
 }
 
 //-------------------------------------------------------------------------//
 
-#define query_checkexistname      \
-	"SELECT COUNT(*) "             \
-	"FROM _User, _Chat "           \
-	"WHERE _User.username = '%s' " \
-	"OR _Chat.chat_name = '%s';"
-
-#define fill_checkexistname(p, user) \
-	fill_query(p, query_checkexistname, name, name)
+#define query_checkexistname     \
+	"SELECT COUNT(*) "            \
+	"FROM _User, _Chat "          \
+	"WHERE _User.username = ?1 "  \
+	"OR _Chat.chat_name = ?1;"
 
 /**
  * @brief controlla che la stringa "name" non sia già registrata come utente
@@ -324,119 +465,9 @@ static inline void exec_checkexistuser(sqlite3 *db, char *user, long *result)
  */
 static inline void exec_checkexistname(sqlite3 *db, char *name, long *result)
 {
-	init_param(checkexistname, name);
-	exec_query(db, q, getlong_callback, result);
-	destroy_param;
-}
-
-//-------------------------------------------------------------------------//
-
-#define query_getuserfd \
-	"SELECT curr_fd "    \
-	"FROM _User "        \
-	"WHERE username = '%s';"
-
-#define fill_getuserfd(p, user) \
-	fill_query(p, query_getuserfd, user);
-
-/**
- * @brief restituisce l'attuale file descriptor sul quale è collegato "user"
- * 
- * @param db handler db
- * @param user nome utente
- * @param result ([fd]) se l'utente è connesso 
- * 					(VOID_FD) se non è connesso
- * 					(GETLONG_ERROR) se l'utente non esiste  
- * @return int (SQLITE_OK) | (SQLITE_CONSTRAINT)
- */
-static inline int exec_getuserfd(sqlite3 *db, char *user, long *result)
-{
-	init_param(getuserfd, user);
-	int val = exec_query(db, q, getlong_callback, result);
-	destroy_param;
-	return val;
-}
-
-//-------------------------------------------------------------------------//
-
-#define query_checkexistinggroup \
-	"SELECT chat_id "             \
-	"FROM _Chat "                 \
-	"WHERE chat_name = '%s'; "
-
-#define fill_checkexistinggroup(p, group_name) \
-	fill_query(p, query_checkexistinggroup, group_name)
-
-/**
- * @brief restituisce l'id (PK) della chat del gruppo di nome "group_name"
- * 
- * @param db handler db
- * @param group_name nome del gruppo
- * @param result (chat_id) se op ok, (GETLONG_ERROR) se il gruppo non esiste
- * @return int (SQLITE_OK) | (SQLITE_CONSTRAINT)
- */
-static inline int exec_checkexistinggroup(sqlite3 *db, char *group_name, long *result)
-{
-	*result = GETLONG_ERROR;
-	init_param(checkexistinggroup, group_name);
-	int val = exec_query(db, q, getlong_callback, result);
-	destroy_param;
-	return val;
-}
-
-//-------------------------------------------------------------------------//
-
-#define query_connectuser \
-	"UPDATE _User "        \
-	"SET curr_fd = %d "    \
-	"WHERE username = '%s' AND curr_fd = -1;"
-
-#define fill_connectuser(p, user, fd) \
-	fill_query(p, query_connectuser, fd, user)
-
-/**
- * @brief esegue la connessione dell'utente disconnesso "user" sul suo 
- * 		file descriptor corrente
- * @warning è garantito che un utente già connesso non possa essere 
- * 			connesso una seconda volta finché non si disconnette
- * 
- * @param db handler db
- * @param user username
- * @param fd file descriptor
- * @return int (SQLITE_OK) | (SQLITE_CONSTRAINT)
- */
-static inline int exec_connectuser(sqlite3 *db, char *user, int fd)
-{
-	init_param(connectuser, user, fd);
-	int val = exec_query(db, q, NULL, NULL);
-	destroy_param;
-	return val;
-}
-
-//-------------------------------------------------------------------------//
-
-#define query_disconnectuser \
-	"UPDATE _User "           \
-	"SET curr_fd = -1 "       \
-	"WHERE curr_fd = %d;"
-
-#define fill_disconnectuser(p, fd) \
-	fill_query(p, query_disconnectuser, fd)
-
-/**
- * @brief imposta l'utente attualmente connesso sul file descriptor "fd"
- * 		come non connesso
- * @warning non è necessario conoscere il nome utente associato in quanto
- * 			è vincolante la relazione 1:1 tra username e fd
- * 
- * @param db handler db
- * @param fd file descriptor
- */
-static inline void exec_disconnectuser(sqlite3 *db, int fd)
-{
-	init_param(disconnectuser, fd);
-	exec_query(db, q, NULL, NULL);
-	destroy_param;
+	sqlite3_stmt *s = exec_prepare(db, Q_CHECKEXISTNAME);
+	bind_text(s, 1, name);
+	exec_stmt(db, s, read_long, result);
 }
 
 //-------------------------------------------------------------------------//
@@ -455,18 +486,16 @@ static inline void exec_disconnectuser(sqlite3 *db, int fd)
  */
 static inline sqlite3_int64 exec_createchat(sqlite3 *db)
 {
-	int ret = exec_query(db, query_createchat, NULL, NULL);
-	return (ret != SQLITE_OK) ? -1 : sqlite3_last_insert_rowid(db);
+	sqlite3_stmt *s = exec_prepare(db, Q_CREATECHAT);
+	int ret = exec_stmt(db, s, NULL, NULL);
+	return (ret != SQLITE_OK) ? -1 : sqlite3_last_insert_rowid(sqlite3_db_handle(s));
 }
 
 //-------------------------------------------------------------------------//
 
 #define query_creategroup                    \
 	"INSERT INTO _Chat (chat_name, creator) " \
-	"VALUES('%s', '%s');"
-
-#define fill_creategroup(p, group_name, creator) \
-	fill_query(p, query_creategroup, group_name, creator)
+	"VALUES(?1, ?2);"
 
 /**
  * @brief crea un gruppo di nome "group_name" e imposta "creator" come creatore
@@ -479,20 +508,18 @@ static inline sqlite3_int64 exec_createchat(sqlite3 *db)
  */
 static inline sqlite3_int64 exec_creategroup(sqlite3 *db, char *group_name, char *creator)
 {
-	init_param(creategroup, group_name, creator);
-	int ret = exec_query(db, q, NULL, NULL);
-	destroy_param;
-	return (ret != SQLITE_OK) ? -1 : sqlite3_last_insert_rowid(db);
+	sqlite3_stmt *s = exec_prepare(db, Q_CREATEGROUP);
+	bind_text(s, 1, group_name);
+	bind_text(s, 2, creator);
+	int ret = exec_stmt(db, s, NULL, NULL);
+	return (ret != SQLITE_OK) ? -1 : sqlite3_last_insert_rowid(sqlite3_db_handle(s));
 }
 
 //-------------------------------------------------------------------------//
 
 #define query_insert_user_in_chat \
 	"INSERT INTO _Chat_User "      \
-	"VALUES(%lld, '%s');"
-
-#define fill_insert_user_in_chat(p, user, key) \
-	fill_query(p, query_insert_user_in_chat, key, user);
+	"VALUES(?1, ?2);"
 
 /**
  * @brief inserisce l'utente "user" nella chat con PK "chat_id"
@@ -505,10 +532,10 @@ static inline sqlite3_int64 exec_creategroup(sqlite3 *db, char *group_name, char
  */
 static inline int exec_insert_user_in_chat(sqlite3 *db, char *user, sqlite3_int64 chat_id)
 {
-	init_param(insert_user_in_chat, user, chat_id);
-	int val = exec_query(db, q, NULL, NULL);
-	destroy_param;
-	return val;
+	sqlite3_stmt *s = exec_prepare(db, Q_INSERT_USER_IN_CHAT);
+	bind_int(s, 1, chat_id);
+	bind_text(s, 2, user);
+	return exec_stmt(db, s, NULL, NULL);
 }
 
 //-------------------------------------------------------------------------//
@@ -518,17 +545,18 @@ static inline int exec_insert_user_in_chat(sqlite3 *db, char *user, sqlite3_int6
 	"FROM "                           \
 	"(SELECT chat_id "                \
 	"FROM _Chat_User "                \
-	"WHERE username = '%s') AS T1, "  \
+	"WHERE username = ?1) AS T1, "    \
 	"(SELECT chat_id "                \
 	"FROM _Chat_User "                \
-	"WHERE username = '%s') AS T2, "  \
+	"WHERE username = ?2) AS T2, "    \
 	"_Chat "                          \
 	"WHERE T1.chat_id = T2.chat_id "  \
 	"AND T1.chat_id = _Chat.chat_id " \
-	"AND _Chat.chat_name IS NULL;" /* garantisce che non sia un gruppo */
+	"AND +_Chat.chat_name IS NULL;" /* garantisce che non sia un gruppo */
 
-#define fill_checkexistingchat(p, user1, user2) \
-	fill_query(p, query_checkexistingchat, user1, user2)
+/* il + esclude l'indice UNIQUE di chat_name, che vale NULL per quasi tutte
+	le chat: senza il planner scandirebbe tutte le chat utente invece di
+	partire dalle chat di ?1 (_Chat_User_username) */
 
 /**
  * @brief controlla che sia già presente la chat tra "user1" e "user2"
@@ -543,9 +571,10 @@ static inline int exec_insert_user_in_chat(sqlite3 *db, char *user, sqlite3_int6
 static inline sqlite3_int64 exec_checkexistingchat(sqlite3 *db, char *user1, char *user2)
 {
 	long result = GETLONG_ERROR;
-	init_param(checkexistingchat, user1, user2);
-	exec_query(db, q, getlong_callback, &result);
-	destroy_param;
+	sqlite3_stmt *s = exec_prepare(db, Q_CHECKEXISTINGCHAT);
+	bind_text(s, 1, user1);
+	bind_text(s, 2, user2);
+	exec_stmt(db, s, read_long, &result);
 	return (sqlite3_int64)result;
 }
 
@@ -554,10 +583,7 @@ static inline sqlite3_int64 exec_checkexistingchat(sqlite3 *db, char *user1, cha
 #define query_insertmessage                  \
 	"INSERT INTO _Message "                   \
 	"(message, sent_by, chat_id, sent_time) " \
-	"VALUES('%s', '%s', '%lld', datetime('now'));"
-
-#define fill_insertmessage(p, sender, message, id) \
-	fill_query(p, query_insertmessage, message, sender, id)
+	"VALUES(?1, ?2, ?3, datetime('now'));"
 
 /**
  * @brief inserisce il messaggio "message" inviato da "sender" nella chat con id
@@ -571,19 +597,41 @@ static inline sqlite3_int64 exec_checkexistingchat(sqlite3 *db, char *user1, cha
  */
 static inline void exec_insertmessage(sqlite3 *db, char *sender, char *message, sqlite3_int64 chat_id)
 {
-	init_param(insertmessage, sender, message, chat_id);
-	exec_query(db, q, NULL, NULL);
-	destroy_param;
+	sqlite3_stmt *s = exec_prepare(db, Q_INSERTMESSAGE);
+	bind_text(s, 1, message);
+	bind_text(s, 2, sender);
+	bind_int(s, 3, chat_id);
+	exec_stmt(db, s, NULL, NULL);
+}
+//-------------------------------------------------------------------------//
+
+#define query_insertbroadcast                  \
+	"INSERT INTO _Broadcast "                   \
+	"(message, sent_by, sent_time) "            \
+	"VALUES(?1, ?2, datetime('now'));"
+
+/**
+ * @brief salva una sola volta il messaggio "message" inviato da "sender" a
+ * 		tutti gli utenti: lo riceveranno nella cronologia gli utenti
+ * 		registrati in questo momento (exec_getprevmsgs)
+ * 
+ * @param db handler db
+ * @param sender mittente
+ * @param message messaggio
+ */
+static inline void exec_insertbroadcast(sqlite3 *db, char *sender, char *message)
+{
+	sqlite3_stmt *s = exec_prepare(db, Q_INSERTBROADCAST);
+	bind_text(s, 1, message);
+	bind_text(s, 2, sender);
+	exec_stmt(db, s, NULL, NULL);
 }
 //-------------------------------------------------------------------------//
 
 #define query_postfile                        \
 	"INSERT INTO _Message "                    \
 	"(filename, sent_by, chat_id, sent_time) " \
-	"VALUES('%s', '%s', '%lld', datetime('now'));"
-
-#define fill_postfile(p, sender, filename, chat_id) \
-	fill_query(p, query_postfile, filename, sender, chat_id)
+	"VALUES(?1, ?2, ?3, datetime('now'));"
 
 /**
  * @brief inserisce il file "filename" inviato da "sender" nella chat
@@ -596,12 +644,35 @@ static inline void exec_insertmessage(sqlite3 *db, char *sender, char *message,
  * @param sender mittente
  * @param filename nome del file
  * @param chat_id id della chat (utente o gruppo)
+ * @return sqlite3_int64 (-1) se non è stato possibile inserire il file
+ * 							(chiave primaria del messaggio) altrimenti
+ */
+static inline sqlite3_int64 exec_postfile(sqlite3 *db, char *sender, char *filename, sqlite3_int64 chat_id)
+{
+	sqlite3_stmt *s = exec_prepare(db, Q_POSTFILE);
+	bind_text(s, 1, filename);
+	bind_text(s, 2, sender);
+	bind_int(s, 3, chat_id);
+	int ret = exec_stmt(db, s, NULL, NULL);
+	return (ret != SQLITE_OK) ? -1 : sqlite3_last_insert_rowid(sqlite3_db_handle(s));
+}
+//-------------------------------------------------------------------------//
+
+#define query_delfile \
+	"DELETE FROM _Message WHERE message_id = ?1;"
+
+/**
+ * @brief elimina il file inserito con exec_postfile (il file non è stato
+ * 		salvato in DirName)
+ * 
+ * @param db handler db
+ * @param file_id chiave primaria restituita da exec_postfile
  */
-static inline void exec_postfile(sqlite3 *db, char *sender, char *filename, sqlite3_int64 chat_id)
+static inline void exec_delfile(sqlite3 *db, sqlite3_int64 file_id)
 {
-	init_param(postfile, sender, filename, chat_id);
-	exec_query(db, q, NULL, NULL);
-	destroy_param;
+	sqlite3_stmt *s = exec_prepare(db, Q_DELFILE);
+	bind_int(s, 1, file_id);
+	exec_stmt(db, s, NULL, NULL);
 }
 //-------------------------------------------------------------------------//
 
@@ -609,15 +680,12 @@ static inline void exec_postfile(sqlite3 *db, char *sender, char *filename, sqli
 #define query_getfile                           \
 	"SELECT message_id "                         \
 	"FROM _Message, _Chat_User "                 \
-	"WHERE _Chat_User.username = '%s' "          \
-	"AND filename = '%s' "                       \
+	"WHERE _Chat_User.username = ?1 "            \
+	"AND filename = ?2 "                         \
 	"AND _Message.chat_id = _Chat_User.chat_id " \
 	"ORDER BY sent_time DESC "                   \
 	"LIMIT 1;" /* mi inviano più file sulla stessa chat con lo stesso nome => scarico solo l'ultimo */
 
-#define fill_getfile(p, username, filename) \
-	fill_query(p, query_getfile, username, filename)
-
 /**
  * @brief restituisce la chiave primaria alla quale è associato il file 
  * 		"filename" inviato all'utente "username" (chat utente o gruppo)
@@ -629,98 +697,11 @@ static inline void exec_postfile(sqlite3 *db, char *sender, char *filename, sqli
  */
 static inline void exec_getfile(sqlite3 *db, char *username, char *filename, long *result)
 {
-	init_param(getfile, username, filename);
-	exec_query(db, q, getlong_callback, result);
-	destroy_param;
-}
-//-------------------------------------------------------------------------//
-
-#define query_getnumberonlineuser \
-	"SELECT COUNT(username) "      \
-	"FROM _User "                  \
-	"WHERE curr_fd >= 0; "
-
-/**
- * @brief fornisce il numero di utenti attualmente online
- * 
- * @param db handler db
- * @param result numero di utenti online
- */
-static inline void exec_getnumberonlineuser(sqlite3 *db, long *result)
-{
-	exec_query(db, query_getnumberonlineuser, getlong_callback, result);
-}
-
-//-------------------------------------------------------------------------//
-
-#define query_get_online_user \
-	"SELECT username "         \
-	"FROM _User "              \
-	"WHERE curr_fd >= 0 ORDER BY username ASC;"
-
-/**
- * @brief restituisce la lista degli utenti attualmente online
- * 		ordinata in ordine alfabetico
- * 
- * @param db handler del db
- * @param buf_dim posizioni buffer risultato
- * @return char* lista di utenti online | NULL in caso di errore 
- */
-static inline char *exec_get_online_user(sqlite3 *db, int *buf_dim)
-{
-	init_list_callback(string, result_query);
-
-	exec_getnumberonlineuser(db, &(result_query.size));
-	if ((result_query.size == GETLONG_ERROR) || (result_query.size > INT_MAX))
-	{
-		*buf_dim = 0;
-		return NULL;
-	}
-
-	*buf_dim = result_query.size * (MAX_NAME_LENGTH + 1);
-	result_query.result = safe_malloc(*buf_dim * sizeof(char));
-	memset(result_query.result, 0, *buf_dim * sizeof(char));
-
-	exec_query(db, query_get_online_user, getstringlist_callback, &result_query);
-	return result_query.result;
-}
-//-------------------------------------------------------------------------//
-
-#define query_getonlineuserfd \
-	"SELECT curr_fd "          \
-	"FROM _User "              \
-	"WHERE curr_fd >= 0; "
-
-/**
- * @brief restituisce la lista dei descrittori associati a tutti gli 
- * 			utenti attualmente online dentro "result" e il numero di utenti
- * 			attualmente online in "no"
- * 
- * @param db handler db
- * @param result vettore di long risultante
- * @param no numero di utenti online
- */
-static inline void exec_getonlineuserfd(sqlite3 *db, long **result, int *no)
-{
-	init_list_callback(long, par);
-
-	/* numero di utenti attualmente online in modo da allocare il vettore
-		con la corretta dimensione */
-	exec_getnumberonlineuser(db, &(par.size));
-	if (par.size <= 0)
-	{
-		result = NULL;
-		*no = 0;
-		return;
-	}
-	*no = par.size;
-	par.result = safe_malloc((par.size) * sizeof(long));
-	memset(par.result, 0, (par.size) * sizeof(long));
-	*result = par.result;
-
-	exec_query(db, query_getonlineuserfd, getlonglist_callback, &par);
+	sqlite3_stmt *s = exec_prepare(db, Q_GETFILE);
+	bind_text(s, 1, username);
+	bind_text(s, 2, filename);
+	exec_stmt(db, s, read_long, result);
 }
-
 //-------------------------------------------------------------------------//
 
 #define query_gettotaluser   \
@@ -735,81 +716,30 @@ static inline void exec_getonlineuserfd(sqlite3 *db, long **result, int *no)
  */
 static inline void exec_gettotaluser(sqlite3 *db, long *no_user)
 {
-	exec_query(db, query_gettotaluser, getlong_callback, no_user);
+	sqlite3_stmt *s = exec_prepare(db, Q_GETTOTALUSER);
+	exec_stmt(db, s, read_long, no_user);
 }
 
 //-------------------------------------------------------------------------//
 
-#define query_getallusername \
-	"SELECT username "        \
-	"FROM _User;"
-
-/**
- * @brief restituisce la lista di tutti gli utenti registrati alla chat
- * 
- * @param db handler db
- * @param user_list vettore di stringhe risultante
- * @param no_user numero di utenti registrati
- */
-static inline void exec_getallusername(sqlite3 *db, char **user_list, int *no_user)
-{
-	init_list_callback(string, par);
-	exec_gettotaluser(db, (long *)no_user);
-	if (*no_user < 1)
-	{
-		user_list = NULL;
-		return;
-	}
-	par.size = *no_user;
-	par.result = safe_malloc((*no_user * (MAX_NAME_LENGTH + 1)) * sizeof(char));
-	*user_list = par.result;
-
-	exec_query(db, query_getallusername, getstringlist_callback, &par);
-}
-//-------------------------------------------------------------------------//
-
-#define query_getnumberonlineusergroup           \
-	"SELECT COUNT(_User.username) "               \
-	"FROM _User, _Chat_User "                     \
-	"WHERE _User.username = _Chat_User.username " \
-	"AND _Chat_User.chat_id = '%ld' "             \
-	"AND _User.curr_fd >= 0;"
-
-#define fill_getnumberonlineusergroup(p, chat_id) \
-	fill_query(p, query_getnumberonlineusergroup, chat_id)
-
-/**
- * @brief restituisce in "result" il numero di utenti attualmente online nel gruppo 
- * 		con id "group_id"
- * 
- * @param db handler db
- * @param group_id id del gruppo
- * @param result (numero di utenti) | (GETLONG_ERROR) se il gruppo non esiste
- */
-static inline void exec_getnumberonlineusergroup(sqlite3 *db, long group_id, long *result)
-{
-	init_param(getnumberonlineusergroup, group_id);
-	exec_query(db, q, getlong_callback, result);
-	destroy_param;
-}
 //-------------------------------------------------------------------------//
 
-#define query_delgroup                        \
-	"DELETE FROM _Message, _Chat, _Chat_User " \
-	"WHERE _Message.chat_id = _Chat.chat_id "  \
-	"AND _Chat.chat_id = _Chat_User. chat_id " \
-	"AND chat_name = '%s';"
-
 #define query_getgroupowner \
 	"SELECT creator "        \
 	"FROM _Chat "            \
-	"WHERE chat_name = '%s';"
+	"WHERE chat_name = ?1;"
+
+#define query_delgroup_messages                                    \
+	"DELETE FROM _Message "                                         \
+	"WHERE chat_id IN (SELECT chat_id FROM _Chat WHERE chat_name = ?1);"
 
-#define fill_delgroup(q, chat_name) \
-	fill_query(q, query_delgroup, chat_name)
+#define query_delgroup_users                                       \
+	"DELETE FROM _Chat_User "                                       \
+	"WHERE chat_id IN (SELECT chat_id FROM _Chat WHERE chat_name = ?1);"
 
-#define fill_getgroupowner(q, chat_name) \
-	fill_query(q, query_getgroupowner, chat_name)
+#define query_delgroup \
+	"DELETE FROM _Chat " \
+	"WHERE chat_name = ?1;"
 
 /**
  * @brief esegue l'eliminazione del gruppo "group_name" richiesto da
@@ -824,42 +754,40 @@ static inline void exec_getnumberonlineusergroup(sqlite3 *db, long group_id, lon
  */
 static inline int exec_delgroup(sqlite3 *db, char *owner, char *group_name)
 {
-	init_param(getgroupowner, group_name);
-	init_list_callback(string, par);
-	par.size = 1;
-	par.result = safe_malloc((MAX_NAME_LENGTH + 1) * sizeof(char));
+	result_set creator;
+	result_init(&creator, MAX_NAME_LENGTH + 1);
 
 	/* richiedo il proprietario del gruppo */
-	exec_query(db, q, getstringlist_callback, &par);
-	destroy_param;
-
-	if (par.result == NULL)
+	sqlite3_stmt *s = exec_prepare(db, Q_GETGROUPOWNER);
+	bind_text(s, 1, group_name);
+	exec_stmt(db, s, read_stringlist, &creator);
+
+	/* il gruppo non esiste o l'utente non è owner del gruppo */
+	int is_owner = (creator.no_rows > 0) && (strcmp(result_row(&creator, char, 0), owner) == 0);
+	result_free(&creator);
+	if (!is_owner)
 		return SQLITE_FAIL;
 
-	if (strcmp(par.result, owner) == 0) /* l'utente è owner del gruppo */
-	{
-		init_param(delgroup, group_name);
-		exec_query(db, q, NULL, NULL);
-		destroy_param;
-		return SQLITE_OK;
-	}
-
-	free(par.result);
-	return SQLITE_FAIL;
+	sqlite3_stmt *del[3] = {exec_prepare(db, Q_DELGROUP_MESSAGES),
+									exec_prepare(db, Q_DELGROUP_USERS),
+									exec_prepare(db, Q_DELGROUP)};
+	for (int i = 0; i < 3; i++)
+		bind_text(del[i], 1, group_name);
+	exec_prepared(db, del, 3, NULL, NULL);
+	return SQLITE_OK;
 }
 //-------------------------------------------------------------------------//
 
-#define query_removeuser_from_group          \
-	"DELETE FROM _Chat_User "                 \
-	"WHERE chat_id = '%ld' "                  \
-	"AND username = '%s'; "                   \
+#define query_removeuser_from_group \
+	"DELETE FROM _Chat_User "        \
+	"WHERE chat_id = ?1 "            \
+	"AND username = ?2;"
+
+#define query_removeuser_from_group_messages \
 	"UPDATE _Message "                        \
 	"SET sent_by = '#user_no_more_in_group' " \
-	"WHERE chat_id = '%ld' "                  \
-	"AND sent_by = '%s';"
-
-#define fill_removeuser_from_group(q, chat_id, username) \
-	fill_query(q, query_removeuser_from_group, chat_id, username, chat_id, username)
+	"WHERE chat_id = ?1 "                     \
+	"AND sent_by = ?2;"
 
 /**
  * @brief rimuove l'utente "username" dal gruppo con id "chat_id"
@@ -875,68 +803,60 @@ static inline int exec_delgroup(sqlite3 *db, char *owner, char *group_name)
  */
 static inline void exec_removeuser_from_group(sqlite3 *db, long chat_id, char *username)
 {
-	init_param(removeuser_from_group, chat_id, username);
-	exec_query(db, q, NULL, NULL);
-	destroy_param;
+	sqlite3_stmt *s[2] = {exec_prepare(db, Q_REMOVEUSER_FROM_GROUP),
+								 exec_prepare(db, Q_REMOVEUSER_FROM_GROUP_MESSAGES)};
+	for (int i = 0; i < 2; i++)
+	{
+		bind_int(s[i], 1, chat_id);
+		bind_text(s[i], 2, username);
+	}
+	exec_prepared(db, s, 2, NULL, NULL);
 }
 //-------------------------------------------------------------------------//
 
-#define query_getonlineuser_in_group             \
-	"SELECT _User.curr_fd "                       \
-	"FROM _User, _Chat_User "                     \
-	"WHERE _User.username = _Chat_User.username " \
-	"AND _Chat_User.chat_id = '%ld' "             \
-	"AND _User.curr_fd >= 0;"
-
-#define fill_getonlineuser_in_group(p, chat_id) \
-	fill_query(p, query_getonlineuser_in_group, chat_id)
+#define query_loadgroups                                           \
+	"SELECT _Chat.chat_id, chat_name, username "                    \
+	"FROM _Chat LEFT JOIN _Chat_User "                              \
+	"ON _Chat_User.chat_id = _Chat.chat_id "                        \
+	"WHERE chat_name IS NOT NULL;"
 
 /**
- * @brief restituisce in "result" i descrittori associati a tutti gli utenti attualmente
- * 		online nel gruppo con id "group_id"
+ * @brief carica dal database l'indice dei gruppi (groups.h) con i loro
+ * 		iscritti
+ * @warning da eseguire all'avvio, dopo presence_init e groups_init
  * 
  * @param db handler db
- * @param group_id id del gruppo
- * @param result descrittori di tutti gli utenti online
- * @param no numero di utenti online
  * @return int (SQLITE_OK) | (SQLITE_CONSTRAINT)
  */
-static inline int exec_getonlineuser_in_group(sqlite3 *db, long group_id, long **result, int *no)
+static inline int exec_loadgroups(sqlite3 *db)
 {
-	init_list_callback(long, par);
-
-	/* prendo il numero di utenti online in modo da inizializzare
-		correttamente la struttura */
-	exec_getnumberonlineusergroup(db, group_id, &(par.size));
-	if (par.size <= 0)
-	{
-		result = NULL;
-		*no = 0;
-		return 0;
-	}
-	par.result = safe_malloc(par.size * sizeof(long));
-	*result = par.result;
-	*no = par.size;
-
-	init_param(getonlineuser_in_group, group_id);
-	int ret = exec_query(db, q, getlonglist_callback, &par);
-	destroy_param;
-	return ret;
+	sqlite3_stmt *s = exec_prepare(db, Q_LOADGROUPS);
+	return exec_stmt(db, s, read_group, NULL);
 }
 
 //-------------------------------------------------------------------------//
 
-#define query_getprevmsgs                         \
-	"SELECT message, filename, sent_by "           \
-	"FROM _Message, _Chat_User "                   \
-	"WHERE _Message.chat_id = _Chat_User.chat_id " \
-	"AND username = '%s' "                         \
-	"AND sent_by <> '%s' "                         \
-	"ORDER BY sent_time DESC "                     \
-	"LIMIT %d; "
-
-#define fill_getprevmsgs(p, user, max_msgs) \
-	fill_query(p, query_getprevmsgs, user, user, max_msgs)
+#define query_getprevmsgs                                           \
+	"SELECT message, filename, sent_by FROM ("                       \
+	"SELECT * FROM (SELECT message, filename, sent_by, sent_time "   \
+	"FROM _Message, _Chat_User "                                     \
+	"WHERE _Message.chat_id = _Chat_User.chat_id "                   \
+	"AND username = ?1 "                                             \
+	"AND sent_by <> ?1 "                                             \
+	"ORDER BY sent_time DESC LIMIT ?2) "                             \
+	"UNION ALL "                                                     \
+	"SELECT * FROM (SELECT message, NULL, sent_by, sent_time "       \
+	"FROM _Broadcast "                                               \
+	"WHERE broadcast_id > "                                          \
+	"(SELECT broadcast_from FROM _User WHERE username = ?1) "        \
+	"AND sent_by <> ?1 "                                             \
+	"ORDER BY broadcast_id DESC LIMIT ?2)) "                         \
+	"ORDER BY sent_time DESC "                                       \
+	"LIMIT ?2; "
+
+/* i messaggi a tutti stanno in _Broadcast e non nelle chat: le due parti
+	vengono limitate separatamente (i broadcast in ordine di id, cioè di
+	invio) e poi unite */
 
 /**
  * @brief effettua il recupero di tutti gli ultimi "max_msgs" (in ordine di 
@@ -947,56 +867,34 @@ static inline int exec_getonlineuser_in_group(sqlite3 *db, long group_id, long *
  * @param db handler del db
  * @param user utente che richiede i messaggi
  * @param max_msgs massimo numero di messaggi
- * @param result vettore risultato
- * @return int dimensione del vettore
+ * @param result insieme di message_t da liberare con result_free
+ * @return int numero di messaggi
  */
-static inline int exec_getprevmsgs(sqlite3 *db, char *user, int max_msgs, message_t **result)
+static inline int exec_getprevmsgs(sqlite3 *db, char *user, int max_msgs, result_set *result)
 {
-	init_list_callback(message, par);
-	par.result = safe_malloc(max_msgs * sizeof(message_t));
-#ifdef MAKE_VALGRIND_HAPPY
-	memset(par.result, 0, max_msgs * sizeof(message_t));
-#endif
-	par.size = max_msgs;
-	init_param(getprevmsgs, user, max_msgs);
+	result_init(result, sizeof(message_t));
 
-	exec_query(db, q, getmessagelist_callback, &par);
-	destroy_param;
-	if ((par.curr_pos < par.size) && (par.curr_pos > 0))
-	{
-		par.result = realloc(par.result, par.curr_pos * sizeof(message_t));
-		if (!(par.result))
-			handle_error(STRING_BAD_REALLOC);
-		par.size = par.curr_pos;
-	}
-	else if (par.curr_pos == 0)
-	{
-		par.size = 0;
-		free(par.result);
-		*result = NULL;
-		return par.size;
-	}
+	sqlite3_stmt *s = exec_prepare(db, Q_GETPREVMSGS);
+	bind_text(s, 1, user);
+	bind_int(s, 2, max_msgs);
+	exec_stmt(db, s, read_messagelist, result);
 
-	for (int i = 0; i < par.size; i++)
-		strcpy(par.result[i].data.hdr.receiver, user);
+	for (unsigned int i = 0; i < result->no_rows; i++)
+		strcpy(result_row(result, message_t, i)->data.hdr.receiver, user);
 
-	*result = (par.size <= 0) ? NULL : par.result;
-	return par.size;
+	return result->no_rows;
 }
 
 //-------------------------------------------------------------------------//
 #ifndef MAKE_TEST_HAPPY
 
-#define query_increasestats                             \
-	"UPDATE _Stats "                                     \
-	"SET not_delivered_txt = not_delivered_txt + '%d', " \
-	"not_delivered_file = not_delivered_file + '%d', "   \
-	"delivered_txt = delivered_txt + '%d', "             \
-	"delivered_file = delivered_file + '%d', "           \
-	"error_numbers = error_numbers + '%d';"
-
-#define fill_increasestats(p, not_txt, not_file, txt, file, err) \
-	fill_query(p, query_increasestats, not_txt, not_file, txt, file, err)
+#define query_increasestats                            \
+	"UPDATE _Stats "                                    \
+	"SET not_delivered_txt = not_delivered_txt + ?1, "  \
+	"not_delivered_file = not_delivered_file + ?2, "    \
+	"delivered_txt = delivered_txt + ?3, "              \
+	"delivered_file = delivered_file + ?4, "            \
+	"error_numbers = error_numbers + ?5;"
 
 /**
  * @brief esegue l'incremento delle statistiche
@@ -1010,9 +908,13 @@ static inline int exec_getprevmsgs(sqlite3 *db, char *user, int max_msgs, messag
  */
 static inline void exec_increasestats(sqlite3 *db, int not_txt, int not_file, int txt, int file, int err)
 {
-	init_param(increasestats, not_txt, not_file, txt, file, err);
-	exec_query(db, q, NULL, NULL);
-	destroy_param;
+	sqlite3_stmt *s = exec_prepare(db, Q_INCREASESTATS);
+	bind_int(s, 1, not_txt);
+	bind_int(s, 2, not_file);
+	bind_int(s, 3, txt);
+	bind_int(s, 4, file);
+	bind_int(s, 5, err);
+	exec_stmt(db, s, NULL, NULL);
 }
 
 //-------------------------------------------------------------------------//
@@ -1035,7 +937,8 @@ static inline void exec_increasestats(sqlite3 *db, int not_txt, int not_file, in
 static inline void exec_get_from_stats(sqlite3 *db, unsigned long *not_txt, unsigned long *not_file, unsigned long *text, unsigned long *file, unsigned long *errors)
 {
 	unsigned long par[5];
-	exec_query(db, query_get_from_stats, getstats_callback, &par);
+	sqlite3_stmt *s = exec_prepare(db, Q_GET_FROM_STATS);
+	exec_stmt(db, s, read_stats, &par);
 
 	*not_txt = par[0];
 	*not_file = par[1];
@@ -1065,12 +968,22 @@ enum operation
 const char *createdb();
 
 /**
- * @brief restituisce la query per la pulizia del database da effettuare
- * 		dopo ogni avvio
+ * @brief restituisce la versione dello schema attesa dal server
+ * 		(PRAGMA user_version)
+ * 
+ * @return int versione dello schema
+ */
+int schema_version();
+
+/**
+ * @brief restituisce la query che aggiorna lo schema dalla versione
+ * 		"version" alla successiva (imposta anche user_version)
  * 
- * @return const char* query_cleardb
+ * @param version versione attuale del database
+ * @return const char* query di migrazione | NULL se "version" è già
+ * 						aggiornata o sconosciuta
  */
-const char *cleardb();
+const char *migratedb(int version);
 
 //-------------------------------------------------------------------------//
 
@@ -1086,15 +999,6 @@ const char *cleardb();
  */
 void set_reply_message(message_t *ans, op_t OP, char *buffer, int buf_dim, char *sender, char *receiver);
 
-/**
- * @brief restituisce la lista di utenti attualmente online
- * 
- * @param db handler del database
- * @param buf_dim puntatore alla dimensione del buffer restituito (negativo in caso di errore)
- * @return char* lista degli utenti online
- */
-char *get_online_user(sqlite3 *db, int *buf_dim);
-
 /**
  * @brief effettua l'inserimento di "user" nel database (se possibile)
  * 		come utente CONNESSO
@@ -1129,9 +1033,8 @@ op_t manage_connectuser(char *user, int fd, message_t *ans, sqlite3 *db);
  * 		tramite il descrittore "fd"
  * 
  * @param fd descrittore
- * @param db handler db
  */
-void manage_disconnectuser(int fd, sqlite3 *db);
+void manage_disconnectuser(int fd);
 
 /**
  * @brief effettua la creazione del gruppo "group_name" (se possibile)
@@ -1163,12 +1066,11 @@ op_t manage_addtogroup(char *group_name, char *user, sqlite3 *db);
  * 
  * @param group_name nome gruppo
  * @param user utente
- * @param curr_fd fd sul quale è connesso
  * @param db handler db
  * @return op_t l'operazione da inviare come risposta all'utente
  * 				(OP_OK) | (OP_FAIL) | (OP_NICK_UNKNOWN) | ...
  */
-op_t manage_removeuserfromgroup(char *group_name, char *user, int curr_fd, sqlite3 *db);
+op_t manage_removeuserfromgroup(char *group_name, char *user, sqlite3 *db);
 
 /**
  * @brief effettua la rimozione del gruppo "group_name" effettuata da "user"
@@ -1213,7 +1115,7 @@ op_t manage_unregisteruser(char *user, sqlite3 *db);
  * @param *no_fd dimensione del vettore restituito
  * @return int* vettore di fd
  */
-long *manage_postmessage(message_t *msg, int sender_fd, int *no_fd, enum operation *branch, sqlite3 *db);
+long *manage_postmessage(message_t *msg, int *no_fd, enum operation *branch, sqlite3 *db);
 
 /**
  * @brief restituisce (se possibile) un vettore contenente gli ultimi x messaggi 
@@ -1224,18 +1126,22 @@ long *manage_postmessage(message_t *msg, int sender_fd, int *no_fd, enum operati
  * @param db 
  * @return int 
  */
-int manage_getprevmsgs(char *sender, message_t **ans, sqlite3 *db);
+int manage_getprevmsgs(char *sender, result_set *ans, sqlite3 *db);
 
 /**
  * @brief restituisce (se possibile) il messaggio di risposta alla richiesta
- * 		del file inviata tramite "msg"
+ * 		del file inviata tramite "msg": il contenuto non viene caricato in
+ * 		memoria, il file resta aperto per essere inviato con sendFile
  * 
  * @param msg messaggio di richiesta
- * @param ans messaggio di risposta (completo)
+ * @param ans messaggio di risposta (solo header, data.hdr.len contiene la
+ * 			dimensione del file)
+ * @param file_fd descrittore del file aperto in lettura (se OP_OK), deve
+ * 			essere chiuso dal chiamante
  * @param db handler db
  * @return op_t op_t l'operazione da inviare come risposta all'utente
  * 				(OP_OK) | (OP_FAIL) | (OP_NICK_UNKNOWN) | ...
  */
-op_t manage_getfile(message_t *msg, message_t *ans, sqlite3 *db);
+op_t manage_getfile(message_t *msg, message_t *ans, int *file_fd, sqlite3 *db);
 
 #endif
@@ -2,148 +2,1297 @@
 #define _GNU_SOURCE
 
 /**
- * @brief il seguente file contiene l'implementazione delle 
- * 		operazioni di push e pop per la coda di messaggi utilizzata per lo
- * 		scambio di messaggi tra core e slaves. Tutte le operazioni sono thread-safe
- * 		
- * 
+ * @brief il seguente file contiene l'implementazione delle
+ * 		operazioni di push e pop per le code di messaggi utilizzate per lo
+ * 		scambio di messaggi tra core e slaves.
+ * 		I messaggi di ogni connessione vengono accodati in una casella
+ * 		(mailbox) propria della connessione; le code degli slaves contengono
+ * 		invece le connessioni che hanno messaggi da eseguire: uno slave che
+ * 		estrae una connessione ne esegue i messaggi in ordine e la trattiene
+ * 		finché non li ha terminati (o deve lasciare il posto ad altre), quindi
+ * 		le operazioni di un client non vengono mai eseguite da due slaves
+ * 		contemporaneamente. Uno slave senza lavoro ruba le connessioni in
+ * 		attesa nelle code degli altri.
+ * 		Le connessioni attendono in una coda diversa a seconda della classe
+ * 		di priorità (op_class) del loro primo messaggio: le operazioni
+ * 		pesanti vengono eseguite da sole, dagli slaves non riservati alle
+ * 		interattive, una ogni "interactive_weight" connessioni interattive.
+ * 		Le nuove connessioni vengono assegnate solo agli slaves attivi
+ * 		(i primi "active_slaves"): il core ne avvia altri quando i messaggi
+ * 		attendono troppo e ritira l'ultimo quando resta inattivo, che prima
+ * 		di terminare passa le proprie connessioni agli altri.
+ * 		Ogni coda è un anello limitato senza lock (ogni posizione ha un
+ * 		proprio turno, produttori e consumatori si contendono solamente
+ * 		l'indice di inserimento/estrazione con una CAS)
+ *
  * @file queues.c
  * @author Marco Costa - 545144 - mcsx97@gmail.com
  * @date 2018-08-28
- * 
+ *
  * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
  * 			opera originale dell'autore
  */
 #include <stdio.h>
 #include <stdlib.h>
-#include <pthread.h>
-#include <sys/queue.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
 #include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
 #include "queues.h"
 #include "utils.h"
 #include "slaves.h"
+#include "mystring.h"
+#include "ops.h"
+
+/* tentativi a vuoto degli slaves prima di sospendersi sul futex */
+#define QUEUE_SPIN_TRIES 128
+
+/* posizioni iniziali della casella di una connessione (raddoppiano) */
+#define MAILBOX_INIT_SIZE 8
+
+/* sotto questa soglia (metà di quella alta) termina il sovraccarico: il
+	margine evita che i reactor sospendano e riprendano la lettura ad ogni
+	messaggio */
+#define LOW_WATERMARK(high) ((high) / 2)
+
+/* istogramma delle latenze in µs: i primi LAT_LINEAR valori esatti, poi
+	4 intervalli per ogni potenza di 2 */
+#define LAT_LINEAR 8
+#define LAT_BUCKETS (LAT_LINEAR + 4 * 40)
+
+/* dimensione di una linea di cache: gli indici di inserimento e di
+	estrazione vengono separati per non invalidarsi a vicenda */
+#define CACHE_LINE 64
+
+/**
+ * @brief anello delle connessioni in attesa di una classe di priorità,
+ * 		con indici e parole dei futex
+ *
+ */
+typedef struct job_lane
+{
+	job_entry *ring;
+	size_t mask;
+	char pad0[CACHE_LINE];
+	size_t push_pos; /* prossima posizione da occupare */
+	char pad1[CACHE_LINE];
+	size_t pop_pos; /* prossima posizione da liberare */
+	char pad2[CACHE_LINE];
+	unsigned int space;			/* futex dei produttori in attesa di posizioni */
+	unsigned int push_sleepers; /* produttori sospesi su space */
+	char pad3[CACHE_LINE];
+} job_lane;
+
+/* stato del thread di uno slave: il passaggio da SLAVE_RETIRING avviene
+	con una CAS, da parte dello slave (termina) o del core (lo riattiva) */
+#define SLAVE_STOPPED 0
+#define SLAVE_RUNNING 1
+#define SLAVE_RETIRING 2
+
+/**
+ * @brief coda di uno slave: un anello per classe di priorità, connessioni
+ * 		trattenute e metriche
+ *
+ */
+typedef struct job_ring
+{
+	job_lane lanes[OP_CLASSES];
+	int held[SLAVE_BATCH_SIZE]; /* connessioni trattenute dallo slave */
+	unsigned int no_held;
+	unsigned int credits; /* connessioni interattive estratte dall'ultima pesante */
+	unsigned long depth;	 /* messaggi in attesa nelle connessioni assegnate allo slave */
+	unsigned long steals; /* connessioni rubate ad altri slaves */
+	unsigned int state;	 /* SLAVE_STOPPED | SLAVE_RUNNING | SLAVE_RETIRING */
+	char pad4[CACHE_LINE];
+} job_ring;
+
+/**
+ * @brief messaggio in attesa nella casella di una connessione
+ *
+ */
+typedef struct queued_msg
+{
+	message_t *msg;
+	unsigned long enqueued; /* istante di inserimento (ns) */
+} queued_msg;
+
+/**
+ * @brief casella dei messaggi di una connessione, in ordine di arrivo
+ * @note "scheduled" vale 1 finché la connessione si trova nella coda di
+ * 		uno slave o è trattenuta da uno slave: i messaggi in arrivo vengono
+ * 		solamente accodati alla casella
+ *
+ */
+typedef struct mailbox
+{
+	pthread_mutex_t lock;
+	queued_msg *jobs; /* anello di messaggi, cresce se necessario */
+	unsigned int head;
+	unsigned int count;
+	unsigned int size;
+	int scheduled;
+	unsigned int owner; /* slave a cui è assegnata la connessione */
+} mailbox;
+
+static job_ring *rings = NULL;
+static unsigned int no_rings = 0;
+/* le nuove connessioni vengono assegnate agli slaves [0, active_slaves),
+	le code [0, used_rings) sono state utilizzate almeno una volta */
+static unsigned int active_slaves = 0;
+static unsigned int used_rings = 0;
+
+static mailbox **mailboxes = NULL;
+static int mailboxes_dim = 0;
+
+/**
+ * @brief slaves senza lavoro: si sospendono sulla stessa parola, un
+ * 		risvegliato controlla la propria coda e ruba dalle altre. Gli
+ * 		slaves riservati alle operazioni interattive attendono su una parola
+ * 		separata, che le connessioni pesanti non svegliano
+ *
+ */
+#define IDLE_INTERACTIVE 0
+#define IDLE_ANY 1
+
+static struct idle_slaves
+{
+	char pad0[CACHE_LINE];
+	unsigned int items;		 /* futex degli slaves in attesa di messaggi */
+	unsigned int pop_sleepers; /* slaves sospesi su items */
+	char pad1[CACHE_LINE];
+} idle[2];
+
+static unsigned int reserved_slaves = 0;	 /* slaves [0, reserved_slaves) solo interattivi */
+static unsigned int interactive_weight = 1; /* interattive estratte per ogni pesante */
+
+/**
+ * @brief dimensione del pool: valutata dal core ogni POOL_CHECK_MS
+ *
+ */
+static struct
+{
+	unsigned int min_slaves;
+	unsigned long idle_timeout;	/* ns di inattività prima del ritiro, 0 mai */
+	unsigned long last_check;	/* ultima valutazione (ns) */
+	unsigned long idle_since;	/* inizio dell'inattività di uno slave (ns), 0 se assente */
+	unsigned long max_wait;		/* attesa massima in coda dall'ultima valutazione (ns) */
+	unsigned long started;		/* slaves avviati o riattivati */
+	unsigned long retired;		/* slaves ritirati */
+} pool;
+
+/* latenze dall'inserimento al termine, per classe, dall'ultima stampa */
+static unsigned long latency[OP_CLASSES][LAT_BUCKETS];
+static const char *class_names[OP_CLASSES] = {"interattive", "pesanti"};
 
 /**
- * @brief variabili condivise, quali mutex, condizioni di attesa sulla coda
- * 			e condizioni di terminazione
- * 
+ * @brief messaggi in attesa in tutte le caselle: al più "capacity", oltre
+ * 		"high_mark" la coda è in sovraccarico finché non scendono sotto
+ * 		"low_mark"
+ *
  */
-static pthread_mutex_t mux = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t pop_waiting = PTHREAD_COND_INITIALIZER;
+static struct
+{
+	char pad0[CACHE_LINE];
+	unsigned long queued;
+	char pad1[CACHE_LINE];
+	unsigned int space;			/* futex dei produttori in attesa di posti */
+	unsigned int push_sleepers; /* produttori sospesi su space */
+	unsigned long since;			/* inizio del sovraccarico in corso (ns), 0 se assente */
+	unsigned long overloads;	/* numero di sovraccarichi */
+	unsigned long overload_ns; /* durata dei sovraccarichi terminati */
+	unsigned long max_queued;	/* massimo raggiunto */
+	char pad2[CACHE_LINE];
+} load;
+
+static unsigned long capacity = ULONG_MAX;
+static unsigned long high_mark = ULONG_MAX;
+static unsigned long low_mark = ULONG_MAX;
+
 static volatile sig_atomic_t isFree = 0;
 static volatile sig_atomic_t must_terminate = 0;
 static int isInit = 0;
 
+static void futex_wait(unsigned int *addr, unsigned int val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static void futex_wake(unsigned int *addr, int n)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+static unsigned long now_ns()
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (unsigned long)t.tv_sec * 1000000000UL + t.tv_nsec;
+}
+
+static inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
 /**
- * @brief inizializza la coda tramite la macro STAILQ_INIT
- * 
+ * @brief alloca un anello per slave e assegna ad ogni posizione il turno
+ * 		iniziale, la tabella delle caselle è indicizzata per descrittore
+ *
  */
-void queue_init()
+void queue_init(unsigned int no_queues, unsigned int max_queued, unsigned int high_watermark,
+					 unsigned int reserved, unsigned int weight, unsigned int max_connections)
 {
 	if (!isInit)
 	{
-		STAILQ_INIT(&head);
+		if ((mailboxes_dim = fd_table_dim(max_connections)) < 0)
+			handle_error("getrlimit");
+		mailboxes = calloc(mailboxes_dim, sizeof(mailbox *));
+		if (!mailboxes)
+			handle_error("calloc");
+
+		rings = safe_malloc(no_queues * sizeof(job_ring));
+		memset(rings, 0, no_queues * sizeof(job_ring));
+		for (unsigned int i = 0; i < no_queues; i++)
+			for (int lane = 0; lane < OP_CLASSES; lane++)
+			{
+				job_lane *q = &(rings[i].lanes[lane]);
+				q->ring = safe_malloc(JOB_QUEUE_SIZE * sizeof(job_entry));
+				q->mask = JOB_QUEUE_SIZE - 1;
+				for (size_t j = 0; j < JOB_QUEUE_SIZE; j++)
+					q->ring[j].seq = j;
+			}
+		no_rings = no_queues;
+		active_slaves = used_rings = no_queues;
+		for (unsigned int i = 0; i < no_queues; i++)
+			rings[i].state = SLAVE_RUNNING;
+		pool.min_slaves = no_queues;
+
+		/* almeno uno slave deve eseguire le operazioni pesanti */
+		reserved_slaves = (reserved < no_queues) ? reserved : no_queues - 1;
+		interactive_weight = (weight > 0) ? weight : 1;
+
+		capacity = max_queued;
+		high_mark = (high_watermark > 0) ? high_watermark : 1;
+		low_mark = LOW_WATERMARK(high_mark);
 		isInit = 1;
 	}
 }
 
+unsigned int queue_pool_init(unsigned int min_slaves, unsigned int idle_timeout)
+{
+	if ((min_slaves == 0) || (min_slaves > no_rings))
+		min_slaves = no_rings;
+
+	for (unsigned int i = min_slaves; i < no_rings; i++)
+		rings[i].state = SLAVE_STOPPED;
+	active_slaves = used_rings = min_slaves;
+
+	/* gli slaves riservati non vengono mai ritirati, quelli sempre attivi
+		devono comprenderne almeno uno per le operazioni pesanti */
+	if (reserved_slaves >= min_slaves)
+		reserved_slaves = min_slaves - 1;
+
+	pool.min_slaves = min_slaves;
+	pool.idle_timeout = idle_timeout * 1000000000UL;
+	pool.last_check = now_ns();
+
+	return min_slaves;
+}
+
+/**
+ * @brief casella di "fd", allocata al primo messaggio ricevuto sul
+ * 		descrittore e riutilizzata dalle connessioni successive
+ *
+ * @return mailbox* la casella | NULL se fd è fuori dalla tabella
+ */
+static mailbox *mailbox_of(int fd)
+{
+	if ((fd < 0) || (fd >= mailboxes_dim))
+		return NULL;
+
+	mailbox *m = __atomic_load_n(&(mailboxes[fd]), __ATOMIC_ACQUIRE);
+	if (!m)
+	{
+		mailbox *expected = NULL;
+
+		m = safe_malloc(sizeof(mailbox));
+		memset(m, 0, sizeof(mailbox));
+		pthread_mutex_init(&(m->lock), NULL);
+		m->size = MAILBOX_INIT_SIZE;
+		m->jobs = safe_malloc(m->size * sizeof(queued_msg));
+
+		if (!__atomic_compare_exchange_n(&(mailboxes[fd]), &expected, m, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		{
+			free(m->jobs);
+			pthread_mutex_destroy(&(m->lock));
+			free(m);
+			m = expected;
+		}
+	}
+
+	return m;
+}
+
+/**
+ * @brief accoda "msg" alla casella (da richiamare con m->lock acquisito)
+ *
+ */
+static void mailbox_add(mailbox *m, message_t *msg)
+{
+	if (m->count == m->size)
+	{
+		queued_msg *jobs = safe_malloc(2 * m->size * sizeof(queued_msg));
+		for (unsigned int i = 0; i < m->count; i++)
+			jobs[i] = m->jobs[(m->head + i) % m->size];
+		free(m->jobs);
+		m->jobs = jobs;
+		m->head = 0;
+		m->size *= 2;
+	}
+
+	queued_msg *e = &(m->jobs[(m->head + m->count) % m->size]);
+	e->msg = msg;
+	e->enqueued = now_ns();
+	m->count++;
+}
+
+/**
+ * @brief estrae il messaggio più vecchio (da richiamare con m->lock
+ * 		acquisito e m->count > 0)
+ *
+ */
+static queued_msg mailbox_take(mailbox *m)
+{
+	queued_msg e = m->jobs[m->head];
+
+	m->head = (m->head + 1) % m->size;
+	m->count--;
+
+	return e;
+}
+
+/**
+ * @brief classe di priorità del messaggio più vecchio (da richiamare con
+ * 		m->lock acquisito e m->count > 0)
+ *
+ */
+static op_class_t mailbox_class(mailbox *m)
+{
+	return op_class(m->jobs[m->head].msg->hdr.op);
+}
+
+/**
+ * @brief inserimento senza attesa: la posizione "pos" è libera quando il
+ * 		suo turno vale "pos", occupata quando vale "pos + 1"
+ *
+ * @return int 1 se inserito, 0 se la coda è piena
+ */
+static int ring_push(job_lane *q, int fd)
+{
+	size_t pos = __atomic_load_n(&(q->push_pos), __ATOMIC_RELAXED);
+	job_entry *job;
+
+	for (;;)
+	{
+		job = &(q->ring[pos & q->mask]);
+		size_t seq = __atomic_load_n(&(job->seq), __ATOMIC_ACQUIRE);
+		long diff = (long)(seq - pos);
+
+		if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&(q->push_pos), &pos, pos + 1, 1,
+													  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (diff < 0)
+			return 0; /* la posizione non è ancora stata liberata: piena */
+		else
+			pos = __atomic_load_n(&(q->push_pos), __ATOMIC_RELAXED);
+	}
+
+	job->fd = fd;
+	__atomic_store_n(&(job->seq), pos + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+/**
+ * @brief estrazione senza attesa, libera la posizione per il giro
+ * 		successivo dell'anello
+ *
+ * @return int 1 se estratto, 0 se la coda è vuota
+ */
+static int ring_pop(job_lane *q, int *fd)
+{
+	size_t pos = __atomic_load_n(&(q->pop_pos), __ATOMIC_RELAXED);
+	job_entry *job;
+
+	for (;;)
+	{
+		job = &(q->ring[pos & q->mask]);
+		size_t seq = __atomic_load_n(&(job->seq), __ATOMIC_ACQUIRE);
+		long diff = (long)(seq - (pos + 1));
+
+		if (diff == 0)
+		{
+			if (__atomic_compare_exchange_n(&(q->pop_pos), &pos, pos + 1, 1,
+													  __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (diff < 0)
+			return 0; /* la posizione non è ancora stata occupata: vuota */
+		else
+			pos = __atomic_load_n(&(q->pop_pos), __ATOMIC_RELAXED);
+	}
+
+	*fd = job->fd;
+	__atomic_store_n(&(job->seq), pos + q->mask + 1, __ATOMIC_RELEASE);
+
+	return 1;
+}
+
+static int lane_empty(job_lane *q)
+{
+	return __atomic_load_n(&(q->push_pos), __ATOMIC_RELAXED) == __atomic_load_n(&(q->pop_pos), __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief sveglia uno slave sospeso su "w" (se ce ne sono): ogni slave che
+ * 		si sospende incrementa "pop_sleepers" e ogni risveglio lo decrementa,
+ * 		quindi viene svegliato una sola volta anche se nel frattempo vengono
+ * 		inserite altre connessioni
+ *
+ * @return int 1 se uno slave è stato svegliato, 0 altrimenti
+ */
+static int wake_sleeper(struct idle_slaves *w)
+{
+	unsigned int n = __atomic_load_n(&(w->pop_sleepers), __ATOMIC_RELAXED);
+
+	while (n > 0)
+	{
+		if (__atomic_compare_exchange_n(&(w->pop_sleepers), &n, n - 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		{
+			__atomic_add_fetch(&(w->items), 1, __ATOMIC_SEQ_CST);
+			futex_wake(&(w->items), 1);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief sveglia tutti gli slaves sospesi su "w", azzerandone il numero:
+ * 		chi torna a sospendersi si conta di nuovo
+ *
+ */
+static void wake_all(struct idle_slaves *w)
+{
+	__atomic_exchange_n(&(w->pop_sleepers), 0, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&(w->items), 1, __ATOMIC_SEQ_CST);
+	futex_wake(&(w->items), INT_MAX);
+}
+
+/**
+ * @brief sveglia uno slave in grado di eseguire una connessione della
+ * 		classe "lane": per le interattive preferisce quelli riservati
+ * @note la barriera ordina la pubblicazione della posizione rispetto alla
+ * 		lettura dei sospesi: o il thread che si sta sospendendo vede la
+ * 		posizione o noi vediamo lui
+ *
+ */
+static void wake_one(int lane)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if ((lane == OP_CLASS_INTERACTIVE) && (wake_sleeper(&(idle[IDLE_INTERACTIVE]))))
+		return;
+	wake_sleeper(&(idle[IDLE_ANY]));
+}
+
+/**
+ * @brief sveglia tutti i produttori sospesi quando la coda si è svuotata
+ * 		almeno per metà: risvegliarli ad ogni estrazione costerebbe una
+ * 		syscall per messaggio mentre la coda è piena
+ *
+ */
+static void wake_producers(job_lane *q)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&(q->push_sleepers), __ATOMIC_RELAXED) == 0)
+		return;
+
+	size_t depth = __atomic_load_n(&(q->push_pos), __ATOMIC_RELAXED) - __atomic_load_n(&(q->pop_pos), __ATOMIC_RELAXED);
+	if ((depth <= (q->mask + 1) / 2) && (__atomic_exchange_n(&(q->push_sleepers), 0, __ATOMIC_SEQ_CST) > 0))
+	{
+		__atomic_add_fetch(&(q->space), 1, __ATOMIC_SEQ_CST);
+		futex_wake(&(q->space), INT_MAX);
+	}
+}
+
+/**
+ * @brief inserisce la connessione "fd" nella coda "q" della classe "lane",
+ * 		attendendo una posizione libera se necessario
+ *
+ */
+static void ring_push_wait(job_lane *q, int fd, int lane)
+{
+	while (!ring_push(q, fd))
+	{
+		if (must_terminate)
+			return;
+		/* coda piena: gli slaves sono in ritardo, attendere attivamente non
+			serve, mi sospendo finché non la svuotano per metà */
+		unsigned int space = __atomic_load_n(&(q->space), __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&(q->push_sleepers), 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (ring_push(q, fd))
+			break;
+		if (!must_terminate)
+			futex_wait(&(q->space), space);
+	}
+
+	wake_one(lane);
+}
+
+/**
+ * @brief termina il sovraccarico se i messaggi in attesa sono scesi
+ * 		sotto la soglia bassa, sommandone la durata
+ *
+ */
+static void overload_end(unsigned long queued)
+{
+	unsigned long since = __atomic_load_n(&(load.since), __ATOMIC_SEQ_CST);
+
+	if ((since) && (queued <= low_mark) &&
+		 (__atomic_compare_exchange_n(&(load.since), &since, 0, 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)))
+		__atomic_add_fetch(&(load.overload_ns), now_ns() - since, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief attende che ci sia posto per un messaggio: la verifica non è
+ * 		atomica con l'inserimento, quindi ogni reactor può superare la
+ * 		capacità al più di un messaggio
+ *
+ */
+static void wait_capacity()
+{
+	while (__atomic_load_n(&(load.queued), __ATOMIC_SEQ_CST) >= capacity)
+	{
+		if (must_terminate)
+			return;
+		/* gli slaves mi svegliano appena estraggono dei messaggi */
+		unsigned int space = __atomic_load_n(&(load.space), __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&(load.push_sleepers), 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&(load.queued), __ATOMIC_SEQ_CST) < capacity)
+			break;
+		if (!must_terminate)
+			futex_wait(&(load.space), space);
+	}
+}
+
+/**
+ * @brief conta un messaggio inserito, aggiornando il massimo raggiunto e
+ * 		l'inizio del sovraccarico
+ *
+ */
+static void load_add()
+{
+	unsigned long queued = __atomic_add_fetch(&(load.queued), 1, __ATOMIC_SEQ_CST);
+	unsigned long max = __atomic_load_n(&(load.max_queued), __ATOMIC_RELAXED);
+
+	while ((queued > max) &&
+			 (!__atomic_compare_exchange_n(&(load.max_queued), &max, queued, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)))
+		;
+
+	unsigned long expected = 0;
+	if ((queued >= high_mark) && (__atomic_load_n(&(load.since), __ATOMIC_RELAXED) == 0) &&
+		 (__atomic_compare_exchange_n(&(load.since), &expected, now_ns(), 0, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)))
+		__atomic_add_fetch(&(load.overloads), 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief conta "n" messaggi estratti e sveglia i produttori in attesa di
+ * 		posti (una sola syscall per attesa, come in wake_producers)
+ *
+ */
+static void load_sub(unsigned long n)
+{
+	unsigned long queued = __atomic_sub_fetch(&(load.queued), n, __ATOMIC_SEQ_CST);
+
+	overload_end(queued);
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if ((queued < capacity) && (__atomic_load_n(&(load.push_sleepers), __ATOMIC_RELAXED) > 0) &&
+		 (__atomic_exchange_n(&(load.push_sleepers), 0, __ATOMIC_SEQ_CST) > 0))
+	{
+		__atomic_add_fetch(&(load.space), 1, __ATOMIC_SEQ_CST);
+		futex_wake(&(load.space), INT_MAX);
+	}
+}
+
+int queue_overloaded()
+{
+	/* il sovraccarico può essere iniziato dopo l'ultima estrazione che
+		lo avrebbe terminato: lo verifico anche qui */
+	overload_end(__atomic_load_n(&(load.queued), __ATOMIC_SEQ_CST));
+
+	return __atomic_load_n(&(load.since), __ATOMIC_SEQ_CST) != 0;
+}
+
+int queue_connection_idle(int fd)
+{
+	if ((fd < 0) || (fd >= mailboxes_dim))
+		return 1;
+
+	mailbox *m = __atomic_load_n(&(mailboxes[fd]), __ATOMIC_ACQUIRE);
+	if (!m)
+		return 1;
+
+	pthread_mutex_lock(&(m->lock));
+	int idle_connection = !m->scheduled;
+	pthread_mutex_unlock(&(m->lock));
+
+	return idle_connection;
+}
+
 /**
- * @brief inserisce un nuovo messaggio in fondo alla coda
- * @note STAILQ_INSERT_TAIL è O(1)
- * 
+ * @brief accoda il messaggio alla casella di "fd": se la connessione non
+ * 		è già assegnata ad uno slave la inserisce nella coda dello slave
+ * 		attivo "fd % active_slaves" della classe del messaggio
+ *
  * @param msg messaggio da inserire
  * @param fd descrittore di provenienza
  */
 void queue_push(message_t *msg, int fd)
 {
-	job_entry *job = safe_malloc(sizeof(job_entry));
-	(*job).msg = msg;
-	(*job).fd = fd;
+	mailbox *m = mailbox_of(fd);
+
+	if ((!m) || (must_terminate))
+	{
+		free_message(msg);
+		return;
+	}
+
+	wait_capacity();
+
+	pthread_mutex_lock(&(m->lock));
+	mailbox_add(m, msg);
+	load_add();
+	int schedule = !m->scheduled;
+	if (schedule)
+	{
+		m->scheduled = 1;
+		m->owner = (unsigned int)fd % __atomic_load_n(&active_slaves, __ATOMIC_ACQUIRE);
+	}
+	unsigned int owner = m->owner;
+	__atomic_add_fetch(&(rings[owner].depth), 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&(m->lock));
+
+	if (schedule)
+	{
+		int lane = op_class(msg->hdr.op);
+		ring_push_wait(&(rings[owner].lanes[lane]), fd, lane);
+	}
+}
+
+/**
+ * @brief estrae in ordine fino a "max" messaggi della connessione "fd",
+ * 		che lo slave "id" ha estratto da una coda (la propria o quella di
+ * 		un altro slave) o sta già trattenendo. Un messaggio pesante viene
+ * 		eseguito da solo: si ferma prima, o dopo averlo estratto se "alone"
+ *
+ * @param alone 1 se il gruppo di messaggi dello slave è ancora vuoto
+ * @param bulk settato ad 1 se è stato estratto un messaggio pesante
+ * @return int numero di messaggi estratti, -1 se la casella era vuota e
+ * 			la connessione non è più assegnata allo slave
+ */
+static int take_messages(unsigned int id, int fd, wrapper *jobs, int max, int alone, int *bulk)
+{
+	job_ring *q = &(rings[id]);
+	mailbox *m = mailboxes[fd];
+	int n = 0;
+
+	pthread_mutex_lock(&(m->lock));
+	if (m->owner != id)
+	{
+		/* connessione rubata: i suoi messaggi passano a questo slave */
+		__atomic_sub_fetch(&(rings[m->owner].depth), m->count, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&(q->depth), m->count, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&(q->steals), 1, __ATOMIC_RELAXED);
+		m->owner = id;
+	}
+	while ((n < max) && (m->count > 0))
+	{
+		int lane = mailbox_class(m);
+		if ((lane == OP_CLASS_BULK) && ((!alone) || (n > 0)))
+			break;
+
+		queued_msg e = mailbox_take(m);
+		jobs[n].msg = e.msg;
+		jobs[n].fd = fd;
+		jobs[n].enqueued = e.enqueued;
+		jobs[n++].lane = lane;
+
+		if (lane == OP_CLASS_BULK)
+		{
+			*bulk = 1;
+			break;
+		}
+	}
+	int released = (n == 0) && (m->count == 0);
+	if (released)
+		m->scheduled = 0;
+	pthread_mutex_unlock(&(m->lock));
+
+	if (released)
+		return -1;
+
+	__atomic_sub_fetch(&(q->depth), n, __ATOMIC_RELAXED);
+	if (n > 0)
+	{
+		/* il primo messaggio è quello che ha atteso di più */
+		unsigned long wait = now_ns() - jobs[0].enqueued;
+		unsigned long max = __atomic_load_n(&(pool.max_wait), __ATOMIC_RELAXED);
+
+		while ((wait > max) &&
+				 (!__atomic_compare_exchange_n(&(pool.max_wait), &max, wait, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)))
+			;
+		load_sub(n);
+	}
+
+	return n;
+}
+
+/**
+ * @brief le operazioni precedenti dello slave "id" sono terminate: le
+ * 		connessioni trattenute senza altri messaggi vengono rilasciate, le
+ * 		altre tornano in fondo alla coda dello slave della classe del
+ * 		prossimo messaggio. Se nella coda non c'è nessun'altra connessione
+ * 		in attesa (o è piena) quelle interattive restano trattenute
+ *
+ */
+static void release_held(unsigned int id)
+{
+	job_ring *q = &(rings[id]);
+	unsigned int kept = 0;
+	int requeued[OP_CLASSES] = {0};
+
+	for (unsigned int i = 0; i < q->no_held; i++)
+	{
+		int fd = q->held[i];
+		mailbox *m = mailboxes[fd];
+		int waiting = (!lane_empty(&(q->lanes[OP_CLASS_INTERACTIVE]))) || (!lane_empty(&(q->lanes[OP_CLASS_BULK])));
+
+		pthread_mutex_lock(&(m->lock));
+		if (m->count == 0)
+			m->scheduled = 0;
+		else
+		{
+			/* un messaggio pesante passa sempre dalla coda: viene eseguito
+				secondo i pesi, da uno slave non riservato */
+			int lane = mailbox_class(m);
+			if (((waiting) || (lane == OP_CLASS_BULK)) && (ring_push(&(q->lanes[lane]), fd)))
+				requeued[lane] = 1;
+			else
+				q->held[kept++] = fd;
+		}
+		pthread_mutex_unlock(&(m->lock));
+	}
+	q->no_held = kept;
 
-	pthread_mutex_lock(&mux);
-	STAILQ_INSERT_TAIL(&head, job, next_entry);
-	pthread_cond_signal(&pop_waiting);
-	pthread_mutex_unlock(&mux);
+	/* uno slave libero può rubarle */
+	for (int lane = 0; lane < OP_CLASSES; lane++)
+		if (requeued[lane])
+			wake_one(lane);
 }
 
 /**
- * @brief estrazione di un messaggio dalla coda
- * 
- * @return wrapper struttura wrapper di ritorno contenente messaggio e descr
+ * @brief estrae una connessione dalla propria coda o, se è vuota, da
+ * 		quella di un altro slave, partendo dal successivo per non
+ * 		concentrare i furti sul primo. Le interattive hanno la precedenza
+ * 		finché non ne sono state estratte "interactive_weight" dall'ultima
+ * 		pesante
+ *
+ * @param allow_bulk 1 se può essere estratta una connessione pesante
+ * @return int 1 se è stata estratta una connessione, 0 altrimenti
  */
-wrapper queue_pop()
+static int find_connection(unsigned int id, int allow_bulk, int *fd)
+{
+	job_ring *q = &(rings[id]);
+	int order[OP_CLASSES] = {OP_CLASS_INTERACTIVE, OP_CLASS_BULK};
+	/* comprende le code degli slaves ritirati: chi ha letto il numero di
+		slaves attivi prima del ritiro può avervi inserito una connessione */
+	unsigned int no_queues = __atomic_load_n(&used_rings, __ATOMIC_ACQUIRE);
+
+	if ((allow_bulk) && (q->credits >= interactive_weight))
+	{
+		order[0] = OP_CLASS_BULK;
+		order[1] = OP_CLASS_INTERACTIVE;
+	}
+
+	for (int l = 0; l < OP_CLASSES; l++)
+	{
+		int lane = order[l];
+		if ((lane == OP_CLASS_BULK) && (!allow_bulk))
+			continue;
+
+		for (unsigned int k = 0; k < no_queues; k++)
+		{
+			job_lane *victim = &(rings[(id + k) % no_queues].lanes[lane]);
+
+			if (lane_empty(victim))
+				continue;
+			if (ring_pop(victim, fd))
+			{
+				wake_producers(victim);
+				if (lane == OP_CLASS_BULK)
+					q->credits = 0;
+				else if (q->credits < interactive_weight)
+					q->credits++;
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief riempie "jobs" fino a "max" messaggi: prima quelli delle
+ * 		connessioni trattenute, poi quelli delle connessioni estratte dalle
+ * 		code. Un messaggio pesante è sempre l'unico del gruppo
+ *
+ * @return int numero di messaggi estratti
+ */
+static int find_work(unsigned int id, wrapper *jobs, int max)
+{
+	job_ring *q = &(rings[id]);
+	int n = 0, fd, bulk = 0;
+
+	for (unsigned int i = 0; (i < q->no_held) && (n < max) && (!bulk);)
+	{
+		int taken = take_messages(id, q->held[i], jobs + n, max - n, n == 0, &bulk);
+		/* la connessione rilasciata non è più trattenuta: un nuovo messaggio
+			la inserisce in una coda */
+		if (taken < 0)
+			q->held[i] = q->held[--q->no_held];
+		else
+		{
+			n += taken;
+			i++;
+		}
+	}
+
+	/* gli slaves riservati non estraggono connessioni pesanti */
+	while ((!bulk) && (n < max) && (q->no_held < SLAVE_BATCH_SIZE) &&
+			 (find_connection(id, (n == 0) && (id >= reserved_slaves), &fd)))
+	{
+		int taken = take_messages(id, fd, jobs + n, max - n, n == 0, &bulk);
+		if (taken > 0)
+		{
+			q->held[q->no_held++] = fd;
+			n += taken;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * @brief passa la connessione "fd" con i suoi messaggi allo slave attivo
+ * 		"fd % active_slaves", inserendola nella sua coda
+ *
+ */
+static void move_connection(int fd)
+{
+	mailbox *m = mailboxes[fd];
+	unsigned int to = (unsigned int)fd % __atomic_load_n(&active_slaves, __ATOMIC_ACQUIRE);
+	int lane = -1;
+
+	pthread_mutex_lock(&(m->lock));
+	if (m->count == 0)
+		m->scheduled = 0;
+	else
+	{
+		lane = mailbox_class(m);
+		__atomic_sub_fetch(&(rings[m->owner].depth), m->count, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&(rings[to].depth), m->count, __ATOMIC_RELAXED);
+		m->owner = to;
+	}
+	pthread_mutex_unlock(&(m->lock));
+
+	/* la connessione resta assegnata: i messaggi in arrivo vengono solo
+		accodati alla casella finché non è nella nuova coda */
+	if (lane >= 0)
+		ring_push_wait(&(rings[to].lanes[lane]), fd, lane);
+}
+
+/**
+ * @brief ritiro dello slave "id" richiesto dal core: le connessioni
+ * 		trattenute e quelle nella sua coda passano agli slaves attivi
+ *
+ * @return int 1 se lo slave deve terminare, 0 se nel frattempo il core
+ * 			lo ha riattivato
+ */
+static int retire(unsigned int id)
+{
+	job_ring *q = &(rings[id]);
+	unsigned int expected = SLAVE_RETIRING;
+	int fd;
+
+	for (unsigned int i = 0; i < q->no_held; i++)
+		move_connection(q->held[i]);
+	q->no_held = 0;
+
+	for (int lane = 0; lane < OP_CLASSES; lane++)
+		while (ring_pop(&(q->lanes[lane]), &fd))
+		{
+			wake_producers(&(q->lanes[lane]));
+			move_connection(fd);
+		}
+
+	return __atomic_compare_exchange_n(&(q->state), &expected, SLAVE_STOPPED, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * @brief messaggio fasullo restituito agli slaves alla terminazione
+ *
+ */
+static wrapper termination_job()
 {
 	wrapper w;
-	message_t *msg;
-	job_entry *job;
+	message_t *msg = safe_malloc(sizeof(message_t));
 
-	/* questo controllo evita che possa essere stato distrutto il mutex prima di poter controllare
-		la variabile di terminazione */
-	if (must_terminate)
-	{
-		msg = safe_malloc(sizeof(message_t));
-		msg->hdr.op = OP_NOOP; /* operazione gestita come terminazione */
-		msg->data.buf = NULL;
-		w.msg = msg;
-		w.fd = TERMINATION_FD; /* imposto un descrittore fasullo */
-		return w;
-	}
-
-	pthread_mutex_lock(&mux);
-	while ((STAILQ_EMPTY(&head)) && (!must_terminate))
-		pthread_cond_wait(&pop_waiting, &mux);
-	if (must_terminate) /* mi è stato inviato il segnale di terminazione, non un messaggio */
-	{
-		pthread_mutex_unlock(&mux);
-		msg = safe_malloc(sizeof(message_t));
-		msg->hdr.op = OP_NOOP;
-		msg->data.buf = NULL;
-		w.msg = msg;
-		w.fd = TERMINATION_FD; /* imposto un descrittore fasullo */
-		return w;
-	}
-	job = STAILQ_FIRST(&head);
-	STAILQ_REMOVE_HEAD(&head, next_entry); /* O(1) rimozione in testa */
-	pthread_mutex_unlock(&mux);
-	w.msg = job->msg;
-	w.fd = job->fd;
-	free(job);
+	msg->hdr.op = OP_NOOP; /* operazione gestita come terminazione */
+	msg->data.buf = NULL;
+	w.msg = msg;
+	w.fd = TERMINATION_FD; /* imposto un descrittore fasullo */
+	w.enqueued = 0;
+	w.lane = OP_CLASS_INTERACTIVE;
 
 	return w;
 }
 
 /**
- * @brief setta a 1 la variabile condivisa di terminazione, 
- * 		sveglia tutti i thread in wait e pulisce i messaggi ancora in coda
- * 
+ * @brief estrazione di un gruppo di messaggi per lo slave "id": la
+ * 		dimensione cresce con i messaggi in attesa dello slave (metà di
+ * 		quelli in coda), a coda quasi vuota viene estratto un messaggio
+ * 		alla volta. Uno slave ritirato riceve il messaggio di terminazione
+ * @note richiamarla segnala anche il termine delle operazioni precedenti
+ *
+ * @return int numero di messaggi in "jobs"
+ */
+int queue_pop_batch(unsigned int id, wrapper *jobs, int max)
+{
+	int n, tries = 0;
+
+	id %= no_rings;
+	release_held(id);
+	struct idle_slaves *w = &(idle[(id < reserved_slaves) ? IDLE_INTERACTIVE : IDLE_ANY]);
+
+	if (max > SLAVE_BATCH_SIZE)
+		max = SLAVE_BATCH_SIZE;
+	unsigned long target = 1 + __atomic_load_n(&(rings[id].depth), __ATOMIC_RELAXED) / 2;
+	if (target < (unsigned long)max)
+		max = (int)target;
+
+	for (;;)
+	{
+		if (must_terminate) /* mi è stato inviato il segnale di terminazione, non un messaggio */
+		{
+			jobs[0] = termination_job();
+			return 1;
+		}
+
+		if ((__atomic_load_n(&(rings[id].state), __ATOMIC_SEQ_CST) == SLAVE_RETIRING) && (retire(id)))
+		{
+			jobs[0] = termination_job();
+			return 1;
+		}
+
+		if ((n = find_work(id, jobs, max)) > 0)
+			return n;
+
+		/* attesa attiva breve: un messaggio arriva spesso entro pochi cicli */
+		if (tries++ < QUEUE_SPIN_TRIES)
+		{
+			cpu_relax();
+			continue;
+		}
+
+		/* nessuna coda con lavoro: mi sospendo sul futex finché un
+			produttore non inserisce */
+		unsigned int items = __atomic_load_n(&(w->items), __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&(w->pop_sleepers), 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if ((n = find_work(id, jobs, max)) > 0)
+			return n;
+		/* il core segnala il ritiro dopo aver cambiato lo stato: o lo vedo
+			qui o lui vede che mi sto sospendendo */
+		if ((!must_terminate) && (__atomic_load_n(&(rings[id].state), __ATOMIC_SEQ_CST) != SLAVE_RETIRING))
+			futex_wait(&(w->items), items);
+		tries = 0;
+	}
+}
+
+/**
+ * @brief attiva lo slave successivo: se si sta ritirando riprende a
+ * 		lavorare, altrimenti deve essere avviato un nuovo thread
+ *
+ * @return int indice del thread da avviare, -1 se non necessario
+ */
+static int pool_grow()
+{
+	unsigned int slot = active_slaves;
+	unsigned int expected = SLAVE_RETIRING;
+
+	__atomic_add_fetch(&(pool.started), 1, __ATOMIC_RELAXED);
+	if (!__atomic_compare_exchange_n(&(rings[slot].state), &expected, SLAVE_RUNNING, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+	{
+		/* il thread precedente è terminato (o non è mai stato avviato) */
+		__atomic_store_n(&(rings[slot].state), SLAVE_RUNNING, __ATOMIC_SEQ_CST);
+		if (slot >= used_rings)
+			__atomic_store_n(&used_rings, slot + 1, __ATOMIC_RELEASE);
+		__atomic_store_n(&active_slaves, slot + 1, __ATOMIC_RELEASE);
+		return (int)slot;
+	}
+
+	__atomic_store_n(&active_slaves, slot + 1, __ATOMIC_RELEASE);
+	return -1;
+}
+
+/**
+ * @brief ritira l'ultimo slave attivo: non riceve nuove connessioni e
+ * 		termina appena ha passato le sue agli altri
+ *
+ */
+static void pool_shrink()
+{
+	unsigned int slot = active_slaves - 1;
+
+	__atomic_add_fetch(&(pool.retired), 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&active_slaves, slot, __ATOMIC_RELEASE);
+	__atomic_store_n(&(rings[slot].state), SLAVE_RETIRING, __ATOMIC_SEQ_CST);
+	/* potrebbe essere sospeso */
+	wake_all(&(idle[IDLE_ANY]));
+}
+
+int queue_pool_scale()
+{
+	unsigned long now = now_ns();
+
+	if ((!isInit) || (must_terminate) || (now - pool.last_check < POOL_CHECK_MS * 1000000UL))
+		return -1;
+	pool.last_check = now;
+
+	unsigned long max_wait = __atomic_exchange_n(&(pool.max_wait), 0, __ATOMIC_RELAXED);
+	unsigned long queued = __atomic_load_n(&(load.queued), __ATOMIC_RELAXED);
+	/* uno slave che può eseguire qualsiasi operazione è senza lavoro (quelli
+		riservati lo sono anche quando mancano slaves per le pesanti) */
+	int spare = __atomic_load_n(&(idle[IDLE_ANY].pop_sleepers), __ATOMIC_SEQ_CST) > 0;
+
+	if (!spare)
+	{
+		pool.idle_since = 0;
+		/* i messaggi attendono troppo o sono più di quelli che gli slaves
+			attivi estraggono in un gruppo */
+		if ((active_slaves < no_rings) &&
+			 ((max_wait >= POOL_GROW_WAIT_MS * 1000000UL) || (queued >= (unsigned long)active_slaves * SLAVE_BATCH_SIZE)))
+			return pool_grow();
+		return -1;
+	}
+
+	if ((active_slaves <= pool.min_slaves) || (pool.idle_timeout == 0))
+		return -1;
+	if (!pool.idle_since)
+		pool.idle_since = now;
+	else if (now - pool.idle_since >= pool.idle_timeout)
+	{
+		/* uno alla volta: il prossimo dopo un altro periodo di inattività */
+		pool_shrink();
+		pool.idle_since = now;
+	}
+
+	return -1;
+}
+
+/**
+ * @brief intervallo dell'istogramma delle latenze di "us" microsecondi
+ *
+ */
+static unsigned int latency_bucket(unsigned long us)
+{
+	if (us < LAT_LINEAR)
+		return us;
+
+	unsigned int e = 63 - __builtin_clzl(us); /* us in [2^e, 2^(e+1)) */
+	unsigned int b = LAT_LINEAR + (e - 3) * 4 + ((us >> (e - 2)) & 3);
+
+	return (b < LAT_BUCKETS) ? b : LAT_BUCKETS - 1;
+}
+
+/**
+ * @brief estremo superiore (in µs) dell'intervallo "b" dell'istogramma
+ *
+ */
+static unsigned long bucket_limit(unsigned int b)
+{
+	if (b < LAT_LINEAR)
+		return b + 1;
+
+	unsigned int e = (b - LAT_LINEAR) / 4 + 3;
+	unsigned long sub = (b - LAT_LINEAR) % 4;
+
+	return (4 + sub + 1) << (e - 2);
+}
+
+void queue_done(wrapper *jobs, int n)
+{
+	unsigned long now = now_ns();
+
+	for (int i = 0; i < n; i++)
+		if (jobs[i].fd != TERMINATION_FD)
+			__atomic_add_fetch(&(latency[jobs[i].lane][latency_bucket((now - jobs[i].enqueued) / 1000)]), 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief stampa numero e percentili delle latenze di ogni classe
+ * 		dall'ultima stampa, azzerandone l'istogramma
+ *
+ */
+static void print_latencies(FILE *fout)
+{
+	for (int lane = 0; lane < OP_CLASSES; lane++)
+	{
+		unsigned long counts[LAT_BUCKETS], total = 0;
+		unsigned long p50 = 0, p99 = 0, seen = 0;
+
+		for (unsigned int b = 0; b < LAT_BUCKETS; b++)
+			total += counts[b] = __atomic_exchange_n(&(latency[lane][b]), 0, __ATOMIC_RELAXED);
+
+		for (unsigned int b = 0; (b < LAT_BUCKETS) && (total > 0); b++)
+		{
+			seen += counts[b];
+			if ((!p50) && (seen * 2 >= total))
+				p50 = bucket_limit(b);
+			if (seen * 100 >= total * 99)
+			{
+				p99 = bucket_limit(b);
+				break;
+			}
+		}
+
+		fprintf(fout, STRING_LOG_QUEUE_CLASS, class_names[lane], total, p50 / 1e3, p99 / 1e3);
+	}
+}
+
+void queue_print_stats(FILE *fout)
+{
+	if (!isInit)
+		return;
+
+	for (unsigned int i = 0; i < __atomic_load_n(&used_rings, __ATOMIC_ACQUIRE); i++)
+		fprintf(fout, STRING_LOG_QUEUE_STATS, i,
+				  __atomic_load_n(&(rings[i].depth), __ATOMIC_RELAXED),
+				  __atomic_load_n(&(rings[i].steals), __ATOMIC_RELAXED));
+
+	/* comprende la durata del sovraccarico in corso */
+	unsigned long since = __atomic_load_n(&(load.since), __ATOMIC_RELAXED);
+	unsigned long overload_ns = __atomic_load_n(&(load.overload_ns), __ATOMIC_RELAXED);
+	if (since)
+		overload_ns += now_ns() - since;
+	fprintf(fout, STRING_LOG_QUEUE_LOAD,
+			  __atomic_load_n(&(load.queued), __ATOMIC_RELAXED), capacity,
+			  __atomic_load_n(&(load.max_queued), __ATOMIC_RELAXED),
+			  __atomic_load_n(&(load.overloads), __ATOMIC_RELAXED), overload_ns / 1e9);
+	print_latencies(fout);
+	fprintf(fout, STRING_LOG_QUEUE_POOL, __atomic_load_n(&active_slaves, __ATOMIC_RELAXED),
+			  pool.min_slaves, no_rings, __atomic_load_n(&(pool.started), __ATOMIC_RELAXED),
+			  __atomic_load_n(&(pool.retired), __ATOMIC_RELAXED));
+	fflush(fout);
+}
+
+/**
+ * @brief libera i messaggi rimasti nelle caselle
+ *
+ */
+static void free_mailboxes_jobs()
+{
+	for (int fd = 0; fd < mailboxes_dim; fd++)
+	{
+		mailbox *m = __atomic_load_n(&(mailboxes[fd]), __ATOMIC_ACQUIRE);
+		if (!m)
+			continue;
+
+		pthread_mutex_lock(&(m->lock));
+		while (m->count > 0)
+			free_message(mailbox_take(m).msg);
+		pthread_mutex_unlock(&(m->lock));
+	}
+}
+
+/**
+ * @brief setta a 1 la variabile condivisa di terminazione,
+ * 		sveglia tutti i thread sospesi e pulisce i messaggi ancora in coda
+ *
  */
 void queue_free()
 {
 	must_terminate = 1;
-	pthread_cond_broadcast(&pop_waiting);
-
-	if (!isFree)
+	for (int i = 0; i < 2; i++)
 	{
-		pthread_mutex_lock(&mux);
-		while (!STAILQ_EMPTY(&head))
+		__atomic_add_fetch(&(idle[i].items), 1, __ATOMIC_SEQ_CST);
+		futex_wake(&(idle[i].items), INT_MAX);
+	}
+	for (unsigned int i = 0; i < no_rings; i++)
+		for (int lane = 0; lane < OP_CLASSES; lane++)
 		{
-			job_entry *job = STAILQ_FIRST(&head);
-			STAILQ_REMOVE_HEAD(&head, next_entry);
-			/* libero il messaggio rimasto in coda */
-			free_message(job->msg);
-			free(job);
+			__atomic_add_fetch(&(rings[i].lanes[lane].space), 1, __ATOMIC_SEQ_CST);
+			futex_wake(&(rings[i].lanes[lane].space), INT_MAX);
 		}
-		pthread_mutex_unlock(&mux);
+	__atomic_add_fetch(&(load.space), 1, __ATOMIC_SEQ_CST);
+	futex_wake(&(load.space), INT_MAX);
 
+	if ((!isFree) && (isInit))
+	{
+		free_mailboxes_jobs();
 		isFree = 1;
 	}
-
-	pthread_cond_broadcast(&pop_waiting);
 }
 
 void destroy_queue_mutex()
 {
-	pthread_mutex_destroy(&mux);
-	pthread_cond_destroy(&pop_waiting);
+	if (isInit)
+	{
+		/* messaggi accodati dopo queue_free */
+		free_mailboxes_jobs();
+		for (int fd = 0; fd < mailboxes_dim; fd++)
+			if (mailboxes[fd])
+			{
+				pthread_mutex_destroy(&(mailboxes[fd]->lock));
+				free(mailboxes[fd]->jobs);
+				free(mailboxes[fd]);
+			}
+		free(mailboxes);
+		mailboxes = NULL;
+		mailboxes_dim = 0;
+
+		for (unsigned int i = 0; i < no_rings; i++)
+			for (int lane = 0; lane < OP_CLASSES; lane++)
+				free(rings[i].lanes[lane].ring);
+		free(rings);
+		rings = NULL;
+		no_rings = 0;
+		isInit = 0;
+	}
 }
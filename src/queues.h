@@ -11,23 +11,10 @@
 #ifndef _QUEUES_H_
 #define _QUEUES_H_
 
-#include <sys/queue.h>
+#include <stdio.h>
+#include <stddef.h>
 #include "message.h"
 
-/*
-	A singly-linked tail queue	is headed by a structure defined by the
-     STAILQ_HEAD macro.	 This structure	contains a pair	of pointers, one to
-     the first element in the tail queue and the other to the last element in
-     the tail queue.  The elements are singly linked for minimum space and
-     pointer manipulation overhead at the expense of O(n) removal for arbi-
-     trary elements.  New elements can be added	to the tail queue after	an
-     existing element, at the head of the tail queue, or at the	end of the
-     tail queue.
-
-	  da "man queue"
-*/
-static STAILQ_HEAD(job_queue, job_entry) head = STAILQ_HEAD_INITIALIZER(head);
-
 /**
  * @brief struttura wrapper per la restituzione dei parametri
  * 
@@ -36,42 +23,142 @@ typedef struct wrapper
 {
    message_t *msg;
    int fd;
+   unsigned long enqueued; /* istante di inserimento nella coda (ns) */
+   int lane;               /* classe di priorità del messaggio (op_class) */
 } wrapper;
 
 /**
- * @brief entry della coda
+ * @brief posizione della coda di uno slave: le posizioni sono preallocate
+ * 		in un anello di JOB_QUEUE_SIZE elementi e riutilizzate, ognuna indica
+ * 		una connessione con messaggi da eseguire
  * 
  */
 typedef struct job_entry
 {
-   message_t *msg; /* il messaggio */
-   int fd;         /* il descrittore dal quale è arrivato il messaggio */
-   STAILQ_ENTRY(job_entry)
-   next_entry; /* macro che gestisce il parametro successivo */
+   size_t seq; /* turno della posizione: indica se è libera o occupata */
+   int fd;     /* la connessione */
 } job_entry;
 
+/* politiche dei reactor quando la coda è in sovraccarico */
+#define QUEUE_POLICY_THROTTLE "throttle" /* smettono di leggere dai client */
+#define QUEUE_POLICY_BUSY "busy"			/* rispondono OP_BUSY senza eseguire */
+
+/**
+ * @brief inizializza le code di comunicazione CORE -> SLAVE, una per slave
+ * 		e per classe di priorità
+ * 
+ * @param __no_queues numero massimo di slaves
+ * @param __max_queued messaggi massimi in attesa degli slaves: oltre, chi
+ * 			inserisce attende
+ * @param __high_watermark messaggi in attesa oltre i quali la coda è in
+ * 			sovraccarico (vedi queue_overloaded)
+ * @param __reserved numero di slaves che eseguono solo operazioni
+ * 			interattive (almeno uno slave resta per quelle pesanti)
+ * @param __weight connessioni interattive estratte da uno slave per ogni
+ * 			pesante quando entrambe sono in attesa
+ * @param __max_connections MaxConnections (dimensiona la tabella delle
+ * 			caselle con fd_table_dim)
+ */
+void queue_init(unsigned int __no_queues, unsigned int __max_queued, unsigned int __high_watermark,
+                unsigned int __reserved, unsigned int __weight, unsigned int __max_connections);
+
 /**
- * @brief inizializza la coda di comunicazione CORE -> SLAVE
+ * @brief rende elastico il pool di slaves: sono attivi i primi "__min" e
+ * 		gli altri (fino al numero di code) vengono avviati su richiesta
+ * 		di queue_pool_scale
+ * @warning da chiamare dopo queue_init e prima di avviare gli slaves
  * 
+ * @param __min slaves sempre attivi (comprendono quelli riservati)
+ * @param __idle_timeout secondi con uno slave inattivo prima di ritirarne
+ * 			uno, 0 per non ritirarli mai
+ * @return unsigned int numero di slaves da avviare (indici [0, ret))
  */
-void queue_init();
+unsigned int queue_pool_init(unsigned int __min, unsigned int __idle_timeout);
 
 /**
- * @brief effettua l'operazione di push (atomica)
+ * @brief accoda il messaggio a quelli di "__fd": le operazioni di una
+ * 		connessione vengono eseguite in ordine, da un solo slave alla volta.
+ * 		Se la connessione deve essere inserita nella coda di uno slave e
+ * 		la coda è piena il chiamante attende che si liberi una posizione
  * 
- * @note STAILQ garantisce l'operazione con costo O(1)
  * @param __msg il messaggio da inserire
  * @param __fd il descrittore dal quale è arrivato il messaggio
  */
 void queue_push(message_t *__msg, int __fd);
 
 /**
- * @brief effettua l'operazione di pop e rimozione dell'elemento(atomica)
+ * @brief indica se la coda è in sovraccarico: lo diventa quando i messaggi
+ * 		in attesa raggiungono la soglia alta e lo resta finché non scendono
+ * 		sotto la sua metà
+ * 
+ * @return int 1 se in sovraccarico, 0 altrimenti
+ */
+int queue_overloaded();
+
+/**
+ * @brief indica se "__fd" non ha messaggi in attesa né in esecuzione: una
+ * 		risposta inviata ora non precede quelle dei messaggi precedenti
+ * 
+ * @param __fd descrittore
+ * @return int 1 se la connessione è libera, 0 altrimenti
+ */
+int queue_connection_idle(int __fd);
+
+/**
+ * @brief estrae fino a "__max" messaggi per lo slave "__id": i successivi
+ * 		delle connessioni che sta eseguendo, altrimenti quelli delle
+ * 		connessioni nella propria coda o rubate a quella di un altro slave.
+ * 		Il numero di messaggi cresce con quelli in attesa dello slave, un
+ * 		messaggio pesante (OP_CLASS_BULK) viene estratto da solo.
+ * 		Senza lavoro il chiamante prova per un breve periodo e poi si
+ * 		sospende su un futex
+ * @warning la chiamata indica che lo slave ha terminato i messaggi
+ * 			precedenti: fino ad allora nessun altro slave esegue messaggi
+ * 			delle stesse connessioni. I messaggi di una connessione sono
+ * 			in "__jobs" nell'ordine di arrivo
+ * 
+ * @param __id indice dello slave
+ * @param __jobs messaggi estratti (almeno "__max" posizioni)
+ * @param __max numero massimo di messaggi (al più SLAVE_BATCH_SIZE)
+ * @return int numero di messaggi estratti (>= 1): alla terminazione, o
+ * 			se lo slave è stato ritirato, l'unico messaggio ha descrittore
+ * 			TERMINATION_FD
+ */
+int queue_pop_batch(unsigned int __id, wrapper *__jobs, int __max);
+
+/**
+ * @brief segnala il termine dell'esecuzione dei messaggi estratti con
+ * 		queue_pop_batch (risposte comprese), registrandone la latenza
+ * 		dall'inserimento nella coda per classe di priorità
+ * 
+ * @param __jobs messaggi eseguiti (i campi msg non vengono letti)
+ * @param __n numero di messaggi
+ */
+void queue_done(wrapper *__jobs, int __n);
+
+/**
+ * @brief valuta la dimensione del pool (al più una volta ogni
+ * 		POOL_CHECK_MS): se i messaggi attendono da più di POOL_GROW_WAIT_MS,
+ * 		o sono troppi per gli slaves attivi, e nessuno di loro è libero ne
+ * 		attiva un altro; se uno slave resta inattivo per il periodo indicato
+ * 		a queue_pool_init ritira l'ultimo, che termina dopo aver passato le
+ * 		proprie connessioni agli altri (vedi queue_pop_batch)
+ * @warning da richiamare da un solo thread
+ * 
+ * @return int indice dello slave di cui avviare il thread (il precedente
+ * 			thread con lo stesso indice è terminato), -1 altrimenti
+ */
+int queue_pool_scale();
+
+/**
+ * @brief stampa su "__fout" per ogni slave i messaggi in attesa nelle
+ * 		connessioni assegnate e le connessioni rubate ad altri slaves,
+ * 		quindi i messaggi in attesa in totale, il tempo trascorso in
+ * 		sovraccarico, le latenze di ogni classe dall'ultima stampa e gli
+ * 		slaves attivi
  * 
- * @note STAILQ garantisce l'operazione con costo O(1)
- * @return wrapper struttura contenente messaggio e descrittore
  */
-wrapper queue_pop();
+void queue_print_stats(FILE *__fout);
 
 /**
  * @brief libera la restante memoria allocata dalla coda in caso 
@@ -81,7 +168,7 @@ wrapper queue_pop();
 void queue_free();
 
 /**
- * @brief distrugge i mutex e le variabili condizione istanziate
+ * @brief libera gli anelli delle code
  * @warning da chiamare dopo aver terminato tutti gli slave
  * 
  */
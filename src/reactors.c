@@ -0,0 +1,572 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+/**
+ * @brief il seguente file contiene l'implementazione dei thread reactor:
+ * 		- il core accetta le connessioni e scrive il descrittore sulla pipe
+ * 			del reactor con meno connessioni
+ * 		- il reactor registra il descrittore nel proprio ciclo di eventi,
+ * 			legge i messaggi senza bloccarsi e li passa agli slaves
+ * 		- ogni connessione appartiene ad un solo reactor fino alla sua
+ * 			chiusura, il suo stato di ricezione (sessions.h) non è quindi
+ * 			mai condiviso
+ * 		- se la socket di un client è piena lo slave chiede al reactor
+ * 			(tramite la stessa pipe) di inviare la coda in uscita quando
+ * 			il descrittore torna scrivibile
+ * 		- se la coda degli slaves è in sovraccarico il reactor smette di
+ * 			leggere dai client (i messaggi restano nei buffer delle socket e
+ * 			i client si bloccano in scrittura) oppure, con la politica
+ * 			"busy", risponde OP_BUSY senza passare le richieste agli slaves
+ *
+ * @file reactors.c
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-07
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "reactors.h"
+#include "events.h"
+#include "sessions.h"
+#include "queues.h"
+#include "ops.h"
+
+/* numero massimo di messaggi completi estratti da una connessione per
+	ogni risveglio, evita che un client molto attivo monopolizzi il reactor */
+#define MAX_FRAMES_PER_WAKEUP 8
+
+/* valore scritto sulla pipe per richiedere la terminazione del reactor */
+#define REACTOR_STOP -1
+
+/* valore scritto sulla pipe per richiedere la notifica di scrittura di
+	"fd" (socket piena), distinto dai descrittori e da REACTOR_STOP */
+#define REACTOR_WATCH(fd) (-(fd)-2)
+
+/* numero massimo di nuovi descrittori letti dalla pipe per risveglio */
+#define MAX_HANDOFF_PER_WAKEUP 64
+
+/* con letture sospese il reactor controlla il termine del sovraccarico
+	ogni THROTTLE_POLL_MS millisecondi */
+#define THROTTLE_POLL_MS 5
+
+/* posizioni iniziali della lista delle connessioni sospese (raddoppiano) */
+#define PAUSED_INIT_SIZE 16
+
+typedef struct reactor
+{
+	pthread_t tid;
+	unsigned int id;
+	int active;						/**< 1 se il thread è stato avviato */
+	event_loop *loop;
+	int pipe_fd[2];				/**< il core scrive i nuovi descrittori in pipe_fd[1] */
+	unsigned long connections; /**< connessioni assegnate (accesso atomico) */
+	unsigned long events;		/**< descrittori pronti gestiti (accesso atomico) */
+	unsigned long pauses;		/**< letture sospese per sovraccarico (accesso atomico) */
+	unsigned long rejected;		/**< richieste rifiutate con OP_BUSY (accesso atomico) */
+	int *paused;					/**< connessioni con la lettura sospesa */
+	unsigned int no_paused;
+	unsigned int paused_size;
+	/* usati solo da reactors_print_stats */
+	unsigned long last_events;
+	struct timespec last_print;
+} reactor_t;
+
+static reactor_t *reactors = NULL;
+static unsigned int tot_reactors = 0;
+static int busy_policy = 0; /* 1 con QUEUE_POLICY_BUSY */
+
+/**
+ * @brief rimuove il client "fd" dal ciclo di eventi del reactor e ne
+ * 		libera lo stato di ricezione
+ * @warning deve essere eseguita PRIMA di passare la disconnessione agli
+ * 			slaves, che si occuperanno di chiudere il descrittore
+ *
+ * @param r reactor proprietario
+ * @param fd descrittore del client
+ */
+static void close_client(reactor_t *r, int fd)
+{
+	session_t *client = session_get(fd);
+	if (client)
+	{
+		client->out_armed = 0;
+		client->rx_paused = 0;
+	}
+
+	ev_del(r->loop, fd);
+	session_close(fd);
+	__atomic_sub_fetch(&(r->connections), 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief sospende la lettura della connessione "fd" finché la coda degli
+ * 		slaves è in sovraccarico
+ *
+ * @param r reactor proprietario
+ * @param client connessione
+ */
+static void pause_client(reactor_t *r, session_t *client)
+{
+	if (ev_watch(r->loop, client->fd, 0, client->out_armed) != 0)
+		return;
+
+	if (r->no_paused == r->paused_size)
+	{
+		r->paused_size = (r->paused_size) ? 2 * r->paused_size : PAUSED_INIT_SIZE;
+		r->paused = realloc(r->paused, r->paused_size * sizeof(int));
+		if (!r->paused)
+			handle_error("realloc");
+	}
+	r->paused[r->no_paused++] = client->fd;
+	client->rx_paused = 1;
+	__atomic_add_fetch(&(r->pauses), 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief riprende la lettura delle connessioni sospese: i messaggi
+ * 		arrivati nel frattempo vengono notificati dal ciclo di eventi
+ *
+ * @param r reactor
+ */
+static void resume_clients(reactor_t *r)
+{
+	for (unsigned int i = 0; i < r->no_paused; i++)
+	{
+		session_t *client = session_get(r->paused[i]);
+
+		/* la connessione può essere stata chiusa (e il descrittore riassegnato) */
+		if ((!client) || (client->reactor != r->id) || (!client->rx_paused))
+			continue;
+		if (ev_watch(r->loop, client->fd, 1, client->out_armed) == 0)
+			client->rx_paused = 0;
+	}
+	r->no_paused = 0;
+}
+
+/**
+ * @brief scarta il contenuto del messaggio ricevuto, che diventa la sola
+ * 		risposta "op" al client
+ *
+ * @param msg messaggio ricevuto
+ * @param data contenuto del file ricevuto
+ * @param spool_path file temporaneo del file ricevuto
+ * @param op risposta
+ */
+static void discard_frame(message_t *msg, message_data_t data, char *spool_path, op_t op)
+{
+	if (msg->data.buf)
+		free(msg->data.buf);
+	if (data.buf)
+		free(data.buf);
+	if (spool_path)
+	{
+		unlink(spool_path);
+		free(spool_path);
+	}
+	memset(msg, 0, sizeof(message_t));
+	msg->hdr.op = op;
+}
+
+/**
+ * @brief risponde OP_BUSY alla richiesta (già scartata) di "fd": se la
+ * 		connessione non ha messaggi in attesa la risposta viene inviata
+ * 		subito, altrimenti segue quelle dei messaggi precedenti
+ *
+ * @param r reactor proprietario
+ * @param fd descrittore del client
+ * @param msg richiesta rifiutata
+ */
+static void reject_request(reactor_t *r, int fd, message_t *msg)
+{
+	__atomic_add_fetch(&(r->rejected), 1, __ATOMIC_RELAXED);
+
+	if (queue_connection_idle(fd))
+	{
+		message_hdr_t busy;
+		setHeader(&busy, OP_BUSY, "server");
+		session_send_header(fd, &busy);
+		free_message(msg);
+	}
+	else
+		queue_push(msg, fd);
+}
+
+/**
+ * @brief passa agli slaves il messaggio completo ricevuto da "fd"
+ *
+ * @param r reactor proprietario
+ * @param fd descrittore del client
+ * @param rx stato di ricezione con il messaggio completo
+ */
+static void dispatch_frame(reactor_t *r, int fd, rx_frame *rx)
+{
+	message_t *new_message = rx->msg;
+	message_data_t data = rx->file;
+	char *spool_path = rx->spool_path;
+	int too_long = rx->too_long;
+
+	/* il messaggio ora appartiene al reactor */
+	nextFrame(rx);
+
+	/* dimensione permessa superata (i byte in eccesso sono già stati scartati) */
+	if (too_long)
+	{
+		discard_frame(new_message, data, spool_path, OP_MSG_TOOLONG);
+		queue_push(new_message, fd);
+	}
+	/* slaves in sovraccarico: la richiesta non viene eseguita */
+	else if ((busy_policy) && (queue_overloaded()))
+	{
+		discard_frame(new_message, data, spool_path, OP_BUSY);
+		reject_request(r, fd, new_message);
+	}
+	/* il contenuto del file è già su disco: il buffer alla fine conterrà 
+		"filename'\0'percorso del file temporaneo'\0'" */
+	else if ((new_message->hdr.op == POSTFILE_OP) && (new_message->data.buf) && (spool_path))
+	{
+		new_message->data.buf[new_message->data.hdr.len - 1] = '\0';
+		char *temp = basename(new_message->data.buf);
+		char *p = new_message->data.buf;
+		new_message->data.hdr.len = strlen(temp) + strlen(spool_path) + 2;
+		new_message->data.buf = safe_malloc(new_message->data.hdr.len * sizeof(char));
+		strcpy(new_message->data.buf, temp);
+		strcpy(&(new_message->data.buf[strlen(temp) + 1]), spool_path);
+
+		free(p);
+		free(spool_path);
+		queue_push(new_message, fd);
+	}
+	/* mi è stato inviato un messaggio con una operazione
+		riservata allo spazio applicativo (o un file senza nome) */
+	else if ((new_message->hdr.op < 0) || (new_message->hdr.op == POSTFILE_OP))
+	{
+		discard_frame(new_message, data, spool_path, OP_FAIL);
+		queue_push(new_message, fd);
+	}
+	/* tutto ok: passo il messaggio agli slaves */
+	else
+		queue_push(new_message, fd);
+}
+
+/**
+ * @brief legge i messaggi disponibili sulla connessione "fd"
+ *
+ * @param r reactor proprietario
+ * @param fd descrittore del client
+ */
+static void read_client(reactor_t *r, int fd)
+{
+	int ret_value = FRAME_PARTIAL;
+	session_t *client = session_get(fd);
+	if (!client)
+		return;
+
+	/* lettura sospesa: il backend notifica comunque chiusure ed errori,
+		che leggo per rilevarli, ma con la notifica di scrittura attiva
+		l'evento può essere solo quest'ultima */
+	if ((client->rx_paused) && (client->out_armed))
+		return;
+
+	/* leggo solo i byte già disponibili: un client lento non blocca
+		il reactor, il messaggio verrà completato ai risvegli successivi */
+	for (int frames = 0; frames < MAX_FRAMES_PER_WAKEUP; frames++)
+	{
+		/* slaves in sovraccarico: i messaggi restano nel buffer della socket */
+		if ((!busy_policy) && (!client->rx_paused) && (queue_overloaded()))
+		{
+			pause_client(r, client);
+			return;
+		}
+		ret_value = readFrame(fd, &(client->rx));
+		if (ret_value != FRAME_COMPLETE)
+			break;
+		dispatch_frame(r, fd, &(client->rx));
+	}
+
+	/* evitiamo di chiudere tutto il server per errori della read:
+		se causa errori, lo trattiamo come una connessione chiusa */
+	if (ret_value <= 0)
+	{
+		message_t *new_message = safe_malloc(sizeof(message_t));
+		memset(new_message, 0, sizeof(message_t));
+
+		/* il descrittore va rimosso prima che lo slave lo chiuda */
+		close_client(r, fd);
+
+		/* imposto la disconnessione dell'utente in base al suo descrittore
+			poiché non ne conosco il nome utente */
+		new_message->hdr.op = DISCONNECT_OP;
+		queue_push(new_message, fd);
+
+		fprintf(stdout, "[++] connessione con fd %d chiusa\n", fd);
+	}
+}
+
+/**
+ * @brief abilita la notifica di scrittura della connessione "fd", se
+ * 		appartiene ancora al reactor
+ *
+ * @param r reactor
+ * @param fd descrittore del client
+ */
+static void watch_client(reactor_t *r, int fd)
+{
+	session_t *client = session_get(fd);
+
+	/* la richiesta può riferirsi ad una connessione ormai chiusa */
+	if ((!client) || (client->reactor != r->id) || (client->out_armed))
+		return;
+
+	if (ev_watch(r->loop, fd, !client->rx_paused, 1) == 0)
+		client->out_armed = 1;
+}
+
+/**
+ * @brief scrive quanto rimasto nella coda in uscita di "fd" (ora
+ * 		scrivibile), disabilitando la notifica di scrittura a coda vuota
+ *
+ * @param r reactor
+ * @param fd descrittore del client
+ */
+static void flush_client(reactor_t *r, int fd)
+{
+	session_t *client = session_get(fd);
+	if ((!client) || (!client->out_armed))
+		return;
+
+	if (session_flush(fd) == 0)
+	{
+		ev_watch(r->loop, fd, !client->rx_paused, 0);
+		client->out_armed = 0;
+	}
+}
+
+/**
+ * @brief registra i nuovi descrittori assegnati dal core e le richieste
+ * 		di notifica di scrittura degli slaves
+ *
+ * @param r reactor
+ * @return int 0 se è stata richiesta la terminazione, 1 altrimenti
+ */
+static int accept_handoff(reactor_t *r)
+{
+	int fds[MAX_HANDOFF_PER_WAKEUP];
+
+	/* ogni scrittura sulla pipe è di un solo intero (atomica), quindi
+		i byte disponibili sono sempre un multiplo di sizeof(int) */
+	ssize_t n = read(r->pipe_fd[0], fds, sizeof(fds));
+	if (n <= 0)
+		return 1;
+
+	for (int i = 0; i < n / (ssize_t)sizeof(int); i++)
+	{
+		if (fds[i] == REACTOR_STOP)
+			return 0;
+		if (fds[i] < REACTOR_STOP)
+		{
+			watch_client(r, -(fds[i]) - 2);
+			continue;
+		}
+
+		/* il backend non può gestire il descrittore (es. select oltre FD_SETSIZE) */
+		if (ev_add(r->loop, fds[i]) != 0)
+		{
+			perror(STRING_PERROR(STRING_BAD_EVENT_ADD));
+			session_close(fds[i]);
+			close(fds[i]);
+			__atomic_sub_fetch(&(r->connections), 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * @brief routine dei thread reactor
+ *
+ * @param arg reactor_t del thread
+ * @return void*
+ */
+static void *reactor_routine(void *arg)
+{
+	reactor_t *r = arg;
+	int ready[MAX_READY_EVENTS];
+
+	for (;;)
+	{
+		if ((r->no_paused > 0) && (!queue_overloaded()))
+			resume_clients(r);
+
+		int no_ready = ev_wait(r->loop, ready, MAX_READY_EVENTS, (r->no_paused > 0) ? THROTTLE_POLL_MS : -1);
+		if (no_ready < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			handle_error(STRING_HANDLE_BAD_EVENT_WAIT);
+		}
+
+		__atomic_add_fetch(&(r->events), no_ready, __ATOMIC_RELAXED);
+
+		for (int i = 0; i < no_ready; i++)
+		{
+			if (ready[i] == r->pipe_fd[0])
+			{
+				if (!accept_handoff(r))
+					return (void *)0;
+			}
+			else
+			{
+				flush_client(r, ready[i]);
+				read_client(r, ready[i]);
+			}
+		}
+	}
+}
+
+int reactors_init(conf_param *conf)
+{
+	int reactor_id_dim = strlen(REACTOR_NAME) + get_digits_number(conf->io_threads) + 1;
+
+	tot_reactors = conf->io_threads;
+	busy_policy = (strcmp(conf->queue_full_policy, QUEUE_POLICY_BUSY) == 0);
+	if ((!busy_policy) && (strcmp(conf->queue_full_policy, QUEUE_POLICY_THROTTLE) != 0))
+		fprintf(stderr, STRING_BAD_QUEUE_POLICY, conf->queue_full_policy);
+
+	reactors = calloc(tot_reactors, sizeof(reactor_t));
+	if (!reactors)
+	{
+		fprintf(stderr, STRING_BAD_MALLOC);
+		return EXIT_FAILURE;
+	}
+
+	for (unsigned int i = 0; i < tot_reactors; i++)
+	{
+		reactor_t *r = &(reactors[i]);
+		char reactor_id[reactor_id_dim];
+
+		r->id = i;
+		r->loop = ev_create(conf->event_backend);
+		if (!r->loop)
+			return EXIT_FAILURE;
+		if (pipe(r->pipe_fd) != 0)
+			return EXIT_FAILURE;
+		/* la lettura non deve bloccare il reactor, la scrittura del core sì */
+		fcntl(r->pipe_fd[0], F_SETFL, fcntl(r->pipe_fd[0], F_GETFL) | O_NONBLOCK);
+		if (ev_add(r->loop, r->pipe_fd[0]) != 0)
+			return EXIT_FAILURE;
+		clock_gettime(CLOCK_MONOTONIC, &(r->last_print));
+
+		if (pthread_create(&(r->tid), NULL, &reactor_routine, (void *)r) != 0)
+			handle_error(STRING_HANDLE_BAD_THREAD_CREATION);
+		r->active = 1;
+		snprintf(reactor_id, sizeof(reactor_id), REACTOR_NAME "%d", i);
+		pthread_setname_np(r->tid, reactor_id); /* utile per il debug */
+	}
+
+	return EXIT_SUCCESS;
+}
+
+int reactor_assign(int fd)
+{
+	reactor_t *r = &(reactors[0]);
+
+	/* scelgo il reactor con meno connessioni */
+	for (unsigned int i = 1; i < tot_reactors; i++)
+		if (__atomic_load_n(&(reactors[i].connections), __ATOMIC_RELAXED) <
+			 __atomic_load_n(&(r->connections), __ATOMIC_RELAXED))
+			r = &(reactors[i]);
+
+	session_t *client = session_get(fd);
+	if (client)
+		client->reactor = r->id;
+
+	/* incremento subito in modo che accept consecutive vengano distribuite */
+	__atomic_add_fetch(&(r->connections), 1, __ATOMIC_RELAXED);
+	if (write(r->pipe_fd[1], &fd, sizeof(int)) != sizeof(int))
+	{
+		__atomic_sub_fetch(&(r->connections), 1, __ATOMIC_RELAXED);
+		return -1;
+	}
+
+	return 0;
+}
+
+void reactor_watch_write(int fd)
+{
+	session_t *client = session_get(fd);
+	int request = REACTOR_WATCH(fd);
+
+	if ((!client) || (!reactors))
+		return;
+
+	write(reactors[client->reactor].pipe_fd[1], &request, sizeof(int));
+}
+
+void reactors_stop()
+{
+	int stop = REACTOR_STOP;
+
+	if (!reactors)
+		return;
+
+	for (unsigned int i = 0; i < tot_reactors; i++)
+		if (reactors[i].active)
+			write(reactors[i].pipe_fd[1], &stop, sizeof(int));
+
+	for (unsigned int i = 0; i < tot_reactors; i++)
+	{
+		reactor_t *r = &(reactors[i]);
+		if (r->active)
+			pthread_join(r->tid, NULL);
+		if (r->loop)
+			ev_destroy(r->loop);
+		free(r->paused);
+		if (r->pipe_fd[0] > 0)
+		{
+			close(r->pipe_fd[0]);
+			close(r->pipe_fd[1]);
+		}
+	}
+
+	free(reactors);
+	reactors = NULL;
+	tot_reactors = 0;
+}
+
+void reactors_print_stats(FILE *fout)
+{
+	struct timespec now;
+
+	if (!reactors)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (unsigned int i = 0; i < tot_reactors; i++)
+	{
+		reactor_t *r = &(reactors[i]);
+		unsigned long events = __atomic_load_n(&(r->events), __ATOMIC_RELAXED);
+		double elapsed = (now.tv_sec - r->last_print.tv_sec) +
+							  (now.tv_nsec - r->last_print.tv_nsec) / 1e9;
+
+		fprintf(fout, STRING_LOG_REACTOR_STATS, i,
+				  __atomic_load_n(&(r->connections), __ATOMIC_RELAXED),
+				  (elapsed > 0) ? (events - r->last_events) / elapsed : 0.0,
+				  events, __atomic_load_n(&(r->pauses), __ATOMIC_RELAXED),
+				  __atomic_load_n(&(r->rejected), __ATOMIC_RELAXED));
+
+		r->last_events = events;
+		r->last_print = now;
+	}
+	fflush(fout);
+}
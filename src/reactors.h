@@ -0,0 +1,65 @@
+/**
+ * @brief il seguente file contiene le dichiarazioni dei thread reactor:
+ * 		ognuno possiede un proprio ciclo di eventi e si occupa della
+ * 		lettura dei messaggi di un sottoinsieme delle connessioni, che gli
+ * 		vengono assegnate dal core al momento della accept
+ *
+ * @file reactors.h
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-07
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+#ifndef _REACTORS_H_
+#define _REACTORS_H_
+
+#include <stdio.h>
+
+#include "utils.h"
+
+#define REACTOR_NAME "REACTOR"
+
+/**
+ * @brief crea ed avvia i thread reactor (conf->io_threads)
+ *
+ * @param conf struttura di configurazione
+ * @return int EXIT_SUCCESS | EXIT_FAILURE
+ */
+int reactors_init(conf_param *conf);
+
+/**
+ * @brief assegna la nuova connessione "fd" al reactor con meno connessioni
+ * @warning lo stato della connessione (session_open) deve essere già
+ * 			stato inizializzato
+ *
+ * @param fd descrittore del client appena accettato
+ * @return int 0 se ok, -1 altrimenti (errno settato)
+ */
+int reactor_assign(int fd);
+
+/**
+ * @brief chiede al reactor proprietario di "fd" di inviare la coda in
+ * 		uscita della connessione quando il descrittore torna scrivibile
+ * 		(vedi session_flush)
+ *
+ * @param fd descrittore del client
+ */
+void reactor_watch_write(int fd);
+
+/**
+ * @brief termina i thread reactor e ne attende la chiusura
+ * @warning non chiude i descrittori dei client (si veda sessions_destroy)
+ *
+ */
+void reactors_stop();
+
+/**
+ * @brief stampa per ogni reactor il numero di connessioni gestite e gli
+ * 		eventi al secondo dall'ultima stampa
+ *
+ * @param fout file di destinazione
+ */
+void reactors_print_stats(FILE *fout);
+
+#endif
@@ -0,0 +1,666 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+/**
+ * @brief il seguente file contiene l'implementazione della tabella delle
+ * 		connessioni: un vettore indicizzato per descrittore allocato una
+ * 		sola volta all'avvio (non viene mai riallocato, quindi i puntatori
+ * 		restituiti restano validi fino alla terminazione del server) e
+ * 		delle code in uscita di ogni connessione
+ *
+ * @file sessions.c
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-05
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/socket.h>
+
+#include "sessions.h"
+#include "reactors.h"
+#include "utils.h"
+
+/* parti di ogni messaggio inviate da session_submit */
+#define SEND_HEADER 1 /* solo l'header (ack) */
+#define SEND_FILE 2	 /* header e header dati, il contenuto è in un file */
+#define SEND_FRAME 3	 /* header, header dati e buffer */
+
+static session_t **sessions = NULL;
+static int sessions_dim = 0;
+
+static size_t max_output_size = 0; /* byte massimi in memoria per connessione */
+static int close_when_full = 0;	  /* 1 con OUTPUT_POLICY_CLOSE */
+
+/**
+ * @brief invio trattenuto da un thread tra session_hold_begin e
+ * 		session_hold_end
+ *
+ */
+typedef struct held_send
+{
+	int fd;
+	unsigned long generation; /* connessione a cui era destinato */
+	size_t size;				  /* byte in memoria (riservati in held_size) */
+	int kind;					  /* categoria (session_hold_count), -1 se nessuna */
+	struct out_queue out;	  /* copia dei messaggi (ed eventuale file) */
+	STAILQ_ENTRY(held_send)
+	next_held;
+} held_send;
+
+static __thread int holding = 0;
+static __thread STAILQ_HEAD(held_queue, held_send) held;
+static __thread held_send *last_held = NULL;
+
+/**
+ * @brief restituisce la struttura associata a "fd" anche se la connessione
+ * 		è già stata chiusa
+ *
+ */
+static session_t *session_slot(int fd)
+{
+	if ((fd < 0) || (fd >= sessions_dim))
+		return NULL;
+
+	return sessions[fd];
+}
+
+static out_msg *new_out_file(int file_fd, size_t len, size_t sent)
+{
+	out_msg *o = safe_malloc(sizeof(out_msg));
+
+	o->kind = OUT_FILE;
+	o->buf = NULL;
+	o->len = len;
+	o->sent = sent;
+	o->file_fd = file_fd;
+
+	return o;
+}
+
+static void free_out(out_msg *o)
+{
+	if (o->buf)
+		free(o->buf);
+	if (o->kind == OUT_FILE)
+		close(o->file_fd);
+	free(o);
+}
+
+/**
+ * @return size_t byte in memoria liberati
+ */
+static size_t free_out_queue(struct out_queue *queue)
+{
+	size_t freed = 0;
+
+	while (!STAILQ_EMPTY(queue))
+	{
+		out_msg *o = STAILQ_FIRST(queue);
+		STAILQ_REMOVE_HEAD(queue, next_out);
+		if (o->kind == OUT_BYTES)
+			freed += o->len;
+		free_out(o);
+	}
+
+	return freed;
+}
+
+int sessions_init(size_t max_output, const char *full_policy, unsigned int max_connections)
+{
+	if ((sessions_dim = fd_table_dim(max_connections)) < 0)
+		return EXIT_FAILURE;
+
+	max_output_size = max_output;
+	close_when_full = (strcmp(full_policy, OUTPUT_POLICY_CLOSE) == 0);
+	if ((!close_when_full) && (strcmp(full_policy, OUTPUT_POLICY_DROP) != 0))
+		fprintf(stderr, STRING_BAD_OUTPUT_POLICY, full_policy);
+
+	sessions = calloc(sessions_dim, sizeof(session_t *));
+	if (!sessions)
+	{
+		fprintf(stderr, STRING_BAD_MALLOC);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+session_t *session_open(int fd, unsigned int max_msg, unsigned int max_file, const char *spool_dir)
+{
+	if ((fd < 0) || (fd >= sessions_dim))
+		return NULL;
+
+	/* la struttura viene allocata alla prima connessione su questo descrittore */
+	if (!sessions[fd])
+	{
+		sessions[fd] = safe_malloc(sizeof(session_t));
+		memset(sessions[fd], 0, sizeof(session_t));
+		pthread_mutex_init(&(sessions[fd]->out_lock), NULL);
+		STAILQ_INIT(&(sessions[fd]->out));
+	}
+
+	session_t *s = sessions[fd];
+	s->fd = fd;
+	initFrame(&(s->rx), max_msg, max_file, spool_dir);
+
+	pthread_mutex_lock(&(s->out_lock));
+	s->out_size = 0;
+	s->held_size = 0;
+	s->out_waiting = 0;
+	s->out_error = 0;
+	s->out_close = 0;
+	s->out_armed = 0;
+	s->rx_paused = 0;
+	s->generation++;
+	s->in_use = 1;
+	pthread_mutex_unlock(&(s->out_lock));
+
+	return s;
+}
+
+session_t *session_get(int fd)
+{
+	if ((fd < 0) || (fd >= sessions_dim) || (!sessions[fd]) || (!sessions[fd]->in_use))
+		return NULL;
+
+	return sessions[fd];
+}
+
+void session_close(int fd)
+{
+	session_t *s = session_get(fd);
+	if (!s)
+		return;
+
+	resetFrame(&(s->rx));
+
+	pthread_mutex_lock(&(s->out_lock));
+	s->in_use = 0;
+	pthread_mutex_unlock(&(s->out_lock));
+}
+
+/**
+ * @brief byte di "n" messaggi serializzati limitandosi alle prime "parts"
+ * 		parti (header, header dati, buffer)
+ *
+ */
+static size_t frames_size(message_t *msgs, int n, int parts)
+{
+	size_t size = 0;
+
+	for (int i = 0; i < n; i++)
+	{
+		size += sizeof(message_hdr_t);
+		if (parts >= SEND_FILE)
+			size += sizeof(message_data_hdr_t);
+		if (parts == SEND_FRAME)
+			size += msgs[i].data.hdr.len;
+	}
+
+	return size;
+}
+
+/**
+ * @brief copia in un unico buffer i messaggi serializzati, esclusi i
+ * 		primi "skip" byte (già inviati)
+ *
+ */
+static out_msg *frames_copy(message_t *msgs, int n, int parts, size_t skip)
+{
+	out_msg *o = safe_malloc(sizeof(out_msg));
+	size_t used = 0;
+
+	o->kind = OUT_BYTES;
+	o->len = frames_size(msgs, n, parts) - skip;
+	o->buf = safe_malloc(o->len);
+	o->sent = 0;
+	o->file_fd = -1;
+
+	for (int i = 0; i < n; i++)
+	{
+		const char *part[SEND_FRAME] = {(char *)&(msgs[i].hdr), (char *)&(msgs[i].data.hdr), msgs[i].data.buf};
+		size_t part_len[SEND_FRAME] = {sizeof(message_hdr_t), sizeof(message_data_hdr_t), msgs[i].data.hdr.len};
+
+		for (int j = 0; j < parts; j++)
+		{
+			if (skip >= part_len[j])
+			{
+				skip -= part_len[j];
+				continue;
+			}
+			memcpy(o->buf + used, part[j] + skip, part_len[j] - skip);
+			used += part_len[j] - skip;
+			skip = 0;
+		}
+	}
+
+	return o;
+}
+
+/**
+ * @brief scrive in ordine gli invii di "pending" finché la socket li
+ * 		accetta, liberando quelli completati: i buffer consecutivi vengono
+ * 		inviati con una sola writev
+ *
+ * @param fd descrittore
+ * @param pending invii da scrivere, restano quelli non completati se la
+ * 			socket è piena
+ * @param freed byte in memoria liberati
+ * @return int 0 se ok, -1 se una scrittura è fallita
+ */
+static int write_out(int fd, struct out_queue *pending, size_t *freed)
+{
+	struct iovec iov[IOV_MAX];
+
+	while (!STAILQ_EMPTY(pending))
+	{
+		out_msg *first = STAILQ_FIRST(pending);
+		size_t expected = 0;
+		ssize_t written;
+
+		if (first->kind == OUT_FILE)
+		{
+			off_t offset = first->sent;
+			expected = first->len - first->sent;
+			written = trySendFile(fd, first->file_fd, &offset, expected);
+		}
+		else
+		{
+			int iovcnt = 0;
+			for (out_msg *o = first; (o) && (o->kind == OUT_BYTES) && (iovcnt < IOV_MAX); o = STAILQ_NEXT(o, next_out))
+			{
+				iov[iovcnt].iov_base = o->buf + o->sent;
+				iov[iovcnt++].iov_len = o->len - o->sent;
+				expected += o->len - o->sent;
+			}
+			written = trySendv(fd, iov, iovcnt);
+		}
+
+		if (written < 0)
+			return -1;
+
+		/* libero gli invii completati e avanzo quello interrotto */
+		size_t left = written;
+		while (!STAILQ_EMPTY(pending))
+		{
+			out_msg *o = STAILQ_FIRST(pending);
+			if (left < o->len - o->sent)
+			{
+				o->sent += left;
+				break;
+			}
+			left -= o->len - o->sent;
+			STAILQ_REMOVE_HEAD(pending, next_out);
+			if (o->kind == OUT_BYTES)
+				*freed += o->len;
+			free_out(o);
+		}
+
+		/* socket piena */
+		if ((size_t)written < expected)
+			return 0;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief da richiamare con out_lock acquisito dal thread che sta scrivendo
+ * 		su "s": scrive quanto accodato nel frattempo dagli altri thread
+ * 		finché la socket lo accetta e libera la connessione
+ *
+ * @param s connessione
+ * @param pending byte che il chiamante non è riuscito a scrivere
+ * @return int 1 se la socket è piena (la coda verrà svuotata dal reactor
+ * 			dopo reactor_watch_write), 0 altrimenti
+ */
+static int drain_out(session_t *s, struct out_queue *pending)
+{
+	int full = 0;
+
+	for (;;)
+	{
+		/* connessione chiusa o in errore: gli invii vengono scartati */
+		if ((s->out_error) || (s->out_close))
+		{
+			s->out_size -= free_out_queue(pending);
+			s->out_size -= free_out_queue(&(s->out));
+			break;
+		}
+		/* i byte rimasti precedono quanto accodato nel frattempo */
+		if (!STAILQ_EMPTY(pending))
+		{
+			STAILQ_CONCAT(pending, &(s->out));
+			STAILQ_CONCAT(&(s->out), pending);
+			s->out_waiting = 1;
+			full = 1;
+			break;
+		}
+		if (STAILQ_EMPTY(&(s->out)))
+			break;
+
+		/* prelevo l'intera coda: gli altri thread possono continuare ad
+			accodare mentre scrivo */
+		size_t freed = 0;
+		STAILQ_CONCAT(pending, &(s->out));
+		pthread_mutex_unlock(&(s->out_lock));
+
+		int ret_value = write_out(s->fd, pending, &freed);
+
+		pthread_mutex_lock(&(s->out_lock));
+		s->out_size -= freed;
+		if (ret_value < 0)
+			s->out_error = 1;
+	}
+
+	s->out_draining = 0;
+	if (s->out_close)
+	{
+		s->out_close = 0;
+		close(s->fd);
+	}
+
+	return full;
+}
+
+/**
+ * @brief coda in uscita piena: applica la politica configurata
+ * 		(da richiamare con out_lock acquisito)
+ *
+ * @return int SEND_DROPPED | -1 se la connessione viene chiusa
+ */
+static int output_full(session_t *s)
+{
+	if (!close_when_full)
+		return SEND_DROPPED;
+
+	/* il reactor riceverà la chiusura e disconnetterà il client */
+	shutdown(s->fd, SHUT_RDWR);
+	s->out_error = 1;
+	s->out_size -= free_out_queue(&(s->out));
+
+	return -1;
+}
+
+/**
+ * @brief accoda a "queue" una copia degli invii
+ *
+ * @param file_fd file da inviare (SEND_FILE), ne diventa proprietaria la
+ * 			coda (viene impostato a -1)
+ * @return size_t byte in memoria accodati
+ */
+static size_t queue_copy(struct out_queue *queue, int parts, message_t *msgs, int n, int *file_fd)
+{
+	out_msg *o = frames_copy(msgs, n, parts, 0);
+	size_t size = o->len;
+
+	STAILQ_INSERT_TAIL(queue, o, next_out);
+	if (parts == SEND_FILE)
+	{
+		o = new_out_file(*file_fd, msgs->data.hdr.len, 0);
+		STAILQ_INSERT_TAIL(queue, o, next_out);
+		*file_fd = -1;
+	}
+
+	return size;
+}
+
+/**
+ * @brief scrive direttamente (se la connessione è libera) o accoda una
+ * 		copia degli invii
+ *
+ * @param fd descrittore
+ * @param parts SEND_HEADER | SEND_FILE | SEND_FRAME
+ * @param msgs messaggi da inviare
+ * @param n numero di messaggi
+ * @param file_fd file da inviare (SEND_FILE), ne diventa proprietaria
+ */
+static int session_submit(int fd, int parts, message_t *msgs, int n, int file_fd)
+{
+	session_t *s = session_slot(fd);
+	struct out_queue pending = STAILQ_HEAD_INITIALIZER(pending);
+	size_t size = frames_size(msgs, n, parts);
+	int ret_value = SEND_DONE;
+
+	if (!s)
+	{
+		if (file_fd != -1)
+			close(file_fd);
+		return -1;
+	}
+
+	pthread_mutex_lock(&(s->out_lock));
+	if ((!s->in_use) || (s->out_error) || (s->out_close))
+	{
+		pthread_mutex_unlock(&(s->out_lock));
+		if (file_fd != -1)
+			close(file_fd);
+		return -1;
+	}
+
+	/* la connessione è occupata o gli invii del thread sono trattenuti:
+		accodo una copia degli invii, se c'è spazio */
+	if ((holding) || (s->out_draining) || (s->out_waiting) || (!STAILQ_EMPTY(&(s->out))))
+	{
+		/* anche i byte trattenuti dagli slave occupano la coda */
+		size_t queued = s->out_size + s->held_size;
+		if ((queued > 0) && (queued + size > max_output_size))
+			ret_value = output_full(s);
+		else if (holding)
+		{
+			held_send *h = safe_malloc(sizeof(held_send));
+			h->fd = fd;
+			h->generation = s->generation;
+			h->kind = -1;
+			STAILQ_INIT(&(h->out));
+			h->size = queue_copy(&(h->out), parts, msgs, n, &file_fd);
+			s->held_size += h->size;
+			STAILQ_INSERT_TAIL(&held, h, next_held);
+			last_held = h;
+			ret_value = SEND_HELD;
+		}
+		else
+			s->out_size += queue_copy(&(s->out), parts, msgs, n, &file_fd);
+		pthread_mutex_unlock(&(s->out_lock));
+
+		if (file_fd != -1)
+			close(file_fd);
+		return ret_value;
+	}
+
+	s->out_draining = 1;
+	pthread_mutex_unlock(&(s->out_lock));
+
+	/* connessione libera: scrivo senza copie finché la socket lo accetta */
+	ssize_t sent;
+	off_t offset = 0;
+	if (parts == SEND_FRAME)
+		sent = trySendRequests(fd, msgs, n);
+	else
+	{
+		struct iovec iov[SEND_FILE] = {{&(msgs->hdr), sizeof(message_hdr_t)},
+												 {&(msgs->data.hdr), sizeof(message_data_hdr_t)}};
+		sent = trySendv(fd, iov, parts);
+		if ((parts == SEND_FILE) && (sent == (ssize_t)size) &&
+			 (trySendFile(fd, file_fd, &offset, msgs->data.hdr.len) < 0))
+			sent = -1;
+	}
+
+	/* conservo quanto la socket non ha accettato */
+	size_t leftover = 0;
+	if ((sent >= 0) && ((size_t)sent < size))
+	{
+		out_msg *o = frames_copy(msgs, n, parts, sent);
+		STAILQ_INSERT_TAIL(&pending, o, next_out);
+		leftover = o->len;
+	}
+	if (parts == SEND_FILE)
+	{
+		if ((sent >= 0) && (offset < msgs->data.hdr.len))
+		{
+			out_msg *o = new_out_file(file_fd, msgs->data.hdr.len, offset);
+			STAILQ_INSERT_TAIL(&pending, o, next_out);
+		}
+		else
+			close(file_fd);
+	}
+
+	pthread_mutex_lock(&(s->out_lock));
+	s->out_size += leftover;
+	if (sent < 0)
+		s->out_error = 1;
+	int full = drain_out(s, &pending);
+	pthread_mutex_unlock(&(s->out_lock));
+
+	if (full)
+		reactor_watch_write(fd);
+
+	return (sent < 0) ? -1 : SEND_DONE;
+}
+
+int session_send(int fd, message_t *msgs, int n)
+{
+	return session_submit(fd, SEND_FRAME, msgs, n, -1);
+}
+
+int session_send_header(int fd, message_hdr_t *hdr)
+{
+	message_t msg;
+
+	memset(&msg, 0, sizeof(message_t));
+	msg.hdr = *hdr;
+
+	return session_submit(fd, SEND_HEADER, &msg, 1, -1);
+}
+
+int session_send_file(int fd, message_t *msg, int file_fd)
+{
+	return session_submit(fd, SEND_FILE, msg, 1, file_fd);
+}
+
+void session_hold_begin()
+{
+	if (!holding)
+		STAILQ_INIT(&held);
+	holding = 1;
+}
+
+void session_hold_count(int kind)
+{
+	if (last_held)
+		last_held->kind = kind;
+}
+
+void session_hold_end(int *discarded)
+{
+	holding = 0;
+	last_held = NULL;
+
+	while (!STAILQ_EMPTY(&held))
+	{
+		held_send *h = STAILQ_FIRST(&held);
+		session_t *s = session_slot(h->fd);
+		struct out_queue pending = STAILQ_HEAD_INITIALIZER(pending);
+		int full = 0;
+
+		STAILQ_REMOVE_HEAD(&held, next_held);
+
+		pthread_mutex_lock(&(s->out_lock));
+		/* la riserva appartiene alla connessione a cui era destinato l'invio
+			(session_open la azzera) */
+		if (s->generation == h->generation)
+			s->held_size -= h->size;
+		if ((!s->in_use) || (s->generation != h->generation) || (s->out_error) || (s->out_close))
+		{
+			free_out_queue(&(h->out));
+			if ((discarded) && (h->kind >= 0))
+				discarded[h->kind]++;
+		}
+		else
+		{
+			/* i byte riservati all'invio passano alla coda */
+			STAILQ_CONCAT(&(s->out), &(h->out));
+			s->out_size += h->size;
+			if ((!s->out_draining) && (!s->out_waiting))
+			{
+				s->out_draining = 1;
+				full = drain_out(s, &pending);
+			}
+		}
+		pthread_mutex_unlock(&(s->out_lock));
+
+		if (full)
+			reactor_watch_write(h->fd);
+		free(h);
+	}
+}
+
+int session_flush(int fd)
+{
+	struct out_queue pending = STAILQ_HEAD_INITIALIZER(pending);
+	session_t *s = session_get(fd);
+	if (!s)
+		return 0;
+
+	pthread_mutex_lock(&(s->out_lock));
+	if (!s->out_waiting)
+	{
+		pthread_mutex_unlock(&(s->out_lock));
+		return 0;
+	}
+	s->out_waiting = 0;
+	s->out_draining = 1;
+	int full = drain_out(s, &pending);
+	pthread_mutex_unlock(&(s->out_lock));
+
+	return full;
+}
+
+void session_release(int fd)
+{
+	session_t *s = session_slot(fd);
+	if (!s)
+	{
+		close(fd);
+		return;
+	}
+
+	pthread_mutex_lock(&(s->out_lock));
+	s->out_size -= free_out_queue(&(s->out));
+	s->out_waiting = 0;
+	/* il descrittore non può essere riutilizzato finché è in scrittura */
+	if (s->out_draining)
+		s->out_close = 1;
+	else
+		close(fd);
+	pthread_mutex_unlock(&(s->out_lock));
+}
+
+void sessions_destroy()
+{
+	if (!sessions)
+		return;
+
+	for (int i = 0; i < sessions_dim; i++)
+		if (sessions[i])
+		{
+			if (sessions[i]->in_use)
+			{
+				resetFrame(&(sessions[i]->rx));
+				close(i);
+			}
+			free_out_queue(&(sessions[i]->out));
+			pthread_mutex_destroy(&(sessions[i]->out_lock));
+			free(sessions[i]);
+		}
+
+	free(sessions);
+	sessions = NULL;
+	sessions_dim = 0;
+}
@@ -0,0 +1,222 @@
+/**
+ * @brief il seguente file contiene le dichiarazioni delle strutture che
+ * 		mantengono lo stato lato server di ogni connessione client,
+ * 		indicizzate per descrittore
+ *
+ * @file sessions.h
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-05
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+#ifndef _SESSIONS_H_
+#define _SESSIONS_H_
+
+#include <pthread.h>
+#include <sys/queue.h>
+
+#include "connections.h"
+
+/* politiche quando la coda in uscita di una connessione è piena */
+#define OUTPUT_POLICY_DROP "drop"	/* il messaggio viene scartato (non consegnato) */
+#define OUTPUT_POLICY_CLOSE "close" /* la connessione viene chiusa */
+
+/* esito di un invio */
+#define SEND_DONE 1		/* inviato o accodato */
+#define SEND_DROPPED 0 /* scartato: coda in uscita piena */
+#define SEND_HELD 2		/* trattenuto: l'esito è deciso da session_hold_end */
+
+/**
+ * @brief tipo di un invio in attesa nella coda in uscita
+ *
+ */
+typedef enum _out_kind
+{
+	OUT_BYTES, /**< byte serializzati di uno o più messaggi */
+	OUT_FILE,  /**< contenuto del file out_msg.file_fd */
+} out_kind;
+
+/**
+ * @brief invio in attesa: i byte (o il file) appartengono alla coda
+ *
+ */
+typedef struct out_msg
+{
+	out_kind kind;
+	char *buf;	  /**< byte da inviare (OUT_BYTES) */
+	size_t len;	  /**< dimensione del buffer o del file */
+	size_t sent;  /**< byte già inviati */
+	int file_fd; /**< file da inviare (OUT_FILE) */
+	STAILQ_ENTRY(out_msg)
+	next_out;
+} out_msg;
+
+/**
+ * @brief stato di una connessione
+ * @warning la struttura associata ad un descrittore non viene mai liberata
+ * 			prima della terminazione del server: alla chiusura viene
+ * 			solamente marcata come non in uso e riutilizzata dalla
+ * 			connessione successiva che ottiene lo stesso descrittore
+ *
+ */
+typedef struct session
+{
+	int fd;
+	int in_use;	/**< 1 se la connessione è aperta */
+	rx_frame rx; /**< stato della ricezione del messaggio corrente */
+
+	/* coda in uscita: qualsiasi thread accoda, un solo thread alla volta
+		(quello che la trova libera) scrive sul descrittore senza bloccarsi;
+		se la socket è piena la coda viene svuotata dal reactor quando il
+		descrittore torna scrivibile */
+	pthread_mutex_t out_lock;
+	STAILQ_HEAD(out_queue, out_msg)
+	out;
+	size_t out_size;		/**< byte in memoria nella coda (limitati da MaxOutputSize) */
+	size_t held_size;		/**< byte trattenuti dagli slave (session_hold_begin), già ammessi */
+	int out_draining;		/**< 1 se un thread sta scrivendo sulla connessione */
+	int out_waiting;		/**< 1 se la socket è piena: si attende il reactor */
+	int out_error;			/**< la scrittura è fallita: gli invii successivi sono scartati */
+	int out_close;			/**< il descrittore va chiuso al termine della scrittura */
+	int out_armed;			/**< notifica di scrittura attiva (solo reactor proprietario) */
+	int rx_paused;			/**< lettura sospesa per sovraccarico (solo reactor proprietario) */
+	unsigned int reactor; /**< reactor proprietario della connessione */
+	unsigned long generation; /**< incrementato ad ogni nuova connessione sul descrittore */
+} session_t;
+
+/**
+ * @brief alloca la tabella delle connessioni, dimensionata con fd_table_dim
+ *
+ * @param max_output byte massimi in attesa nella coda in uscita di una
+ * 			connessione (un messaggio viene sempre accettato a coda vuota)
+ * @param full_policy OUTPUT_POLICY_DROP | OUTPUT_POLICY_CLOSE
+ * @param max_connections MaxConnections
+ * @return int EXIT_SUCCESS | EXIT_FAILURE
+ */
+int sessions_init(size_t max_output, const char *full_policy, unsigned int max_connections);
+
+/**
+ * @brief inizializza lo stato della nuova connessione "fd"
+ *
+ * @param fd descrittore
+ * @param max_msg dimensione massima di un messaggio testuale
+ * @param max_file dimensione massima di un file in byte
+ * @param spool_dir cartella dove salvare i file in ricezione
+ * @return session_t* la connessione | NULL se fd fuori dalla tabella
+ */
+session_t *session_open(int fd, unsigned int max_msg, unsigned int max_file, const char *spool_dir);
+
+/**
+ * @brief restituisce lo stato della connessione "fd"
+ *
+ * @param fd descrittore
+ * @return session_t* la connessione | NULL se non è aperta
+ */
+session_t *session_get(int fd);
+
+/**
+ * @brief marca la connessione "fd" come chiusa e libera l'eventuale
+ * 		messaggio parzialmente ricevuto
+ * @warning non chiude il descrittore
+ *
+ * @param fd descrittore
+ */
+void session_close(int fd);
+
+/**
+ * @brief invia in ordine "n" messaggi sulla connessione "fd" senza mai
+ * 		bloccarsi: se nessun altro thread sta scrivendo su "fd" il chiamante
+ * 		scrive direttamente (anche quanto accodato nel frattempo dagli
+ * 		altri), altrimenti i messaggi vengono copiati in coda e inviati da
+ * 		quel thread; i byte che la socket non accetta restano in coda
+ * @note l'ordine degli invii sulla stessa connessione è quello delle
+ * 		chiamate, senza alcun lock globale
+ *
+ * @param fd descrittore
+ * @param msgs messaggi da inviare
+ * @param n numero di messaggi
+ * @return int SEND_DONE se inviati o accodati, SEND_HELD se trattenuti
+ * 			(session_hold_begin), SEND_DROPPED se la coda è piena, <0 se la
+ * 			connessione è chiusa o in errore
+ */
+int session_send(int fd, message_t *msgs, int n);
+
+/**
+ * @brief come session_send, invia solo l'header "hdr" (ack)
+ *
+ * @param fd descrittore
+ * @param hdr header da inviare
+ * @return int come session_send
+ */
+int session_send_header(int fd, message_hdr_t *hdr);
+
+/**
+ * @brief come session_send, invia "msg" con il contenuto del file
+ * 		"file_fd" (vedi trySendFile)
+ * @warning la coda diventa proprietaria di "file_fd" e lo chiude
+ *
+ * @param fd descrittore
+ * @param msg header del messaggio (data.hdr.len dimensione del file)
+ * @param file_fd file da inviare
+ * @return int come session_send
+ */
+int session_send_file(int fd, message_t *msg, int file_fd);
+
+/**
+ * @brief da questo momento gli invii del thread chiamante vengono
+ * 		trattenuti (copiati) fino a session_hold_end: l'ammissione nella
+ * 		coda in uscita è decisa subito (SEND_HELD, SEND_DROPPED) e i byte
+ * 		trattenuti restano riservati nel limite MaxOutputSize
+ *
+ */
+void session_hold_begin();
+
+/**
+ * @brief assegna la categoria "kind" all'ultimo invio trattenuto dal
+ * 		thread chiamante (SEND_HELD), per conoscerne l'esito in
+ * 		session_hold_end
+ *
+ * @param kind indice in "discarded" di session_hold_end
+ */
+void session_hold_count(int kind);
+
+/**
+ * @brief esegue, nell'ordine delle chiamate, gli invii trattenuti dal
+ * 		thread chiamante: quelli verso connessioni chiuse o in errore nel
+ * 		frattempo vengono scartati
+ *
+ * @param discarded incrementato in posizione "kind" per ogni invio
+ * 			scartato a cui è stata assegnata una categoria
+ * 			(session_hold_count), può essere NULL
+ */
+void session_hold_end(int *discarded);
+
+/**
+ * @brief da richiamare dal reactor proprietario quando "fd" è scrivibile:
+ * 		invia quanto rimasto in coda
+ *
+ * @param fd descrittore
+ * @return int 1 se restano byte in coda (socket di nuovo piena), 0 se la
+ * 			coda è vuota
+ */
+int session_flush(int fd);
+
+/**
+ * @brief chiude il descrittore "fd" di una connessione terminata: se un
+ * 		thread sta ancora scrivendo la chiusura viene eseguita da
+ * 		quest'ultimo al termine, gli invii in coda vengono scartati
+ *
+ * @param fd descrittore
+ */
+void session_release(int fd);
+
+/**
+ * @brief chiude i descrittori delle connessioni ancora aperte e libera
+ * 		la tabella
+ * @warning nessun thread deve più inviare sulle connessioni
+ *
+ */
+void sessions_destroy();
+
+#endif
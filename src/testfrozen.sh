@@ -0,0 +1,126 @@
+#! /bin/bash
+
+# test del lettore bloccato (OutputFullPolicy): un client connesso che non
+# legge più non deve fermare il server, i client attivi vengono serviti e
+# i messaggi per il client bloccato vengono scartati (drop) oppure la sua
+# connessione viene chiusa (close)
+#
+# autore: Marco Costa - 545144
+#
+# Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+# 	opera originale dell'autore
+
+# messaggio di uso
+function usage () {
+    echo "uso: $0 <unix_path> <stat_path> <dir_path> <drop|close> [clients]" 1>&2;
+}
+
+if [ $# -lt 4 ] || [ $# -gt 5 ]; then
+    usage
+    exit 1
+fi
+
+upath=$1
+spath=$2
+dpath=$3
+policy=$4
+clients=${5:-1000}
+
+if [ "$policy" != "drop" ] && [ "$policy" != "close" ]; then
+    usage
+    exit 1
+fi
+
+# configurazione del test: coda in uscita piccola, connessioni sufficienti
+# per tutti i client attivi
+conf=$(mktemp /tmp/chatty_frozen_XXXXXX.conf)
+cat > $conf <<EOF
+UnixPath = $upath
+MaxConnections = $((clients + 64))
+ThreadsInPool = 8
+MaxMsgSize = 512
+MaxFileSize = 1024
+MaxHistMsgs = 16
+DirName = $dpath
+StatFileName = $spath
+MaxOutputSize = 64
+OutputFullPolicy = $policy
+EOF
+
+function fail () {
+    echo "********** testfrozen ($policy) FALLITO: $1" 1>&2
+    [ -n "$frozen" ] && kill -9 $frozen 2> /dev/null
+    [ -n "$server" ] && kill -9 $server 2> /dev/null
+    rm -f $conf
+    exit 1
+}
+
+rm -f $upath
+./chatty -f $conf > /dev/null &
+server=$!
+for i in $(seq 50); do
+    [ -S $upath ] && break
+    sleep 0.1
+done
+[ -S $upath ] || fail "server non avviato"
+
+# registrazione degli utenti
+./client -l $upath -c frozen > /dev/null || fail "registrazione frozen"
+for ((i = 0; i < clients; i++)); do
+    ./client -l $upath -c c$i > /dev/null || fail "registrazione c$i"
+done
+
+# il lettore si connette e viene fermato: la sua socket non viene più letta
+./client -l $upath -k frozen -R 0 > /dev/null 2>&1 &
+frozen=$!
+sleep 0.5
+kill -STOP $frozen
+
+# client attivi in parallelo: ognuno invia due messaggi al lettore bloccato
+# e deve ricevere entrambe le risposte entro il timeout
+msg=$(head -c 400 /dev/zero | tr '\0' 'x')
+pids=()
+for ((i = 0; i < clients; i++)); do
+    timeout 30 ./client -l $upath -k c$i -S "$msg":frozen -S "$msg":frozen > /dev/null 2>&1 &
+    pids+=($!)
+done
+
+served=0
+for p in ${pids[@]}; do
+    wait $p && served=$((served + 1))
+done
+[ $served -eq $clients ] || fail "serviti $served client attivi su $clients"
+
+# statistiche: messaggi non consegnati (campo 6)
+kill -USR1 $server
+sleep 0.5
+notdelivered=$(tail -1 $spath | cut -d ' ' -f 6)
+
+kill -CONT $frozen
+if [ "$policy" == "drop" ]; then
+    # il lettore resta connesso, i messaggi in eccesso sono stati scartati
+    [ "$notdelivered" -gt 0 ] 2> /dev/null || fail "nessun messaggio scartato"
+    sleep 1
+    kill -0 $frozen 2> /dev/null || fail "lettore disconnesso con drop"
+    kill -9 $frozen
+else
+    # la connessione del lettore è stata chiusa: letti i messaggi accettati
+    # dalla socket il client termina con errore
+    for i in $(seq 100); do
+        kill -0 $frozen 2> /dev/null || break
+        sleep 0.1
+    done
+    kill -0 $frozen 2> /dev/null && fail "lettore ancora connesso con close"
+fi
+wait $frozen 2> /dev/null
+frozen=
+
+# il server è ancora attivo e risponde
+./client -l $upath -k c0 -p > /dev/null || fail "server non risponde"
+
+kill -QUIT $server
+wait $server
+rm -f $conf
+
+echo "********** testfrozen ($policy): $served client serviti, $notdelivered messaggi non consegnati"
+exit 0
@@ -0,0 +1,114 @@
+#! /bin/bash
+
+# test della modalità del journal (DBJournalMode): con il WAL attivo e non
+# attivo i messaggi confermati dal server devono sopravvivere sia ad un
+# riavvio regolare sia alla terminazione forzata del server
+# @warning il server deve essere compilato senza RESET_DB e
+# 			MAKE_VALGRIND_HAPPY (make all RESET_FLAGS=)
+#
+# autore: Marco Costa - 545144
+#
+# Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+# 	opera originale dell'autore
+
+# messaggio di uso
+function usage () {
+    echo "uso: $0 <unix_path> <stat_path> <dir_path> <db_name> <wal|memory>" 1>&2;
+}
+
+if [ $# -ne 5 ]; then
+    usage
+    exit 1
+fi
+
+upath=$1
+spath=$2
+dpath=$3
+dbname=$4
+mode=$5
+
+if [ "$mode" != "wal" ] && [ "$mode" != "memory" ]; then
+    usage
+    exit 1
+fi
+
+conf=$(mktemp /tmp/chatty_wal_XXXXXX.conf)
+cat > $conf <<EOF
+UnixPath = $upath
+MaxConnections = 32
+ThreadsInPool = 8
+MaxMsgSize = 512
+MaxFileSize = 1024
+MaxHistMsgs = 16
+DirName = $dpath
+StatFileName = $spath
+DBJournalMode = $mode
+EOF
+
+file=$(mktemp /tmp/chatty_wal_XXXXXX.bin)
+head -c 100000 /dev/urandom > $file
+
+function fail () {
+    echo "********** testwal ($mode) FALLITO: $1" 1>&2
+    [ -n "$server" ] && kill -9 $server 2> /dev/null
+    rm -f $conf $file
+    exit 1
+}
+
+function start () {
+    rm -f $upath
+    ./chatty -f $conf > /dev/null &
+    server=$!
+    for i in $(seq 50); do
+        [ -S $upath ] && return
+        sleep 0.1
+    done
+    fail "server non avviato"
+}
+
+# controlla che la history di "user" contenga tutti i messaggi inviati
+function check_history () {
+    out=$(./client -l $upath -k $1 -p 2>&1) || fail "history $1 ($2)"
+    for m in "primo messaggio" "secondo messaggio" "messaggio a tutti" "$(basename $file)"; do
+        echo "$out" | grep -q "$m" || fail "manca '$m' nella history di $1 ($2)"
+    done
+    echo "$out" | grep -q "scaricato correttamente" || fail "file non scaricabile ($2)"
+}
+
+# database vuoto
+rm -rf $dbname $dbname-wal $dbname-shm $dbname-journal $dpath
+mkdir -p $dpath
+
+start
+./client -l $upath -c pippo > /dev/null || fail "registrazione pippo"
+./client -l $upath -c pluto > /dev/null || fail "registrazione pluto"
+./client -l $upath -k pippo -S "primo messaggio":pluto -S "secondo messaggio":pluto \
+    -s $file:pluto -S "messaggio a tutti": > /dev/null || fail "invio messaggi"
+
+# il journal scelto è quello in uso
+if [ "$mode" == "wal" ]; then
+    [ -f $dbname-wal ] || fail "WAL non attivo"
+else
+    [ -f $dbname-wal ] && fail "WAL attivo"
+fi
+
+# riavvio regolare
+kill -QUIT $server
+wait $server
+start
+check_history pluto "riavvio"
+
+# terminazione forzata dopo nuovi messaggi confermati
+./client -l $upath -k pluto -S "dopo il riavvio":pippo > /dev/null || fail "invio dopo il riavvio"
+kill -9 $server
+wait $server 2> /dev/null
+start
+check_history pluto "terminazione forzata"
+./client -l $upath -k pippo -p 2>&1 | grep -q "dopo il riavvio" || fail "manca 'dopo il riavvio'"
+
+kill -QUIT $server
+wait $server
+rm -f $conf $file
+
+echo "********** testwal ($mode): messaggi presenti dopo i riavvii"
+exit 0
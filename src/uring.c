@@ -0,0 +1,298 @@
+#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
+
+/**
+ * @brief il seguente file contiene l'implementazione dell'interfaccia minima
+ * 		verso io_uring: mappatura delle code di sottomissione/completamento
+ * 		e sottomissione in blocco delle operazioni di invio (una sola
+ * 		syscall io_uring_enter per blocco)
+ *
+ * @file uring.c
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-10
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "uring.h"
+
+#ifdef IO_URING
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#include "utils.h"
+
+struct uring
+{
+	int ring_fd;
+	unsigned int entries;
+	unsigned int queued; /**< operazioni accodate e non ancora sottomesse */
+
+	/* coda di sottomissione */
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+
+	/* coda di completamento */
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* mappature da rilasciare */
+	void *sq_ptr;
+	size_t sq_size;
+	void *cq_ptr;
+	size_t cq_size;
+	size_t sqes_size;
+
+	char *buffer;
+	size_t buffer_size;
+};
+
+static int sys_io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+uring_t *uring_init(unsigned int entries, size_t buf_size)
+{
+	struct io_uring_params p;
+	uring_t *r = safe_malloc(sizeof(uring_t));
+
+	memset(r, 0, sizeof(uring_t));
+	memset(&p, 0, sizeof(p));
+
+	r->ring_fd = sys_io_uring_setup(entries, &p);
+	if (r->ring_fd < 0)
+	{
+		free(r);
+		return NULL;
+	}
+	r->entries = p.sq_entries;
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	/* con IORING_FEAT_SINGLE_MMAP le due code condividono la stessa mappatura */
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (r->cq_size > r->sq_size)
+			r->sq_size = r->cq_size;
+		r->cq_size = 0;
+	}
+
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+						  r->ring_fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED)
+		goto error;
+
+	if (r->cq_size == 0)
+		r->cq_ptr = r->sq_ptr;
+	else
+	{
+		r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+							  r->ring_fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED)
+		{
+			munmap(r->sq_ptr, r->sq_size);
+			goto error;
+		}
+	}
+
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+						r->ring_fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+	{
+		munmap(r->sq_ptr, r->sq_size);
+		if (r->cq_size)
+			munmap(r->cq_ptr, r->cq_size);
+		goto error;
+	}
+
+	r->sq_head = (unsigned int *)((char *)r->sq_ptr + p.sq_off.head);
+	r->sq_tail = (unsigned int *)((char *)r->sq_ptr + p.sq_off.tail);
+	r->sq_mask = (unsigned int *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+	r->sq_array = (unsigned int *)((char *)r->sq_ptr + p.sq_off.array);
+	r->cq_head = (unsigned int *)((char *)r->cq_ptr + p.cq_off.head);
+	r->cq_tail = (unsigned int *)((char *)r->cq_ptr + p.cq_off.tail);
+	r->cq_mask = (unsigned int *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+
+	r->buffer_size = buf_size;
+	r->buffer = safe_malloc(buf_size);
+
+	return r;
+
+error:
+	close(r->ring_fd);
+	free(r);
+	return NULL;
+}
+
+void uring_destroy(uring_t *r)
+{
+	if (!r)
+		return;
+
+	munmap(r->sqes, r->sqes_size);
+	munmap(r->sq_ptr, r->sq_size);
+	if (r->cq_size)
+		munmap(r->cq_ptr, r->cq_size);
+	close(r->ring_fd);
+	free(r->buffer);
+	free(r);
+}
+
+unsigned int uring_entries(uring_t *r)
+{
+	return r->entries;
+}
+
+char *uring_buffer(uring_t *r)
+{
+	return r->buffer;
+}
+
+size_t uring_buffer_size(uring_t *r)
+{
+	return r->buffer_size;
+}
+
+int uring_prep_sendmsg(uring_t *r, int fd, const struct msghdr *msg, uint64_t user_data)
+{
+	if (r->queued == r->entries)
+		return -1;
+
+	unsigned int tail = *(r->sq_tail) + r->queued;
+	unsigned int index = tail & *(r->sq_mask);
+	struct io_uring_sqe *sqe = &(r->sqes[index]);
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)msg;
+	sqe->len = 1;
+	sqe->user_data = user_data;
+	/* l'operazione non deve mai attendere che la socket si svuoti: con la
+		socket piena termina con -EAGAIN o con un invio parziale */
+	sqe->msg_flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+
+	r->sq_array[index] = index;
+	r->queued++;
+
+	return 0;
+}
+
+int uring_submit_wait(uring_t *r, int *res)
+{
+	unsigned int to_submit = r->queued;
+	unsigned int tail = *(r->sq_tail);
+	unsigned int completed = 0;
+	int submitted;
+
+	if (to_submit == 0)
+		return 0;
+
+	/* rendo visibili al kernel le operazioni accodate */
+	__atomic_store_n(r->sq_tail, tail + to_submit, __ATOMIC_RELEASE);
+	r->queued = 0;
+
+	/* solo sottomissione: gli invii non bloccanti completano quasi sempre
+		durante la syscall, l'attesa sotto serve per i rimanenti */
+	do
+		submitted = sys_io_uring_enter(r->ring_fd, to_submit, 0, 0);
+	while ((submitted < 0) && (errno == EINTR));
+	if (submitted < 0)
+		submitted = 0;
+
+	/* il kernel consuma le operazioni in ordine: quelle rimaste nell'anello
+		vengono ritirate, altrimenti partirebbero con il blocco successivo
+		puntando a un buffer già riutilizzato */
+	if ((unsigned int)submitted < to_submit)
+		__atomic_store_n(r->sq_tail, tail + submitted, __ATOMIC_RELEASE);
+
+	while (completed < (unsigned int)submitted)
+	{
+		unsigned int head = *(r->cq_head);
+		unsigned int cq_tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+
+		if (head == cq_tail)
+		{
+			/* completamenti non ancora tutti disponibili */
+			if ((sys_io_uring_enter(r->ring_fd, 0, submitted - completed, IORING_ENTER_GETEVENTS) < 0) &&
+				 (errno != EINTR))
+				return -1;
+			continue;
+		}
+
+		for (; head != cq_tail; head++, completed++)
+		{
+			struct io_uring_cqe *cqe = &(r->cqes[head & *(r->cq_mask)]);
+			if (cqe->user_data < r->entries)
+				res[cqe->user_data] = cqe->res;
+		}
+		__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return completed;
+}
+
+#else /* IO_URING */
+
+/* compilato senza supporto io_uring: il motore resta quello bloccante */
+
+uring_t *uring_init(unsigned int entries, size_t buf_size)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+void uring_destroy(uring_t *r)
+{
+}
+
+unsigned int uring_entries(uring_t *r)
+{
+	return 0;
+}
+
+char *uring_buffer(uring_t *r)
+{
+	return NULL;
+}
+
+size_t uring_buffer_size(uring_t *r)
+{
+	return 0;
+}
+
+int uring_prep_sendmsg(uring_t *r, int fd, const struct msghdr *msg, uint64_t user_data)
+{
+	return -1;
+}
+
+int uring_submit_wait(uring_t *r, int *res)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif /* IO_URING */
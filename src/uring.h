@@ -0,0 +1,87 @@
+/**
+ * @brief il seguente file contiene le dichiarazioni di un'interfaccia minima
+ * 		verso io_uring (tramite le syscall, senza liburing) utilizzata dal
+ * 		motore di invio dei messaggi in connections.c
+ * @warning un'istanza non è thread safe: ogni thread utilizza la propria
+ * 			(disponibile solo se compilato con -DIO_URING)
+ *
+ * @file uring.h
+ * @author Marco Costa - 545144 - mcsx97@gmail.com
+ * @date 2018-09-10
+ *
+ * @note Si dichiara che l'opera è in ogni sua parte (eccetto ove specificato)
+ * 			opera originale dell'autore
+ */
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct uring uring_t;
+struct msghdr;
+
+/**
+ * @brief crea una coda di sottomissione di "entries" operazioni ed alloca
+ * 		"buf_size" byte di buffer in cui il chiamante può comporre gli invii
+ *
+ * @param entries numero di operazioni (potenza di 2)
+ * @param buf_size dimensione dei buffer
+ * @return uring_t* l'istanza | NULL (errno settato) se io_uring non è
+ * 				disponibile
+ */
+uring_t *uring_init(unsigned int entries, size_t buf_size);
+
+/**
+ * @brief libera l'istanza e i buffer
+ *
+ * @param r istanza
+ */
+void uring_destroy(uring_t *r);
+
+/**
+ * @return unsigned int numero di operazioni accodabili prima di una submit
+ */
+unsigned int uring_entries(uring_t *r);
+
+/**
+ * @return char* buffer dell'istanza
+ */
+char *uring_buffer(uring_t *r);
+
+/**
+ * @return size_t dimensione del buffer dell'istanza
+ */
+size_t uring_buffer_size(uring_t *r);
+
+/**
+ * @brief accoda l'invio non bloccante (IORING_OP_SENDMSG) dei vettori di
+ * 		"msg" su "fd": con la socket piena l'invio è parziale come per
+ * 		writev, senza interrompere altre operazioni
+ * @warning "msg" e i suoi vettori devono restare validi fino al termine
+ * 			di uring_submit_wait
+ *
+ * @param r istanza
+ * @param fd descrittore
+ * @param msg vettori da inviare
+ * @param user_data valore restituito nel completamento
+ * @return int 0 se ok, -1 se la coda è piena
+ */
+int uring_prep_sendmsg(uring_t *r, int fd, const struct msghdr *msg, uint64_t user_data);
+
+/**
+ * @brief sottomette le operazioni accodate con una sola syscall e attende
+ * 		il completamento di quelle accettate dal kernel. Le operazioni non
+ * 		accettate vengono ritirate dalla coda e non verranno mai eseguite:
+ * 		sono sempre le ultime accodate
+ *
+ * @param r istanza
+ * @param res vettore dei risultati indicizzato per user_data (byte
+ * 			inviati o -errno), deve avere almeno uring_entries posizioni
+ * @return int numero di operazioni accettate e completate (0 se il kernel
+ * 			non ne ha accettata nessuna), -1 se l'attesa dei completamenti
+ * 			fallisce (errno settato)
+ */
+int uring_submit_wait(uring_t *r, int *res);
+
+#endif
@@ -16,6 +16,7 @@
 #include <errno.h>
 #include <limits.h>
 #include <ctype.h>
+#include <sys/resource.h>
 
 #include "utils.h"
 
@@ -91,15 +92,37 @@ void init_default_conf(conf_param **dest)
 	(*dest)->dir_name = safe_malloc((strlen(DEFAULT_DIR_NAME) + 1) * sizeof(char));
 	(*dest)->stat_filename = safe_malloc((strlen(DEFAULT_STAT_FILENAME) + 1) * sizeof(char));
 	(*dest)->unix_path = safe_malloc((strlen(DEFAULT_UNIX_PATH) + 1) * sizeof(char));
+	(*dest)->event_backend = safe_malloc((strlen(DEFAULT_EVENT_BACKEND) + 1) * sizeof(char));
+	(*dest)->io_engine = safe_malloc((strlen(DEFAULT_IO_ENGINE) + 1) * sizeof(char));
+	(*dest)->output_full_policy = safe_malloc((strlen(DEFAULT_OUTPUT_FULL_POLICY) + 1) * sizeof(char));
+	(*dest)->queue_full_policy = safe_malloc((strlen(DEFAULT_QUEUE_FULL_POLICY) + 1) * sizeof(char));
+	(*dest)->db_journal_mode = safe_malloc((strlen(DEFAULT_DB_JOURNAL_MODE) + 1) * sizeof(char));
 	strcpy((*dest)->dir_name, c.dir_name);
 	strcpy((*dest)->stat_filename, c.stat_filename);
 	strcpy((*dest)->unix_path, c.unix_path);
+	strcpy((*dest)->event_backend, c.event_backend);
+	strcpy((*dest)->io_engine, c.io_engine);
+	strcpy((*dest)->output_full_policy, c.output_full_policy);
+	strcpy((*dest)->queue_full_policy, c.queue_full_policy);
+	strcpy((*dest)->db_journal_mode, c.db_journal_mode);
 
 	(*dest)->max_connections = c.max_connections;
 	(*dest)->max_file_size = c.max_file_size;
 	(*dest)->max_hist_msg = c.max_hist_msg;
 	(*dest)->threads_in_pool = c.threads_in_pool;
 	(*dest)->max_msg_size = c.max_msg_size;
+	(*dest)->io_threads = c.io_threads;
+	(*dest)->max_output_size = c.max_output_size;
+	(*dest)->max_queued_msgs = c.max_queued_msgs;
+	(*dest)->queue_high_watermark = c.queue_high_watermark;
+	(*dest)->reserved_slaves = c.reserved_slaves;
+	(*dest)->interactive_weight = c.interactive_weight;
+	(*dest)->min_threads_in_pool = c.min_threads_in_pool;
+	(*dest)->pool_idle_timeout = c.pool_idle_timeout;
+	(*dest)->wal_checkpoint_pages = c.wal_checkpoint_pages;
+	(*dest)->group_commit_ms = c.group_commit_ms;
+	(*dest)->group_commit_ops = c.group_commit_ops;
+	(*dest)->chat_cache_size = c.chat_cache_size;
 }
 
 void format_string(char *source)
@@ -178,6 +201,14 @@ conf_param *parseconf(FILE *f)
 				sub_parsestring(&(c->dir_name), data_value);
 			else if (strcmp(data_name, "StatFileName") == 0)
 				sub_parsestring(&(c->stat_filename), data_value);
+			else if (strcmp(data_name, "EventBackend") == 0)
+				sub_parsestring(&(c->event_backend), data_value);
+			else if (strcmp(data_name, "IoEngine") == 0)
+				sub_parsestring(&(c->io_engine), data_value);
+			else if (strcmp(data_name, "OutputFullPolicy") == 0)
+				sub_parsestring(&(c->output_full_policy), data_value);
+			else if (strcmp(data_name, "QueueFullPolicy") == 0)
+				sub_parsestring(&(c->queue_full_policy), data_value);
 			else if (strcmp(data_name, "MaxConnections") == 0)
 			{
 				sub_parselong(c->max_connections, endptr, data_value);
@@ -191,6 +222,15 @@ conf_param *parseconf(FILE *f)
 					c->threads_in_pool = DEFAULT_THREADS_IN_POOL;
 				}
 			}
+			else if (strcmp(data_name, "IoThreads") == 0)
+			{
+				sub_parselong(c->io_threads, endptr, data_value);
+				if ((c->io_threads > MAX_IO_THREADS) || (c->io_threads == 0))
+				{
+					fprintf(stderr, STRING_MAX_VALUE_EXCEEDED, MAX_IO_THREADS, LINE);
+					c->io_threads = DEFAULT_IO_THREADS;
+				}
+			}
 			else if (strcmp(data_name, "MaxMsgSize") == 0)
 			{
 				sub_parselong(c->max_msg_size, endptr, data_value);
@@ -203,6 +243,70 @@ conf_param *parseconf(FILE *f)
 			{
 				sub_parselong(c->max_hist_msg, endptr, data_value);
 			}
+			else if (strcmp(data_name, "MaxOutputSize") == 0)
+			{
+				sub_parselong(c->max_output_size, endptr, data_value);
+			}
+			else if (strcmp(data_name, "MaxQueuedMsgs") == 0)
+			{
+				sub_parselong(c->max_queued_msgs, endptr, data_value);
+				if (c->max_queued_msgs == 0)
+					c->max_queued_msgs = DEFAULT_MAX_QUEUED_MSGS;
+			}
+			else if (strcmp(data_name, "QueueHighWatermark") == 0)
+			{
+				sub_parselong(c->queue_high_watermark, endptr, data_value);
+				if ((c->queue_high_watermark > 100) || (c->queue_high_watermark == 0))
+				{
+					fprintf(stderr, STRING_MAX_VALUE_EXCEEDED, 100, LINE);
+					c->queue_high_watermark = DEFAULT_QUEUE_HIGH_WATERMARK;
+				}
+			}
+			else if (strcmp(data_name, "ReservedSlaves") == 0)
+			{
+				sub_parselong(c->reserved_slaves, endptr, data_value);
+			}
+			else if (strcmp(data_name, "InteractiveWeight") == 0)
+			{
+				sub_parselong(c->interactive_weight, endptr, data_value);
+				if (c->interactive_weight == 0)
+					c->interactive_weight = DEFAULT_INTERACTIVE_WEIGHT;
+			}
+			else if (strcmp(data_name, "MinThreadsInPool") == 0)
+			{
+				sub_parselong(c->min_threads_in_pool, endptr, data_value);
+				if ((c->min_threads_in_pool > MAX_THREADS_IN_POOL) || (c->min_threads_in_pool == 0))
+				{
+					fprintf(stderr, STRING_MAX_VALUE_EXCEEDED, MAX_THREADS_IN_POOL, LINE);
+					c->min_threads_in_pool = DEFAULT_MIN_THREADS_IN_POOL;
+				}
+			}
+			else if (strcmp(data_name, "PoolIdleTimeout") == 0)
+			{
+				sub_parselong(c->pool_idle_timeout, endptr, data_value);
+			}
+			else if (strcmp(data_name, "DBJournalMode") == 0)
+				sub_parsestring(&(c->db_journal_mode), data_value);
+			else if (strcmp(data_name, "WalCheckpointPages") == 0)
+			{
+				sub_parselong(c->wal_checkpoint_pages, endptr, data_value);
+				if (c->wal_checkpoint_pages == 0)
+					c->wal_checkpoint_pages = DEFAULT_WAL_CHECKPOINT_PAGES;
+			}
+			else if (strcmp(data_name, "GroupCommitMs") == 0)
+			{
+				sub_parselong(c->group_commit_ms, endptr, data_value);
+			}
+			else if (strcmp(data_name, "GroupCommitOps") == 0)
+			{
+				sub_parselong(c->group_commit_ops, endptr, data_value);
+				if (c->group_commit_ops == 0)
+					c->group_commit_ops = DEFAULT_GROUP_COMMIT_OPS;
+			}
+			else if (strcmp(data_name, "ChatCacheSize") == 0)
+			{
+				sub_parselong(c->chat_cache_size, endptr, data_value);
+			}
 			else
 			{
 				ERR_BAD_PARSED_FILE;
@@ -244,6 +348,31 @@ void free_conf_param(conf_param *c)
 		free(c->stat_filename);
 		c->stat_filename = NULL;
 	}
+	if (c->event_backend)
+	{
+		free(c->event_backend);
+		c->event_backend = NULL;
+	}
+	if (c->io_engine)
+	{
+		free(c->io_engine);
+		c->io_engine = NULL;
+	}
+	if (c->output_full_policy)
+	{
+		free(c->output_full_policy);
+		c->output_full_policy = NULL;
+	}
+	if (c->queue_full_policy)
+	{
+		free(c->queue_full_policy);
+		c->queue_full_policy = NULL;
+	}
+	if (c->db_journal_mode)
+	{
+		free(c->db_journal_mode);
+		c->db_journal_mode = NULL;
+	}
 
 	if (c)
 		free(c);
@@ -276,6 +405,30 @@ int get_digits_number(int n)
 	return 10;
 }
 
+int fd_table_dim(unsigned int max_connections)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+		return -1;
+
+	/* alcuni container impostano nofile vicino a 2^30: una tabella di quella
+		dimensione per modulo occuperebbe GB */
+	unsigned long dim = (unsigned long)max_connections + FD_TABLE_HEADROOM;
+	if ((rl.rlim_cur != RLIM_INFINITY) && (rl.rlim_cur < dim))
+		dim = rl.rlim_cur;
+
+	return (dim > INT_MAX) ? INT_MAX : (int)dim;
+}
+
+unsigned int name_hash(const char *name)
+{
+	unsigned int h = 2166136261u;
+	for (int i = 0; (i < MAX_NAME_LENGTH) && (name[i]); i++)
+		h = (h ^ (unsigned char)name[i]) * 16777619u;
+	return h;
+}
+
 /**
  * @brief realloca la zona di memoria SENZA CONSERVARE I PRECEDENTI DATI
  * 		- old_len alla fine dell'esecuzione conterrà la nuova dimensione 
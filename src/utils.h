@@ -37,6 +37,23 @@ struct conf_param_s
 	unsigned int max_hist_msg;
 	char *dir_name;
 	char *stat_filename;
+	char *event_backend;
+	unsigned int io_threads;
+	char *io_engine;
+	unsigned int max_output_size;
+	char *output_full_policy;
+	unsigned int max_queued_msgs;
+	unsigned int queue_high_watermark;
+	char *queue_full_policy;
+	unsigned int reserved_slaves;
+	unsigned int interactive_weight;
+	unsigned int min_threads_in_pool;
+	unsigned int pool_idle_timeout;
+	char *db_journal_mode;
+	unsigned int wal_checkpoint_pages;
+	unsigned int group_commit_ms;
+	unsigned int group_commit_ops;
+	unsigned int chat_cache_size;
 };
 
 typedef struct conf_param_s conf_param;
@@ -46,7 +63,16 @@ typedef struct conf_param_s conf_param;
 #define CONF_PARAM_DEFAULT DEFAULT_UNIX_PATH, DEFAULT_MAX_CONNECTIONS,    \
 									DEFAULT_THREADS_IN_POOL, DEFAULT_MAX_MSG_SIZE, \
 									DEFAULT_MAX_FILE_SIZE, DEFAULT_MAX_HIST_MSG,   \
-									DEFAULT_DIR_NAME, DEFAULT_STAT_FILENAME
+									DEFAULT_DIR_NAME, DEFAULT_STAT_FILENAME,       \
+									DEFAULT_EVENT_BACKEND, DEFAULT_IO_THREADS,    \
+									DEFAULT_IO_ENGINE, DEFAULT_MAX_OUTPUT_SIZE,    \
+									DEFAULT_OUTPUT_FULL_POLICY, DEFAULT_MAX_QUEUED_MSGS, \
+									DEFAULT_QUEUE_HIGH_WATERMARK, DEFAULT_QUEUE_FULL_POLICY, \
+									DEFAULT_RESERVED_SLAVES, DEFAULT_INTERACTIVE_WEIGHT, \
+									DEFAULT_MIN_THREADS_IN_POOL, DEFAULT_POOL_IDLE_TIMEOUT, \
+									DEFAULT_DB_JOURNAL_MODE, DEFAULT_WAL_CHECKPOINT_PAGES, \
+									DEFAULT_GROUP_COMMIT_MS, DEFAULT_GROUP_COMMIT_OPS, \
+									DEFAULT_CHAT_CACHE_SIZE
 
 /**
  * @brief inizializza la struttura allocata dinamicamente con i valori di default
@@ -121,6 +147,26 @@ void *safe_c_realloc(void *p, int *old_len, int new_len);
  */
 int get_digits_number(int x);
 
+/**
+ * @brief dimensione delle tabelle indicizzate per descrittore (sessioni,
+ * 		caselle delle code, presenza, gruppi): il limite RLIMIT_NOFILE del
+ * 		processo, ma non oltre max_connections + FD_TABLE_HEADROOM.
+ * 		Le connessioni su descrittori oltre la tabella vengono rifiutate
+ * 
+ * @param max_connections connessioni previste (MaxConnections)
+ * @return int dimensione | -1 se il limite non è leggibile
+ */
+int fd_table_dim(unsigned int max_connections);
+
+/**
+ * @brief hash FNV-1a dei primi MAX_NAME_LENGTH caratteri di "name" (nomi di
+ * 		utenti e gruppi nelle tabelle dei registri in memoria)
+ * 
+ * @param name nome
+ * @return unsigned int hash
+ */
+unsigned int name_hash(const char *name);
+
 #define ERROR_NULL(string)     \
 	do                          \
 	{                           \